@@ -1,5 +1,9 @@
 #include <render/shader.h>
 #include <render/texture.h>
+#include <render/assets.h>
+#include <render/frustum.h>
+#include <render/occlusion.h>
+#include <pose.cpp>
 
 #ifndef BUFFER_OFFSET
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
@@ -7,13 +11,17 @@
 
 struct AnimatedModel {
 	// Shader variable IDs
-	GLuint mvpMatrixID;
-	GLuint jointMatricesID;
-	GLuint lightPositionID;
-	GLuint lightIntensityID;
-	GLuint cameraPositionID;
-	GLuint textureSamplerID;
-	GLuint programID;
+	struct SkinningProgram {
+		GLuint mvpMatrixID;
+		GLuint jointMatricesID;
+		GLuint lightPositionID;
+		GLuint lightIntensityID;
+		GLuint cameraPositionID;
+		GLuint textureSamplerID;
+		GLuint programID;
+	};
+	SkinningProgram fullProgram;	// Linear blend skinning over four joints
+	SkinningProgram lodProgram;		// Rigid skinning to the dominant joint, used at distance
 
 	glm::vec3 lightIntensity;
 	glm::vec3 lightPosition;
@@ -28,7 +36,7 @@ struct AnimatedModel {
 		std::map<int, GLuint> vbos;
 		GLuint textureID;
 		GLuint instanceVBO;
-		int instanceCount;
+		int instanceCapacity;
 	};
 	std::vector<PrimitiveObject> primitiveObjects;
 
@@ -45,21 +53,73 @@ struct AnimatedModel {
 	};
 	std::vector<SkinObject> skinObjects;
 
-	// Animation 
-	struct SamplerObject {
-		std::vector<float> input;
-		std::vector<glm::vec4> output;
-		int interpolation;
-	};
-	struct ChannelObject {
-		int sampler;
-		std::string targetPath;
-		int targetNode;
+	// Animation clips, compressed at load time (see clip.cpp)
+	std::vector<CompressedClip> clips;
+	ClipCompressionSettings clipSettings;
+
+	// Animation level of detail (distances match the fog range in the shaders)
+	struct AnimationLOD {
+		float fullRateDistance = 1024.0f;		// Evaluated every frame up to FOG_MIN_DIST
+		float reducedJointDistance = 1536.0f;	// Beyond this only the upper skeleton is animated
+		float cullDistance = 2048.0f;			// Fully fogged past FOG_MAX_DIST
+		float cheapShaderDistance = 1024.0f;
+		float reducedInterval = 0.25f;			// Animation time between evaluations at reduced rate
+		int reducedJointDepth = 3;
 	};
-	struct AnimationObject {
-		std::vector<SamplerObject> samplers;
+	AnimationLOD lod;
+
+	// Pose blending works on scratch poses from a fixed pool, starting from the rest pose
+	PosePool posePool;
+	Pose restPose;
+	std::vector<Pose> additiveReferences;	// First frame of each clip, the zero point for additive layers
+	std::vector<glm::mat4> localTransforms;
+	std::vector<glm::mat4> globalTransforms;
+
+	// A playback state shared by a group of instances, each with its own joint palette
+	struct AnimationSlot {
+		int clip = 0;
+		float timeScale = 1.0f;
+		float timeOffset = 0.0f;
+
+		// Crossfade out of the previous clip
+		int previousClip = -1;
+		float fadeStart = 0.0f;
+		float fadeDuration = 0.0f;
+
+		// Additive layer applied on top
+		int additiveClip = -1;
+		float additiveWeight = 0.0f;
+
+		std::vector<glm::mat4> jointMatrices;
+
+		// Joint palettes bracketing the current time at reduced update rates
+		std::vector<glm::mat4> palette0;
+		std::vector<glm::mat4> palette1;
+		float paletteTime0 = 0.0f;
+		float paletteTime1 = -1.0f;
+		int paletteDepth = -1;
+
+		// Visible instances this frame and where they start in the instance buffer
+		std::vector<glm::mat4> nearTransforms;
+		std::vector<glm::mat4> farTransforms;
+		int firstNear = 0;
+		int firstFar = 0;
+		float nearestDistance = 0.0f;
 	};
-	std::vector<AnimationObject> animationObjects;
+	std::vector<AnimationSlot> slots;
+	float currentTime = 0.0f;
+
+	// Instances from the tile generator with their slots, and the visible ones grouped by slot
+	std::vector<glm::mat4> instanceTransforms;
+	std::vector<int> instanceSlots;
+	std::vector<glm::mat4> visibleTransforms;
+
+	// Bounding sphere of the rest pose in model space
+	glm::vec3 boundsCenter;
+	float boundsRadius;
+
+	// Depth of each node below the skeleton root, for reduced joint sets
+	std::vector<int> nodeDepths;
 
 	glm::mat4 getNodeTransform(const tinygltf::Node& node) {
 		glm::mat4 transform(1.0f);
@@ -159,233 +219,261 @@ struct AnimatedModel {
 		return skinObjects;
 	}
 
-	int findKeyframeIndex(const std::vector<float>& times, float animationTime)
+	std::vector<CompressedClip> prepareAnimation(const tinygltf::Model& model)
 	{
-		int left = 0;
-		int right = times.size() - 1;
-
-		while (left <= right) {
-			int mid = (left + right) / 2;
-
-			if (mid + 1 < times.size() && times[mid] <= animationTime && animationTime < times[mid + 1]) {
-				return mid;
-			}
-			else if (times[mid] > animationTime) {
-				right = mid - 1;
-			}
-			else { // animationTime >= times[mid + 1]
-				left = mid + 1;
-			}
+		std::vector<CompressedClip> clips;
+		size_t sourceBytes = 0, compressedBytes = 0;
+		for (const auto& anim : model.animations) {
+			CompressedClip clip;
+			clip.build(model, anim, clipSettings);
+			sourceBytes += clip.sourceBytes;
+			compressedBytes += clip.compressedBytes();
+			clips.push_back(clip);
 		}
-
-		// Target not found
-		return times.size() - 2;
+		if (!clips.empty()) {
+			std::cout << "Compressed " << clips.size() << " animation clip(s): " << sourceBytes / 1024
+				<< " KB -> " << compressedBytes / 1024 << " KB" << std::endl;
+		}
+		return clips;
 	}
 
-	std::vector<AnimationObject> prepareAnimation(const tinygltf::Model& model)
-	{
-		std::vector<AnimationObject> animationObjects;
-		for (const auto& anim : model.animations) {
-			AnimationObject animationObject;
-
-			for (const auto& sampler : anim.samplers) {
-				SamplerObject samplerObject;
-
-				const tinygltf::Accessor& inputAccessor = model.accessors[sampler.input];
-				const tinygltf::BufferView& inputBufferView = model.bufferViews[inputAccessor.bufferView];
-				const tinygltf::Buffer& inputBuffer = model.buffers[inputBufferView.buffer];
-
-				assert(inputAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-				assert(inputAccessor.type == TINYGLTF_TYPE_SCALAR);
-
-				// Input (time) values
-				samplerObject.input.resize(inputAccessor.count);
-
-				const unsigned char* inputPtr = &inputBuffer.data[inputBufferView.byteOffset + inputAccessor.byteOffset];
-				const float* inputBuf = reinterpret_cast<const float*>(inputPtr);
+	void releaseBufferData() {
+		// Geometry lives on the GPU and clips are compressed, so the raw glTF buffers are no longer needed
+		for (auto& buffer : model.buffers) {
+			std::vector<unsigned char>().swap(buffer.data);
+		}
+	}
 
-				// Read input (time) values
-				int stride = inputAccessor.ByteStride(inputBufferView);
-				for (size_t i = 0; i < inputAccessor.count; ++i) {
-					samplerObject.input[i] = *reinterpret_cast<const float*>(inputPtr + i * stride);
-				}
+	void computeNodeDepths(int nodeIndex, int depth) {
+		nodeDepths[nodeIndex] = depth;
+		for (int childIndex : model.nodes[nodeIndex].children) {
+			computeNodeDepths(childIndex, depth + 1);
+		}
+	}
 
-				const tinygltf::Accessor& outputAccessor = model.accessors[sampler.output];
-				const tinygltf::BufferView& outputBufferView = model.bufferViews[outputAccessor.bufferView];
-				const tinygltf::Buffer& outputBuffer = model.buffers[outputBufferView.buffer];
+	void prepareLOD() {
+		const tinygltf::Skin& skin = model.skins[0];
 
-				assert(outputAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+		nodeDepths.assign(model.nodes.size(), 0);
+		computeNodeDepths(skin.joints[0], 0);
 
-				const unsigned char* outputPtr = &outputBuffer.data[outputBufferView.byteOffset + outputAccessor.byteOffset];
-				const float* outputBuf = reinterpret_cast<const float*>(outputPtr);
+		// Bound the skeleton in its rest pose, with slack for limbs swinging out during animation
+		const std::vector<glm::mat4>& joints = skinObjects[0].globalJointTransforms;
+		glm::vec3 lo(joints[0][3]), hi(joints[0][3]);
+		for (const auto& joint : joints) {
+			lo = glm::min(lo, glm::vec3(joint[3]));
+			hi = glm::max(hi, glm::vec3(joint[3]));
+		}
+		boundsCenter = 0.5f * (lo + hi);
+		boundsRadius = glm::max(1.5f * glm::length(hi - lo), 1.0f);
+	}
 
-				int outputStride = outputAccessor.ByteStride(outputBufferView);
+	void preparePoses() {
+		size_t nodeCount = model.nodes.size();
+		restPose.resize(nodeCount);
+		for (size_t i = 0; i < nodeCount; ++i) {
+			const tinygltf::Node& node = model.nodes[i];
+			restPose.translations[i] = node.translation.size() == 3 ?
+				glm::vec3(node.translation[0], node.translation[1], node.translation[2]) : glm::vec3(0.0f);
+			restPose.rotations[i] = node.rotation.size() == 4 ?
+				glm::quat(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]) : glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			restPose.scales[i] = node.scale.size() == 3 ?
+				glm::vec3(node.scale[0], node.scale[1], node.scale[2]) : glm::vec3(1.0f);
+		}
 
-				// Output values
-				samplerObject.output.resize(outputAccessor.count);
+		additiveReferences.resize(clips.size());
+		for (size_t i = 0; i < clips.size(); ++i) {
+			additiveReferences[i].resize(nodeCount);
+			additiveReferences[i].copyFrom(restPose);
+			sampleClip(clips[i], 0.0f, nodeDepths, -1, additiveReferences[i]);
+		}
 
-				for (size_t i = 0; i < outputAccessor.count; ++i) {
+		// Current, crossfade source and additive layer are the most ever live at once
+		posePool.initialize(nodeCount, 3);
+		localTransforms.resize(nodeCount);
+		globalTransforms.resize(nodeCount);
 
-					if (outputAccessor.type == TINYGLTF_TYPE_VEC3) {
-						memcpy(&samplerObject.output[i], outputPtr + i * 3 * sizeof(float), 3 * sizeof(float));
-					}
-					else if (outputAccessor.type == TINYGLTF_TYPE_VEC4) {
-						memcpy(&samplerObject.output[i], outputPtr + i * 4 * sizeof(float), 4 * sizeof(float));
-					}
-					else {
-						std::cout << "Unsupport accessor type ..." << std::endl;
-					}
+		// Default slot plays the first clip, as a single-clip model always has
+		slots.clear();
+		addSlot(0, 1.0f, 0.0f);
+	}
 
-				}
+	int addSlot(int clip, float timeScale, float timeOffset) {
+		if (skinObjects.empty()) {
+			return -1;
+		}
 
-				animationObject.samplers.push_back(samplerObject);
-			}
+		AnimationSlot slot;
+		slot.clip = glm::clamp(clip, 0, static_cast<int>(clips.size()) - 1);
+		slot.timeScale = timeScale;
+		slot.timeOffset = timeOffset;
+		slot.jointMatrices = skinObjects[0].jointMatrices;
+		slot.palette0 = slot.jointMatrices;
+		slot.palette1 = slot.jointMatrices;
+		slots.push_back(slot);
+		return static_cast<int>(slots.size()) - 1;
+	}
 
-			animationObjects.push_back(animationObject);
+	// Switch a slot to another clip, crossfading over fadeDuration (animation time)
+	void play(int slotIndex, int clip, float fadeDuration) {
+		if (slotIndex < 0 || slotIndex >= static_cast<int>(slots.size())) {
+			return;
+		}
+		AnimationSlot& slot = slots[slotIndex];
+		if (clip == slot.clip || clip < 0 || clip >= static_cast<int>(clips.size())) {
+			return;
 		}
-		return animationObjects;
+		slot.previousClip = fadeDuration > 0.0f ? slot.clip : -1;
+		slot.clip = clip;
+		slot.fadeStart = currentTime;
+		slot.fadeDuration = fadeDuration;
+		slot.paletteTime1 = -1.0f;
 	}
 
-	void updateAnimation(
-		const tinygltf::Model& model,
-		const tinygltf::Animation& anim,
-		const AnimationObject& animationObject,
-		float time,
-		std::vector<glm::mat4>& nodeTransforms)
-	{
-		// There are many channels so we have to accumulate the transforms 
-		for (const auto& channel : anim.channels) {
-			int targetNodeIndex = channel.target_node;
-			const auto& sampler = anim.samplers[channel.sampler];
-
-			// Access output (value) data for the channel
-			const tinygltf::Accessor& outputAccessor = model.accessors[sampler.output];
-			const tinygltf::BufferView& outputBufferView = model.bufferViews[outputAccessor.bufferView];
-			const tinygltf::Buffer& outputBuffer = model.buffers[outputBufferView.buffer];
-
-			// Get the time values for the keyframes
-			const std::vector<float>& times = animationObject.samplers[channel.sampler].input;
-			float animationTime = fmod(time, times.back());
-
-			// DONE: Find the keyframe for the current animation time
-			int keyframeIndex = findKeyframeIndex(times, animationTime);
-
-			// Get the current and next keyframe values
-			const unsigned char* outputPtr = &outputBuffer.data[outputBufferView.byteOffset + outputAccessor.byteOffset];
-			const float* outputBuf = reinterpret_cast<const float*>(outputPtr);
-
-			// Add interpolation for smooth interpolation
-			if (channel.target_path == "translation") {
-				// Get the translation data
-				glm::vec3 translation0, translation1;
-				memcpy(&translation0, outputPtr + keyframeIndex * 3 * sizeof(float), 3 * sizeof(float));
-				memcpy(&translation1, outputPtr + (keyframeIndex + 1) * 3 * sizeof(float), 3 * sizeof(float));
-
-				// Interpolate between the keyframes
-				float t = (animationTime - times[keyframeIndex]) / (times[keyframeIndex + 1] - times[keyframeIndex]);
-				glm::vec3 translation = glm::mix(translation0, translation1, t);
-
-				// Apply the translation to the node transform
-				nodeTransforms[targetNodeIndex] = glm::translate(nodeTransforms[targetNodeIndex], translation);
-			}
-			else if (channel.target_path == "rotation") {
-				// Get the rotation data
-				glm::quat rotation0, rotation1;
-				memcpy(&rotation0, outputPtr + keyframeIndex * 4 * sizeof(float), 4 * sizeof(float));
-				memcpy(&rotation1, outputPtr + (keyframeIndex + 1) * 4 * sizeof(float), 4 * sizeof(float));
-
-				// Interpolate between the keyframes
-				float t = (animationTime - times[keyframeIndex]) / (times[keyframeIndex + 1] - times[keyframeIndex]);
-				glm::quat rotation = glm::slerp(rotation0, rotation1, t);
-
-				// Apply the rotation to the node transform
-				nodeTransforms[targetNodeIndex] *= glm::mat4_cast(rotation);
-			}
-			else if (channel.target_path == "scale") {
-				// Get the scale data
-				glm::vec3 scale0, scale1;
-				memcpy(&scale0, outputPtr + keyframeIndex * 3 * sizeof(float), 3 * sizeof(float));
-				memcpy(&scale1, outputPtr + (keyframeIndex + 1) * 3 * sizeof(float), 3 * sizeof(float));
-
-				// Interpolate between the keyframes
-				float t = (animationTime - times[keyframeIndex]) / (times[keyframeIndex + 1] - times[keyframeIndex]);
-				glm::vec3 scale = glm::mix(scale0, scale1, t);
-
-				// Apply the scale to the node transform
-				nodeTransforms[targetNodeIndex] = glm::scale(nodeTransforms[targetNodeIndex], scale);
-			}
+	void setAdditive(int slotIndex, int clip, float weight) {
+		if (slotIndex < 0 || slotIndex >= static_cast<int>(slots.size())) {
+			return;
 		}
+		AnimationSlot& slot = slots[slotIndex];
+		slot.additiveClip = clip < static_cast<int>(clips.size()) ? clip : -1;
+		slot.additiveWeight = weight;
+		slot.paletteTime1 = -1.0f;
 	}
 
-	void updateSkinning(const std::vector<glm::mat4>& nodeTransforms) {
-		// Recompute joint matrices
+	void evaluateSlot(const AnimationSlot& slot, float time, int maxDepth, std::vector<glm::mat4>& jointMatrices) {
+		const tinygltf::Skin& skin = model.skins[0];
+		const SkinObject& skinObject = skinObjects[0];
+		float localTime = time * slot.timeScale + slot.timeOffset;
+
+		int current = posePool.acquire();
+		Pose& pose = posePool[current];
+		pose.copyFrom(restPose);
+		sampleClip(clips[slot.clip], localTime, nodeDepths, maxDepth, pose);
+
+		// Crossfade from the previous clip
+		float fade = slot.fadeDuration > 0.0f ? (time - slot.fadeStart) / slot.fadeDuration : 1.0f;
+		if (slot.previousClip >= 0 && fade < 1.0f) {
+			int previous = posePool.acquire();
+			Pose& from = posePool[previous];
+			from.copyFrom(restPose);
+			sampleClip(clips[slot.previousClip], localTime, nodeDepths, maxDepth, from);
+			blendPoses(from, pose, glm::max(fade, 0.0f), pose);
+			posePool.release(previous);
+		}
 
-		for (auto& skinObject : skinObjects) {
-			const tinygltf::Skin& skin = model.skins[0];
+		// Additive layer, relative to its own first frame
+		if (slot.additiveClip >= 0 && slot.additiveWeight > 0.0f) {
+			int additive = posePool.acquire();
+			Pose& layer = posePool[additive];
+			layer.copyFrom(restPose);
+			sampleClip(clips[slot.additiveClip], localTime, nodeDepths, maxDepth, layer);
+			addPose(pose, layer, additiveReferences[slot.additiveClip], slot.additiveWeight, pose);
+			posePool.release(additive);
+		}
 
-			// Reorder global joint transforms according to skin.joints
-			std::vector<glm::mat4> reorderedGlobalJointTransforms(skinObject.globalJointTransforms.size());
-			for (size_t j = 0; j < skinObject.globalJointTransforms.size(); ++j) {
-				int jointIndex = skin.joints[j];
-				reorderedGlobalJointTransforms[j] = nodeTransforms[jointIndex];
-			}
+		poseToMatrices(pose, localTransforms);
+		posePool.release(current);
 
-			// Update globalJointTransforms with reordered transforms
-			skinObject.globalJointTransforms = reorderedGlobalJointTransforms;
+		glm::mat4 parentTransform(1.0f);
+		computeGlobalNodeTransform(model, localTransforms, skin.joints[0], parentTransform, globalTransforms);
 
-			// Recompute joint matrices
-			for (size_t j = 0; j < skinObject.globalJointTransforms.size(); ++j) {
-				skinObject.jointMatrices[j] = skinObject.globalJointTransforms[j] * skinObject.inverseBindMatrices[j];
-			}
+		// Skinning matrices in skin.joints order
+		for (size_t j = 0; j < skin.joints.size(); ++j) {
+			jointMatrices[j] = globalTransforms[skin.joints[j]] * skinObject.inverseBindMatrices[j];
 		}
 	}
 
 	void update(float time) {
-		// Update node transforms using the active animation
-		const tinygltf::Skin& skin = model.skins[0];
-		std::vector<glm::mat4> nodeTransforms(model.nodes.size(), glm::mat4(1.0f));
+		currentTime = time;
+		if (skinObjects.empty() || clips.empty()) {
+			return;
+		}
 
-		// Apply animation
-		if (!model.animations.empty() && !animationObjects.empty()) {
-			const auto& anim = model.animations[0];
-			const auto& animationObject = animationObjects[0];
+		for (auto& slot : slots) {
+			// Drop finished crossfades
+			if (slot.previousClip >= 0 && time - slot.fadeStart >= slot.fadeDuration) {
+				slot.previousClip = -1;
+			}
 
-			updateAnimation(model, anim, animationObject, time, nodeTransforms);
-		}
+			// Nothing on screen, so nothing to animate
+			if (slot.nearTransforms.empty() && slot.farTransforms.empty()) {
+				continue;
+			}
 
-		glm::mat4 parentTransform(1.0f);
-		std::vector<glm::mat4> globalNodeTransforms(skin.joints.size());
-		computeGlobalNodeTransform(model, nodeTransforms, skin.joints[0], parentTransform, globalNodeTransforms);
+			int maxDepth = slot.nearestDistance > lod.reducedJointDistance ? lod.reducedJointDepth : -1;
+			if (slot.nearestDistance <= lod.fullRateDistance) {
+				evaluateSlot(slot, time, maxDepth, slot.jointMatrices);
+				slot.paletteTime1 = -1.0f;
+				continue;
+			}
 
-		// Apply skinning
-		updateSkinning(globalNodeTransforms);
+			// Reduced rate: evaluate on a fixed grid of animation times and blend between the two
+			// palettes around the current time. The grid is in animation time so this never lags.
+			float interval = lod.reducedInterval;
+			float t0 = floor(time / interval) * interval;
+			if (slot.paletteTime1 < 0.0f || t0 != slot.paletteTime0 || maxDepth != slot.paletteDepth) {
+				if (slot.paletteTime1 >= 0.0f && t0 == slot.paletteTime1 && maxDepth == slot.paletteDepth) {
+					slot.palette0.swap(slot.palette1);
+				}
+				else {
+					evaluateSlot(slot, t0, maxDepth, slot.palette0);
+				}
+				evaluateSlot(slot, t0 + interval, maxDepth, slot.palette1);
+				slot.paletteTime0 = t0;
+				slot.paletteTime1 = t0 + interval;
+				slot.paletteDepth = maxDepth;
+			}
 
-		// Pass joint matrices to the shader
-		for (const auto& skinObject : skinObjects) {
-			glUniformMatrix4fv(jointMatricesID, skinObject.jointMatrices.size(), GL_FALSE, glm::value_ptr(skinObject.jointMatrices[0]));
+			float t = glm::clamp((time - slot.paletteTime0) / interval, 0.0f, 1.0f);
+			for (size_t j = 0; j < slot.jointMatrices.size(); ++j) {
+				slot.jointMatrices[j] = slot.palette0[j] * (1.0f - t) + slot.palette1[j] * t;
+			}
 		}
 	}
 
-	bool loadModel(tinygltf::Model& model, const char* filename) {
-		tinygltf::TinyGLTF loader;
-		std::string err;
-		std::string warn;
-
-		bool res = loader.LoadASCIIFromFile(&model, &err, &warn, filename);
-		if (!warn.empty()) {
-			std::cout << "WARN: " << warn << std::endl;
+	void updateLOD(const glm::mat4& cameraMatrix, const glm::vec3& cameraPos, const InstanceCulling* culling = nullptr) {
+		// Cull instances outside the view, beyond the fog or in occluded tiles, then split the rest by slot and distance
+		Frustum frustum = ExtractFrustum(cameraMatrix);
+		for (auto& slot : slots) {
+			slot.nearTransforms.clear();
+			slot.farTransforms.clear();
+			slot.nearestDistance = lod.cullDistance;
+		}
+		if (slots.empty()) {
+			return;
 		}
 
-		if (!err.empty()) {
-			std::cout << "ERR: " << err << std::endl;
+		for (size_t i = 0; i < instanceTransforms.size(); ++i) {
+			const glm::mat4& transform = instanceTransforms[i];
+			glm::vec3 center = glm::vec3(transform * glm::vec4(boundsCenter, 1.0f));
+			float distance = glm::length(center - cameraPos);
+			if (distance - boundsRadius > lod.cullDistance) continue;
+			if (!SphereInFrustum(frustum, center, boundsRadius)) continue;
+			if (culling != nullptr && !culling->isVisible(center - glm::vec3(boundsRadius), center + glm::vec3(boundsRadius))) continue;
+
+			int slotIndex = i < instanceSlots.size() ? instanceSlots[i] % slots.size() : 0;
+			AnimationSlot& slot = slots[slotIndex];
+			slot.nearestDistance = glm::min(slot.nearestDistance, distance);
+			if (distance > lod.cheapShaderDistance) slot.farTransforms.push_back(transform);
+			else slot.nearTransforms.push_back(transform);
 		}
 
-		if (!res)
-			std::cout << "Failed to load glTF: " << filename << std::endl;
-		else
-			std::cout << "Loaded glTF: " << filename << std::endl;
+		// Near instances of every slot first, then the far ones
+		visibleTransforms.clear();
+		for (auto& slot : slots) {
+			slot.firstNear = visibleTransforms.size();
+			visibleTransforms.insert(visibleTransforms.end(), slot.nearTransforms.begin(), slot.nearTransforms.end());
+		}
+		for (auto& slot : slots) {
+			slot.firstFar = visibleTransforms.size();
+			visibleTransforms.insert(visibleTransforms.end(), slot.farTransforms.begin(), slot.farTransforms.end());
+		}
+		uploadInstances(visibleTransforms);
+	}
 
-		return res;
+	bool loadModel(tinygltf::Model& model, const char* filename) {
+		// Parsed on the asset workers if main prefetched it
+		return Assets().takeModel(filename, model);
 	}
 
 	std::vector<GLuint> loadTextures(const tinygltf::Model& model) {
@@ -397,20 +485,23 @@ struct AnimatedModel {
 
 			GLuint texID;
 			glGenTextures(1, &texID);
-			glBindTexture(GL_TEXTURE_2D, texID);
 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
-				GL_RGBA, GL_UNSIGNED_BYTE, image.image.data());
+			// Uploaded from the main thread's queue; the image lives in this->model
+			Assets().queueUpload(PRIORITY_NORMAL, [texID, &image]() {
+				glBindTexture(GL_TEXTURE_2D, texID);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
+					GL_RGBA, GL_UNSIGNED_BYTE, image.image.data());
 
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-			glGenerateMipmap(GL_TEXTURE_2D);
+				glGenerateMipmap(GL_TEXTURE_2D);
+				glBindTexture(GL_TEXTURE_2D, 0);
+			});
 
 			textureIDs[i] = texID;
-			glBindTexture(GL_TEXTURE_2D, 0);
 		}
 
 		return textureIDs;
@@ -438,24 +529,40 @@ struct AnimatedModel {
 
 		// Prepare joint matrices
 		skinObjects = prepareSkinning(model);
+		prepareLOD();
 
-		// Prepare animation data 
-		animationObjects = prepareAnimation(model);
+		// Prepare animation data, precompiled if the model has a cooked package
+		MappedPackage package;
+		if (package.open(filepath) && LoadCookedClips(package, clips)) {
+			std::cout << "Loaded " << clips.size() << " cooked animation clip(s)" << std::endl;
+		}
+		else {
+			clips = prepareAnimation(model);
+		}
+		releaseBufferData();
+		preparePoses();
 
-		// Create and compile our GLSL program from the shaders
-		programID = LoadShadersFromFile("../final/shader/animation.vert", "../final/shader/animation.frag");
-		if (programID == 0)
+		// Create and compile our GLSL programs from the shaders
+		fullProgram = loadSkinningProgram("../final/shader/animation.vert");
+		lodProgram = loadSkinningProgram("../final/shader/animation_lod.vert");
+	}
+
+	SkinningProgram loadSkinningProgram(const char* vertexShaderPath) {
+		SkinningProgram program;
+		program.programID = LoadShadersFromFile(vertexShaderPath, "../final/shader/animation.frag");
+		if (program.programID == 0)
 		{
 			std::cerr << "Failed to load shaders." << std::endl;
 		}
 
 		// Get a handle for GLSL variables
-		mvpMatrixID = glGetUniformLocation(programID, "MVP");
-		jointMatricesID = glGetUniformLocation(programID, "jointMatrices");
-		lightPositionID = glGetUniformLocation(programID, "lightPosition");
-		lightIntensityID = glGetUniformLocation(programID, "lightIntensity");
-		cameraPositionID = glGetUniformLocation(programID, "cameraPosition");
-		textureSamplerID = glGetUniformLocation(programID, "textureSampler");
+		program.mvpMatrixID = glGetUniformLocation(program.programID, "MVP");
+		program.jointMatricesID = glGetUniformLocation(program.programID, "jointMatrices");
+		program.lightPositionID = glGetUniformLocation(program.programID, "lightPosition");
+		program.lightIntensityID = glGetUniformLocation(program.programID, "lightIntensity");
+		program.cameraPositionID = glGetUniformLocation(program.programID, "cameraPosition");
+		program.textureSamplerID = glGetUniformLocation(program.programID, "textureSampler");
+		return program;
 	}
 
 	void setupInstanceBuffer(PrimitiveObject& primitiveObject, const std::vector<glm::mat4>& instanceTransforms) {
@@ -474,22 +581,28 @@ struct AnimatedModel {
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		primitiveObject.instanceCount = instanceTransforms.size();
+		primitiveObject.instanceCapacity = instanceTransforms.size();
+	}
+
+	void updateInstanceMatrices(const std::vector<glm::mat4>& newInstanceMatrices, const std::vector<int>& newInstanceSlots) {
+		// Uploaded after culling in updateLOD
+		instanceTransforms = newInstanceMatrices;
+		instanceSlots = newInstanceSlots;
 	}
 
-	void updateInstanceMatrices(const std::vector<glm::mat4>& newInstanceMatrices) {
+	void uploadInstances(const std::vector<glm::mat4>& newInstanceMatrices) {
 		for (auto& primitive : primitiveObjects) {
 			glBindBuffer(GL_ARRAY_BUFFER, primitive.instanceVBO);
 
 			// Check if the data size has changed
-			if (newInstanceMatrices.size() <= primitive.instanceCount) {
+			if (newInstanceMatrices.size() <= primitive.instanceCapacity) {
 				glBufferSubData(GL_ARRAY_BUFFER, 0, newInstanceMatrices.size() * sizeof(glm::mat4), newInstanceMatrices.data());
 			} else {
 				// Reallocate buffer if so
 				glBufferData(GL_ARRAY_BUFFER, newInstanceMatrices.size() * sizeof(glm::mat4), newInstanceMatrices.data(), GL_DYNAMIC_DRAW);
+				primitive.instanceCapacity = newInstanceMatrices.size();
 			}
 
-			primitive.instanceCount = newInstanceMatrices.size();
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
 	}
@@ -596,94 +709,106 @@ struct AnimatedModel {
 	}
 
 	void drawMesh(const std::vector<PrimitiveObject>& primitiveObjects,
-		tinygltf::Model& model, tinygltf::Mesh& mesh) {
+		tinygltf::Model& model, tinygltf::Mesh& mesh,
+		const SkinningProgram& program, int firstInstance, int instanceCount) {
 
 		for (size_t i = 0; i < mesh.primitives.size(); ++i)
 		{
 			GLuint vao = primitiveObjects[i].vao;
-			std::map<int, GLuint> vbos = primitiveObjects[i].vbos;
+			const std::map<int, GLuint>& vbos = primitiveObjects[i].vbos;
 
+			// Point the instance attributes at this batch of instances
 			glBindVertexArray(vao);
 			glBindBuffer(GL_ARRAY_BUFFER, primitiveObjects[i].instanceVBO);
 			for (int i = 0; i < 4; ++i) {
 				glEnableVertexAttribArray(5 + i);
-				glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+				glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+					(void*)(firstInstance * sizeof(glm::mat4) + i * sizeof(glm::vec4)));
 				glVertexAttribDivisor(5 + i, 1);
 			}
 
 			if (primitiveObjects[i].textureID) {
 				glActiveTexture(GL_TEXTURE0);
 				glBindTexture(GL_TEXTURE_2D, primitiveObjects[i].textureID);
-				glUniform1i(textureSamplerID, 0);
+				glUniform1i(program.textureSamplerID, 0);
 			}
 
-			tinygltf::Primitive primitive = mesh.primitives[i];
-			tinygltf::Accessor indexAccessor = model.accessors[primitive.indices];
+			const tinygltf::Primitive& primitive = mesh.primitives[i];
+			const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
 
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos.at(indexAccessor.bufferView));
 
 			glDrawElementsInstanced(primitive.mode, indexAccessor.count,
 				indexAccessor.componentType,
 				BUFFER_OFFSET(indexAccessor.byteOffset),
-				primitiveObjects[i].instanceCount);
+				instanceCount);
 
 			glBindVertexArray(0);
-			for (int i = 0; i < 4; ++i) {
-				glDisableVertexAttribArray(3 + i);
-			}
 		}
 	}
 
 	void drawModelNodes(const std::vector<PrimitiveObject>& primitiveObjects,
-		tinygltf::Model& model, tinygltf::Node& node) {
+		tinygltf::Model& model, tinygltf::Node& node,
+		const SkinningProgram& program, int firstInstance, int instanceCount) {
 		// Draw the mesh at the node, and recursively do so for children nodes
 		if ((node.mesh >= 0) && (node.mesh < model.meshes.size())) {
-			drawMesh(primitiveObjects, model, model.meshes[node.mesh]);
+			drawMesh(primitiveObjects, model, model.meshes[node.mesh], program, firstInstance, instanceCount);
 		}
 		for (size_t i = 0; i < node.children.size(); i++) {
-			drawModelNodes(primitiveObjects, model, model.nodes[node.children[i]]);
+			drawModelNodes(primitiveObjects, model, model.nodes[node.children[i]], program, firstInstance, instanceCount);
 		}
 	}
 	void drawModel(const std::vector<PrimitiveObject>& primitiveObjects,
-		tinygltf::Model& model) {
+		tinygltf::Model& model, const SkinningProgram& program, int firstInstance, int instanceCount) {
 		// Draw all nodes
 		const tinygltf::Scene& scene = model.scenes[model.defaultScene];
 		for (size_t i = 0; i < scene.nodes.size(); ++i) {
-			drawModelNodes(primitiveObjects, model, model.nodes[scene.nodes[i]]);
+			drawModelNodes(primitiveObjects, model, model.nodes[scene.nodes[i]], program, firstInstance, instanceCount);
 		}
 	}
 
-	void render(glm::mat4 cameraMatrix, glm::vec3 cameraPos) {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glUseProgram(programID);
+	void useProgram(const SkinningProgram& program, const glm::mat4& cameraMatrix, const glm::vec3& cameraPos) {
+		glUseProgram(program.programID);
 
 		// Set camera
 		glm::mat4 mvp = cameraMatrix;
-		glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
+		glUniformMatrix4fv(program.mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
 
-		// Set animation data for linear blend skinning in shader
-		for (size_t skinIndex = 0; skinIndex < skinObjects.size(); ++skinIndex) {
-			const SkinObject& skin = skinObjects[skinIndex];
+		// Set light data
+		glUniform3fv(program.lightPositionID, 1, &lightPosition[0]);
+		glUniform3fv(program.lightIntensityID, 1, &lightIntensity[0]);
+		glUniform3fv(program.cameraPositionID, 1, &cameraPos[0]);
+	}
 
-			// Pass the joint matrices for this skin
-			glUniformMatrix4fv(jointMatricesID, skin.jointMatrices.size(), GL_FALSE,
-				&skin.jointMatrices[0][0][0]);
+	void render(glm::mat4 cameraMatrix, glm::vec3 cameraPos) {
+		if (visibleTransforms.empty()) {
+			return;
 		}
 
-		// Set light data
-		glUniform3fv(lightPositionID, 1, &lightPosition[0]);
-		glUniform3fv(lightIntensityID, 1, &lightIntensity[0]);
-		glUniform3fv(cameraPositionID, 1, &cameraPos[0]);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		// Draw the GLTF model once per slot, full skinning up close and rigid skinning at distance
+		useProgram(fullProgram, cameraMatrix, cameraPos);
+		for (const auto& slot : slots) {
+			if (slot.nearTransforms.empty()) continue;
+			glUniformMatrix4fv(fullProgram.jointMatricesID, slot.jointMatrices.size(), GL_FALSE, &slot.jointMatrices[0][0][0]);
+			drawModel(primitiveObjects, model, fullProgram, slot.firstNear, slot.nearTransforms.size());
+		}
+		useProgram(lodProgram, cameraMatrix, cameraPos);
+		for (const auto& slot : slots) {
+			if (slot.farTransforms.empty()) continue;
+			glUniformMatrix4fv(lodProgram.jointMatricesID, slot.jointMatrices.size(), GL_FALSE, &slot.jointMatrices[0][0][0]);
+			drawModel(primitiveObjects, model, lodProgram, slot.firstFar, slot.farTransforms.size());
+		}
 
-		// Draw the GLTF model
-		drawModel(primitiveObjects, model);
 		glDisable(GL_BLEND);
 		glUseProgram(0);
 		glBindVertexArray(0);
 	}
 
 	void cleanup() {
-		glDeleteProgram(programID);
+		glDeleteProgram(fullProgram.programID);
+		glDeleteProgram(lodProgram.programID);
 	}
 };
\ No newline at end of file
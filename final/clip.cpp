@@ -0,0 +1,368 @@
+#include <render/headers.h>
+
+// Compressed animation clips
+// Rotations are stored as smallest-three quaternions packed into 48 bits and translations/scales
+// are quantised to 16 bits per component over the range of their own track. Keys that can be
+// rebuilt from their neighbours within a tolerance are dropped before quantisation.
+
+enum TrackPath {
+	TRACK_TRANSLATION = 0,
+	TRACK_ROTATION = 1,
+	TRACK_SCALE = 2
+};
+
+struct ClipCompressionSettings {
+	bool reduceKeyframes = true;
+	float translationTolerance = 0.01f;	// Model units
+	float rotationTolerance = 0.0005f;	// Radians
+	float scaleTolerance = 0.0005f;
+};
+
+struct CompressedTrack {
+	int targetNode;
+	int path;
+	bool step;				// STEP interpolation, otherwise linear
+	uint32_t firstKey;		// Offset into the clip's time and key pools
+	uint32_t keyCount;
+	glm::vec3 rangeMin;		// Dequantisation range (translation/scale only)
+	glm::vec3 rangeExtent;
+};
+
+// Smallest-three quaternion packing: 2 bits for the index of the dropped (largest) component
+// and 15 bits for each of the other three, which are bounded by +-1/sqrt(2)
+static const float QUAT_COMPONENT_RANGE = 0.70710678f;
+
+static inline void packQuat(glm::quat q, uint16_t* out) {
+	float c[4] = { q.x, q.y, q.z, q.w };
+	int largest = 0;
+	for (int i = 1; i < 4; ++i) {
+		if (fabs(c[i]) > fabs(c[largest])) largest = i;
+	}
+	// q and -q are the same rotation, so make the dropped component positive
+	float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+
+	uint64_t bits = static_cast<uint64_t>(largest) << 45;
+	int shift = 30;
+	for (int i = 0; i < 4; ++i) {
+		if (i == largest) continue;
+		float v = glm::clamp(c[i] * sign, -QUAT_COMPONENT_RANGE, QUAT_COMPONENT_RANGE);
+		uint64_t qv = static_cast<uint64_t>((v / QUAT_COMPONENT_RANGE * 0.5f + 0.5f) * 32767.0f + 0.5f);
+		bits |= qv << shift;
+		shift -= 15;
+	}
+	out[0] = static_cast<uint16_t>(bits >> 32);
+	out[1] = static_cast<uint16_t>(bits >> 16);
+	out[2] = static_cast<uint16_t>(bits);
+}
+
+static inline glm::quat unpackQuat(const uint16_t* in) {
+	uint64_t bits = (static_cast<uint64_t>(in[0]) << 32) | (static_cast<uint64_t>(in[1]) << 16) | in[2];
+	int largest = static_cast<int>(bits >> 45) & 3;
+
+	float c[4];
+	float sum = 0.0f;
+	int shift = 30;
+	for (int i = 0; i < 4; ++i) {
+		if (i == largest) continue;
+		float v = static_cast<float>((bits >> shift) & 0x7FFF) / 32767.0f;
+		c[i] = (v * 2.0f - 1.0f) * QUAT_COMPONENT_RANGE;
+		sum += c[i] * c[i];
+		shift -= 15;
+	}
+	c[largest] = sqrt(std::max(0.0f, 1.0f - sum));
+	return glm::quat(c[3], c[0], c[1], c[2]);
+}
+
+static inline uint16_t quantiseUnit(float v) {
+	return static_cast<uint16_t>(glm::clamp(v, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+struct CompressedClip {
+	std::string name;
+	float duration;
+	std::vector<CompressedTrack> tracks;
+	std::vector<uint16_t> times;	// One per key, quantised over [0, duration]
+	std::vector<uint16_t> keys;		// Three per key
+
+	size_t sourceBytes = 0;
+
+	size_t compressedBytes() const {
+		return tracks.size() * sizeof(CompressedTrack) + (times.size() + keys.size()) * sizeof(uint16_t);
+	}
+
+	// Read every element of an accessor as a vec4 (vec3 values leave w at 0)
+	static std::vector<glm::vec4> readAccessor(const tinygltf::Model& model, int accessorIndex) {
+		const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+		const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+		const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+		assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+
+		int components = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : accessor.type;
+		int stride = accessor.ByteStride(bufferView);
+		const unsigned char* ptr = &buffer.data[bufferView.byteOffset + accessor.byteOffset];
+
+		std::vector<glm::vec4> values(accessor.count, glm::vec4(0.0f));
+		for (size_t i = 0; i < accessor.count; ++i) {
+			memcpy(&values[i], ptr + i * stride, components * sizeof(float));
+		}
+		return values;
+	}
+
+	static float keyError(int path, const glm::vec4& a, const glm::vec4& b) {
+		if (path == TRACK_ROTATION) {
+			float d = fabs(glm::dot(a, b));
+			return 2.0f * acos(glm::min(d, 1.0f));
+		}
+		return glm::length(glm::vec3(a) - glm::vec3(b));
+	}
+
+	static glm::vec4 interpolateKey(int path, const glm::vec4& a, const glm::vec4& b, float t) {
+		if (path == TRACK_ROTATION) {
+			glm::vec4 bb = glm::dot(a, b) < 0.0f ? -b : b;
+			return glm::normalize(glm::mix(a, bb, t));
+		}
+		return glm::mix(a, b, t);
+	}
+
+	// Greedily drop keys that linear interpolation between the surrounding kept keys reproduces
+	static std::vector<int> reduceKeys(const std::vector<float>& times, const std::vector<glm::vec4>& values,
+		int path, float tolerance) {
+		std::vector<int> kept;
+		int n = static_cast<int>(times.size());
+		kept.push_back(0);
+		if (n < 2) return kept;
+
+		int anchor = 0;
+		for (int i = 1; i < n - 1; ++i) {
+			// Can the segment anchor -> i+1 replace every key in between?
+			bool fits = true;
+			float span = times[i + 1] - times[anchor];
+			for (int j = anchor + 1; j <= i && fits; ++j) {
+				float t = span > 0.0f ? (times[j] - times[anchor]) / span : 0.0f;
+				glm::vec4 approx = interpolateKey(path, values[anchor], values[i + 1], t);
+				fits = keyError(path, approx, values[j]) <= tolerance;
+			}
+			if (!fits) {
+				kept.push_back(i);
+				anchor = i;
+			}
+		}
+		kept.push_back(n - 1);
+		return kept;
+	}
+
+	void build(const tinygltf::Model& model, const tinygltf::Animation& anim, const ClipCompressionSettings& settings) {
+		name = anim.name;
+		duration = 0.0f;
+		tracks.clear();
+		times.clear();
+		keys.clear();
+		sourceBytes = 0;
+
+		for (const auto& sampler : anim.samplers) {
+			const tinygltf::Accessor& inputAccessor = model.accessors[sampler.input];
+			if (!inputAccessor.maxValues.empty()) duration = glm::max(duration, static_cast<float>(inputAccessor.maxValues[0]));
+		}
+		if (duration <= 0.0f) duration = 1.0f;
+
+		for (const auto& channel : anim.channels) {
+			int path = -1;
+			if (channel.target_path == "translation") path = TRACK_TRANSLATION;
+			if (channel.target_path == "rotation") path = TRACK_ROTATION;
+			if (channel.target_path == "scale") path = TRACK_SCALE;
+			if (path < 0) {
+				std::cout << "Unsupported animation path: " << channel.target_path << std::endl;
+				continue;
+			}
+
+			const tinygltf::AnimationSampler& sampler = anim.samplers[channel.sampler];
+			std::vector<glm::vec4> inputs = readAccessor(model, sampler.input);
+			std::vector<glm::vec4> outputs = readAccessor(model, sampler.output);
+			sourceBytes += inputs.size() * sizeof(float) + outputs.size() * sizeof(glm::vec4);
+
+			std::vector<float> keyTimes(inputs.size());
+			for (size_t i = 0; i < inputs.size(); ++i) keyTimes[i] = inputs[i].x;
+
+			// Cubic spline outputs are (in-tangent, value, out-tangent) triples; keep the values
+			std::vector<glm::vec4> keyValues(keyTimes.size());
+			bool cubic = sampler.interpolation == "CUBICSPLINE";
+			for (size_t i = 0; i < keyValues.size(); ++i) {
+				keyValues[i] = cubic ? outputs[3 * i + 1] : outputs[i];
+				if (path == TRACK_ROTATION) keyValues[i] = glm::normalize(keyValues[i]);
+			}
+
+			CompressedTrack track;
+			track.targetNode = channel.target_node;
+			track.path = path;
+			track.step = sampler.interpolation == "STEP";
+			track.firstKey = static_cast<uint32_t>(times.size());
+
+			std::vector<int> kept;
+			if (settings.reduceKeyframes && !track.step) {
+				float tolerance = path == TRACK_TRANSLATION ? settings.translationTolerance :
+					path == TRACK_ROTATION ? settings.rotationTolerance : settings.scaleTolerance;
+				kept = reduceKeys(keyTimes, keyValues, path, tolerance);
+			}
+			else {
+				for (size_t i = 0; i < keyTimes.size(); ++i) kept.push_back(static_cast<int>(i));
+			}
+			track.keyCount = static_cast<uint32_t>(kept.size());
+
+			// Per-track quantisation range
+			track.rangeMin = glm::vec3(0.0f);
+			track.rangeExtent = glm::vec3(0.0f);
+			if (path != TRACK_ROTATION) {
+				glm::vec3 lo(keyValues[kept[0]]), hi(keyValues[kept[0]]);
+				for (int k : kept) {
+					lo = glm::min(lo, glm::vec3(keyValues[k]));
+					hi = glm::max(hi, glm::vec3(keyValues[k]));
+				}
+				track.rangeMin = lo;
+				track.rangeExtent = hi - lo;
+			}
+
+			for (int k : kept) {
+				times.push_back(quantiseUnit(keyTimes[k] / duration));
+				uint16_t packed[3];
+				if (path == TRACK_ROTATION) {
+					const glm::vec4& v = keyValues[k];
+					packQuat(glm::quat(v.w, v.x, v.y, v.z), packed);
+				}
+				else {
+					for (int c = 0; c < 3; ++c) {
+						float extent = track.rangeExtent[c];
+						packed[c] = extent > 0.0f ? quantiseUnit((keyValues[k][c] - track.rangeMin[c]) / extent) : 0;
+					}
+				}
+				keys.insert(keys.end(), packed, packed + 3);
+			}
+
+			tracks.push_back(track);
+		}
+	}
+
+	// Locate the key pair around a (looped) time, returning the blend factor between them
+	float findKeys(const CompressedTrack& track, float time, uint32_t& k0, uint32_t& k1) const {
+		const uint16_t* first = &times[track.firstKey];
+		const uint16_t* last = first + track.keyCount;
+		float qt = fmod(time, duration) / duration * 65535.0f;
+
+		const uint16_t* next = std::upper_bound(first, last, static_cast<uint16_t>(glm::clamp(qt, 0.0f, 65535.0f)));
+		if (next == first) {
+			k0 = k1 = track.firstKey;
+			return 0.0f;
+		}
+		if (next == last) {
+			k0 = k1 = track.firstKey + track.keyCount - 1;
+			return 0.0f;
+		}
+		k1 = track.firstKey + static_cast<uint32_t>(next - first);
+		k0 = k1 - 1;
+		if (track.step) return 0.0f;
+		float t0 = times[k0], t1 = times[k1];
+		return glm::clamp((qt - t0) / (t1 - t0), 0.0f, 1.0f);
+	}
+
+	glm::vec3 decodeVec3(const CompressedTrack& track, uint32_t key) const {
+		const uint16_t* k = &keys[key * 3];
+		return track.rangeMin + track.rangeExtent * glm::vec3(k[0], k[1], k[2]) * (1.0f / 65535.0f);
+	}
+
+	glm::vec3 sampleVec3(const CompressedTrack& track, float time) const {
+		uint32_t k0, k1;
+		float t = findKeys(track, time, k0, k1);
+		return glm::mix(decodeVec3(track, k0), decodeVec3(track, k1), t);
+	}
+
+	glm::quat sampleQuat(const CompressedTrack& track, float time) const {
+		uint32_t k0, k1;
+		float t = findKeys(track, time, k0, k1);
+		glm::quat q0 = unpackQuat(&keys[k0 * 3]);
+		glm::quat q1 = unpackQuat(&keys[k1 * 3]);
+
+		// Keys are close together, so a normalised lerp is indistinguishable from slerp here
+		if (glm::dot(q0, q1) < 0.0f) q1 = -q1;
+		return glm::normalize(glm::quat(
+			glm::mix(q0.w, q1.w, t), glm::mix(q0.x, q1.x, t),
+			glm::mix(q0.y, q1.y, t), glm::mix(q0.z, q1.z, t)));
+	}
+};
+
+// Cooked clips: the pools are stored exactly as build() leaves them, so asset_cooker compresses
+// once and loading is a copy of each range
+static inline void AddCookedClips(PackageWriter& writer, const std::vector<CompressedClip>& clips) {
+	std::vector<PackageClip> packageClips;
+	std::vector<PackageTrack> packageTracks;
+	std::vector<uint16_t> times, keys;
+	for (const auto& clip : clips) {
+		PackageClip packageClip = {};
+		strncpy(packageClip.name, clip.name.c_str(), sizeof(packageClip.name) - 1);
+		packageClip.duration = clip.duration;
+		packageClip.firstTrack = static_cast<uint32_t>(packageTracks.size());
+		packageClip.trackCount = static_cast<uint32_t>(clip.tracks.size());
+		packageClip.firstKey = static_cast<uint32_t>(times.size());
+		packageClip.keyCount = static_cast<uint32_t>(clip.times.size());
+		packageClips.push_back(packageClip);
+
+		for (const auto& track : clip.tracks) {
+			PackageTrack packageTrack;
+			packageTrack.targetNode = track.targetNode;
+			packageTrack.path = track.path;
+			packageTrack.step = track.step ? 1 : 0;
+			packageTrack.firstKey = track.firstKey;
+			packageTrack.keyCount = track.keyCount;
+			memcpy(packageTrack.rangeMin, glm::value_ptr(track.rangeMin), sizeof(packageTrack.rangeMin));
+			memcpy(packageTrack.rangeExtent, glm::value_ptr(track.rangeExtent), sizeof(packageTrack.rangeExtent));
+			packageTracks.push_back(packageTrack);
+		}
+		times.insert(times.end(), clip.times.begin(), clip.times.end());
+		keys.insert(keys.end(), clip.keys.begin(), clip.keys.end());
+	}
+	writer.add(SECTION_CLIPS, packageClips);
+	writer.add(SECTION_TRACKS, packageTracks);
+	writer.add(SECTION_KEY_TIMES, times);
+	writer.add(SECTION_KEY_VALUES, keys);
+}
+
+static inline bool LoadCookedClips(const MappedPackage& package, std::vector<CompressedClip>& clips) {
+	size_t clipCount, trackCount, timeCount, keyCount;
+	const PackageClip* packageClips = package.section<PackageClip>(SECTION_CLIPS, clipCount);
+	const PackageTrack* packageTracks = package.section<PackageTrack>(SECTION_TRACKS, trackCount);
+	const uint16_t* times = package.section<uint16_t>(SECTION_KEY_TIMES, timeCount);
+	const uint16_t* keys = package.section<uint16_t>(SECTION_KEY_VALUES, keyCount);
+	if (packageClips == nullptr || packageTracks == nullptr || times == nullptr || keys == nullptr) {
+		return false;
+	}
+
+	std::vector<CompressedClip> loaded(clipCount);
+	for (size_t i = 0; i < clipCount; ++i) {
+		const PackageClip& packageClip = packageClips[i];
+		size_t lastKey = static_cast<size_t>(packageClip.firstKey) + packageClip.keyCount;
+		if (static_cast<size_t>(packageClip.firstTrack) + packageClip.trackCount > trackCount || lastKey > timeCount || lastKey * 3 > keyCount) {
+			return false;
+		}
+
+		CompressedClip& clip = loaded[i];
+		clip.name = std::string(packageClip.name, strnlen(packageClip.name, sizeof(packageClip.name)));
+		clip.duration = packageClip.duration;
+		for (uint32_t t = 0; t < packageClip.trackCount; ++t) {
+			const PackageTrack& packageTrack = packageTracks[packageClip.firstTrack + t];
+			if (static_cast<size_t>(packageTrack.firstKey) + packageTrack.keyCount > packageClip.keyCount) {
+				return false;
+			}
+			CompressedTrack track;
+			track.targetNode = packageTrack.targetNode;
+			track.path = packageTrack.path;
+			track.step = packageTrack.step != 0;
+			track.firstKey = packageTrack.firstKey;
+			track.keyCount = packageTrack.keyCount;
+			track.rangeMin = glm::make_vec3(packageTrack.rangeMin);
+			track.rangeExtent = glm::make_vec3(packageTrack.rangeExtent);
+			clip.tracks.push_back(track);
+		}
+		clip.times.assign(times + packageClip.firstKey, times + lastKey);
+		clip.keys.assign(keys + static_cast<size_t>(packageClip.firstKey) * 3, keys + lastKey * 3);
+	}
+	clips.swap(loaded);
+	return true;
+}
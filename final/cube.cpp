@@ -1,6 +1,24 @@
 #include <render/texture.h>
+#include <render/assets.h>
 #include <render/shader.h>
-
+#include <render/queue.h>
+#include <render/occlusion.h>
+#include <render/shadows.h>
+
+// Facade and tiling of one building type
+struct CubeStyle {
+	const char* texturePath;
+	float scale;
+	float height;
+};
+
+// Per-instance data: transform plus x = texture layer + 1, y = UV scale, z = UV height
+struct CubeInstance {
+	glm::mat4 transform;
+	glm::vec4 material;
+};
+
+// Every building type in one instanced draw, with the facades in a texture array
 struct Cube {
 
 	glm::vec3 position;
@@ -8,8 +26,12 @@ struct Cube {
 
 	glm::mat4 modelMatrix;
 
+	std::vector<CubeStyle> styles;
 	GLuint instanceBufferID;
-	std::vector<glm::mat4> instanceTransforms;
+	std::vector<CubeInstance> instances;
+	size_t instanceCapacity = 0;
+	size_t visibleCount = 0;	// Leading instances in tiles that passed the occlusion test
+	ShadowCasterList shadowCasters;
 
 	GLfloat vertex_buffer_data[72] = {
 		// Bottom
@@ -145,171 +167,108 @@ struct Cube {
 		0.0f, 1.0f
 	};
 
-	// OpenGL buffers
-	GLuint vertexArrayID;
-	GLuint vertexBufferID;
-	GLuint indexBufferID;
-	GLuint normalBufferID;
-	GLuint uvBufferID;
-	GLuint textureID;
-	GLuint cameraMatrixID;
-	GLuint baseColorFactorID;
-	GLuint isLightID;
-
-	// Shader variable IDs
-	GLuint textureSamplerID;
-	GLuint programID;
-
-	void initialize(GLuint programID, const std::vector<glm::mat4>& instanceTransforms, float scale, float height, const char * filepath) {
-		// Set the instance Matrices
-		this->instanceTransforms = instanceTransforms;
-
-		// Create a vertex array object
-		glGenVertexArrays(1, &vertexArrayID);
-		glBindVertexArray(vertexArrayID);
-
-		// Create a vertex buffer object to store the vertex data		
-		glGenBuffers(1, &vertexBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the normal data		
-		glGenBuffers(1, &normalBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(normal_buffer_data), normal_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the UV data
-		for (int i = 0; i < 48; ++i) uv_buffer_data[i] *= scale;
-		for (int i = 0; i < 24; ++i) uv_buffer_data[2 * i + 1] *= height;
-		glGenBuffers(1, &uvBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
-
-		// Create an index buffer object to store the index data that defines triangle faces
-		glGenBuffers(1, &indexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
-
-		// Create instance buffer
-		glGenBuffers(1, &instanceBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data(), GL_STATIC_DRAW);
+	// Range of the box in the shared static geometry
+	MeshRange mesh;
 
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
+	// OpenGL buffers
+	GLuint textureArrayID;
+
+	// Every style shares the one facade array
+	DrawMaterial material;
+	const QueueProgram* program;
+
+	// transformVectors[i] holds the instances of styles[i]
+	void initialize(ProgramVariants& programs, const std::vector<CubeStyle>& styles, const std::vector<glm::mat4>* transformVectors) {
+		this->styles = styles;
+
+		// Interleave into the shared static geometry (UVs are scaled per instance in the shader)
+		StaticVertex vertices[24];
+		for (int i = 0; i < 24; ++i) {
+			vertices[i].position = glm::vec3(vertex_buffer_data[3 * i], vertex_buffer_data[3 * i + 1], vertex_buffer_data[3 * i + 2]);
+			vertices[i].normal = glm::vec3(normal_buffer_data[3 * i], normal_buffer_data[3 * i + 1], normal_buffer_data[3 * i + 2]);
+			vertices[i].uv = glm::vec2(uv_buffer_data[2 * i], uv_buffer_data[2 * i + 1]);
 		}
+		mesh = StaticGeometry().addMesh(vertices, 24, index_buffer_data, 36);
 
-		// Create and compile our GLSL program from the shaders
-		this->programID = programID;
-
-		// Load the texture into GPU memory
-		textureID = LoadTextureTileBox(filepath);
+		// Instance buffer: mat4 at locations 3-6, material at 7
+		glGenBuffers(1, &instanceBufferID);
+		updateInstances(transformVectors, glm::vec3(0.0f));
 
-		// Get a handle for GLSL variables
-		cameraMatrixID = glGetUniformLocation(programID, "camera");
-		textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-		baseColorFactorID = glGetUniformLocation(programID, "baseColorFactor");
-		isLightID = glGetUniformLocation(programID, "isLight");
-	}
+		// Facade layer and tiling come from each instance
+		program = &programs.get(FEATURE_INSTANCE_MATERIAL);
 
-	void updateInstances(const std::vector<glm::mat4>& instanceTransforms) {
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+		// Load every facade into one texture array, a layer per style
+		std::vector<const char*> texturePaths;
+		for (const auto& style : styles) texturePaths.push_back(style.texturePath);
+		textureArrayID = Assets().loadTextureArray(texturePaths, PRIORITY_HIGH);
 
-		// Check if the data size has changed
-		static size_t currentBufferSize = 0;
-		size_t newSize = instanceTransforms.size() * sizeof(glm::mat4);
-		if (newSize > currentBufferSize) {
-			// Reallocate buffer if needed
-			glBufferData(GL_ARRAY_BUFFER, newSize, nullptr, GL_DYNAMIC_DRAW);
-			currentBufferSize = newSize;
-		}
-		glBufferSubData(GL_ARRAY_BUFFER, 0, newSize, instanceTransforms.data());
+		// The array sampler gets its own unit so it never aliases textureSampler (unit 0)
+		material.textureTarget = GL_TEXTURE_2D_ARRAY;
+		material.textureID = textureArrayID;
+		material.textureUnit = 2;
+		programs.setSamplerUnit("textureArray", material.textureUnit);
 	}
 
-	void render(glm::mat4 cameraMatrix) {
-		glUseProgram(programID);
-
-		glBindVertexArray(vertexArrayID);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glUniform1i(textureSamplerID, 0);
-
-		// Bind the instance buffer
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
+	void updateInstances(const std::vector<glm::mat4>* transformVectors, const glm::vec3& cameraPos, const InstanceCulling* culling = nullptr) {
+		instances.clear();
+		for (size_t style = 0; style < styles.size(); ++style) {
+			glm::vec4 material(static_cast<float>(style + 1), styles[style].scale, styles[style].height, 0.0f);
+			for (const auto& transform : transformVectors[style]) {
+				instances.push_back({ transform, material });
+			}
 		}
 
-		glUniformMatrix4fv(cameraMatrixID, 1, GL_FALSE, &cameraMatrix[0][0]);
-
-		// Set base colour factor to opaque
-		glm::vec4 baseColorFactor = glm::vec4(1.0);
-		glUniform4fv(baseColorFactorID, 1, &baseColorFactor[0]);
-		glUniform1i(isLightID, 0);
-
-		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0, instanceTransforms.size());
-
-		for (int i = 0; i < 4; ++i) {
-			glDisableVertexAttribArray(3 + i);
+		// Nearest first across all styles, so near blocks fill the depth buffer before those behind them
+		auto distance = [&cameraPos](const CubeInstance& instance) {
+			glm::vec2 offset(instance.transform[3].x - cameraPos.x, instance.transform[3].z - cameraPos.z);
+			return glm::dot(offset, offset);
+		};
+		std::sort(instances.begin(), instances.end(), [&distance](const CubeInstance& a, const CubeInstance& b) {
+			return distance(a) < distance(b);
+		});
+
+		// Visible blocks first; the rest only cast shadows
+		visibleCount = instances.size();
+		if (culling != nullptr) {
+			auto split = std::stable_partition(instances.begin(), instances.end(), [culling](const CubeInstance& instance) {
+				return culling->isVisible(instance.transform, BUILDING_BOUNDS_MIN, BUILDING_BOUNDS_MAX);
+			});
+			visibleCount = split - instances.begin();
 		}
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-	}
-
-	void renderDepth(GLuint programID, GLuint lightMatID, const glm::mat4& lightSpaceMatrix) {
-		glUseProgram(programID);
-
-		glUniformMatrix4fv(lightMatID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
 
 		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
+		size_t newSize = instances.size() * sizeof(CubeInstance);
+		if (instances.size() > instanceCapacity) {
+			// Reallocate buffer if needed
+			glBufferData(GL_ARRAY_BUFFER, newSize, nullptr, GL_DYNAMIC_DRAW);
+			instanceCapacity = instances.size();
 		}
+		if (newSize > 0) glBufferSubData(GL_ARRAY_BUFFER, 0, newSize, instances.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0, instanceTransforms.size());
-		glDisableVertexAttribArray(0);
+	// Split every instance, hidden from the camera or not, into the shadow layers it can affect
+	void updateShadowCasters(const std::vector<ShadowLight>& lights) {
+		shadowCasters.update(instances, lights, [](const CubeInstance& instance, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+			TransformBox(instance.transform, BUILDING_BOUNDS_MIN, BUILDING_BOUNDS_MAX, boundsMin, boundsMax);
+		});
+	}
 
-		for (int i = 0; i < 4; ++i) {
-			glDisableVertexAttribArray(3 + i);
+	// Shadow packets come from the lists built by updateShadowCasters
+	void submit(RenderQueue& queue, const QueueProgram* shadowProgram = nullptr) {
+		GeometryArena& geometry = StaticGeometry();
+		queue.submit(PASS_OPAQUE, *program, &material, geometry, instanceBufferID, sizeof(CubeInstance), true, mesh, visibleCount);
+		if (shadowProgram != nullptr) {
+			for (int layer = 0; layer < shadowCasters.ranges.size(); ++layer) {
+				const ShadowCasterList::Range& range = shadowCasters.ranges[layer];
+				queue.submitShadow(layer, *shadowProgram, geometry, shadowCasters.bufferID, sizeof(CubeInstance), true, mesh, range.first, range.count);
+			}
 		}
-		glBindVertexArray(0);
-		glUseProgram(0);
 	}
 
 	void cleanup() {
-		glDeleteBuffers(1, &vertexBufferID);
-		glDeleteBuffers(1, &normalBufferID);
-		glDeleteBuffers(1, &indexBufferID);
 		glDeleteBuffers(1, &instanceBufferID);
-		glDeleteBuffers(1, &uvBufferID);
-		glDeleteTextures(1, &textureID);
-		glDeleteVertexArrays(1, &vertexArrayID);
+		shadowCasters.cleanup();
+		glDeleteTextures(1, &textureArrayID);
 	}
 };
\ No newline at end of file
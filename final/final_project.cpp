@@ -1,9 +1,11 @@
 #include <render/shader.h>
 #include <render/texture.h>
+#include <render/assets.h>
 #include <camera.cpp>
 #include <skybox.cpp>
 #include <animation.cpp>
 #include <lighting.cpp>
+#include <transparency.cpp>
 
 #define MINIAUDIO_IMPLEMENTATION
 #include <miniaudio.h>
@@ -40,6 +42,10 @@ static float depthFoV = 120.0f;
 static float depthNear = 10.0f;
 static float depthFar = 4000.0f;
 
+// Render passes
+// Lay down opaque depth before lighting so each pixel is shaded about once
+static bool depthPrepass = true;
+
 // Mouse Movement
 static glm::vec2 lastMousePos(windowWidth / 2.0f, windowHeight / 2.0f);
 static float sensitivity = 0.1f;
@@ -58,8 +64,14 @@ static float playbackSpeed = 3.5f;
 // Camera
 Camera camera(eye_center, lookat, up, FoV, zNear, zFar, static_cast<float>(windowWidth) / windowHeight);
 
-// Particle Systems
-std::vector<ParticleSystem> particleSystems;
+// Particle pool shared by every lamp
+ParticleSystem particles;
+
+// Tiles hidden behind the opaque scene, tested a frame late
+TileOcclusion occlusion;
+
+// Nearest buildings rasterised on the CPU, tested the same frame
+SoftwareOcclusion occluders;
 
 // Tilesets
 struct TileCoord {
@@ -120,27 +132,51 @@ void generateStools(int x, int y, std::vector<glm::mat4>& sts) {
 	sts.push_back(s);
 }
 
-void generateBots(int x, int y, std::vector<glm::mat4>& bts) {
+// Animation slot for an instance, fixed per tile so it doesn't change as the camera moves
+int animationSlot(int x, int y) {
+	unsigned int h = static_cast<unsigned int>(x) * 73856093u ^ static_cast<unsigned int>(y) * 19349663u;
+	return static_cast<int>((h >> 4) & 0xFFFF);
+}
+
+void generateBots(int x, int y, std::vector<glm::mat4>& bts, std::vector<int>& slots) {
 	glm::mat4 b(1.0f);
 	b = glm::translate(b, glm::vec3(x * tileSize + 10, 70, (y * tileSize) - (tileSize * 1.5f) - 10));
 	bts.push_back(b);
+	slots.push_back(animationSlot(x, y));
 }
 
-void generateFoxes(int x, int y, std::vector<glm::mat4>& fts, float time) {
+void generateFoxes(int x, int y, std::vector<glm::mat4>& fts, std::vector<int>& slots, float time) {
 	glm::mat4 f(1.0f);
 	f = glm::translate(f, glm::vec3((x * tileSize) - (tileSize * 1.25f) + 10, 100, std::fmod(time * 128.0f, tileSize * 3.0f) + (y * tileSize)));
 	fts.push_back(f);
+	slots.push_back(animationSlot(x, y));
 }
 
 void generateLights(int x, int y, Lighting& lighting) {
 	glm::mat4 t = glm::translate(glm::mat4(1.0f), glm::vec3(x * tileSize, 0.0f, y * tileSize));
 	glm::vec3 p = glm::vec3(t * glm::vec4(lightPosition, 1.0f));
-	lighting.addLight(p, lightIntensity, exposure, particleSystems);
+	lighting.addLight(p, lightIntensity, exposure, particles);
+}
+
+// Offsets of the 9x9 tile grid, nearest first, so every instance list comes out front to back
+static const std::vector<TileCoord>& tileOrder() {
+	static std::vector<TileCoord> order;
+	if (order.empty()) {
+		for (int x = -4; x <= 4; ++x) {
+			for (int y = -4; y <= 4; ++y) {
+				order.push_back({ x, y });
+			}
+		}
+		std::stable_sort(order.begin(), order.end(), [](const TileCoord& a, const TileCoord& b) {
+			return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y;
+		});
+	}
+	return order;
 }
 
 // Tile Updates and Rulesets
 void updateTiles(const glm::vec3& cameraPos, std::vector<std::vector<glm::mat4>>& transformVectors, 
-	Lighting& lighting, std::vector<int>& buildingIndices, float time) {
+	std::vector<std::vector<int>>& animationSlots, Lighting& lighting, std::vector<int>& buildingIndices, float time) {
 	// Determine the center tile based on camera position
 	int centerTileX = static_cast<int>(round(cameraPos.x / tileSize));
 	int centerTileY = static_cast<int>(round(cameraPos.z / tileSize));
@@ -148,38 +184,45 @@ void updateTiles(const glm::vec3& cameraPos, std::vector<std::vector<glm::mat4>>
 	// Clear the current tile set
 	activeTiles.clear();
 	for (auto& transforms : transformVectors) transforms.clear();
-	lighting.trimLights(centerTileX, centerTileY, tileSize, particleSystems);
+	for (auto& slots : animationSlots) slots.clear();
+	lighting.trimLights(centerTileX, centerTileY, tileSize, particles);
 
 	// Generate a 9x9 grid of tiles centered on the closest tile
-	for (int x = centerTileX - 4; x <= centerTileX + 4; ++x) {
-		for (int y = centerTileY - 4; y <= centerTileY + 4; ++y) {
-			TileCoord coord{ x, y };
-			activeTiles.insert(coord);
-			generateTile(x, y, transformVectors[0]);
-
-			int modX = ((x - 2) % 3 + 3) % 3;
-			int modY = ((y - 2) % 3 + 3) % 3;
-
-			if (modX == 1 && modY == 1) {
-				// CENTER TILE: Generate lamp, stool and animations
-				generateLamps(x, y, transformVectors[1]);
-				generateStools(x, y, transformVectors[2]);
-				generateBots(x, y, transformVectors[7]);
-				generateFoxes(x, y, transformVectors[8], time);
-				if (x >= centerTileX - 2 && x <= centerTileX + 2 &&
-					y >= centerTileY - 2 && y <= centerTileY + 2)
-					generateLights(x, y, lighting);
-			}
-			else if (modX == modY || modX + modY == 2) {
-				// DIAGONAL AXES: Generate a group of buildings
-				int b = 0;
-				for (int i = -1; i <= 1; ++i) {
-					for (int j = -1; j <= 1; ++j) {
-						generateCubes(x * tileSize + i * 500, y * tileSize + j * 500, transformVectors, buildingIndices[b]);
-						b++;
-					}
+	for (const TileCoord& offset : tileOrder()) {
+		int x = centerTileX + offset.x;
+		int y = centerTileY + offset.y;
+		TileCoord coord{ x, y };
+		activeTiles.insert(coord);
+		generateTile(x, y, transformVectors[0]);
+
+		int modX = ((x - 2) % 3 + 3) % 3;
+		int modY = ((y - 2) % 3 + 3) % 3;
+
+		if (modX == 1 && modY == 1) {
+			// CENTER TILE: Generate lamp, stool and animations
+			generateLamps(x, y, transformVectors[1]);
+			generateStools(x, y, transformVectors[2]);
+			generateBots(x, y, transformVectors[7], animationSlots[0]);
+			generateFoxes(x, y, transformVectors[8], animationSlots[1], time);
+			occlusion.setTile(x, y, tileSize / 2, 800);	// Lamp, particles and animals
+			if (x >= centerTileX - 2 && x <= centerTileX + 2 &&
+				y >= centerTileY - 2 && y <= centerTileY + 2)
+				generateLights(x, y, lighting);
+		}
+		else if (modX == modY || modX + modY == 2) {
+			// DIAGONAL AXES: Generate a group of buildings
+			occlusion.setTile(x, y, 800, 3000);	// Corner blocks reach 500 + 300 from the centre
+			int b = 0;
+			for (int i = -1; i <= 1; ++i) {
+				for (int j = -1; j <= 1; ++j) {
+					generateCubes(x * tileSize + i * 500, y * tileSize + j * 500, transformVectors, buildingIndices[b]);
+					b++;
 				}
-			}   // X AND Y AXES: Empty
+			}
+		}
+		else {
+			// X AND Y AXES: Empty
+			occlusion.setTile(x, y, tileSize / 2, 800);
 		}
 	}
 }
@@ -222,12 +265,25 @@ int main(void)
 		return -1;
 	}
 
+	// Linked shaders are saved here and reused by later runs on the same driver
+	ProgramBinaries().initialize("../final/shader_cache");
+
+	// Material shader variants build behind the first frames
+	BackgroundShaders().initialize(window);
+
+	// Parse the models on the asset workers while everything else is set up; textures requested
+	// below decode there too and are uploaded a few at a time each frame. Static models with a cooked
+	// package map it instead and need no parse; animated ones still read their skeleton from glTF.
+	Assets().initialize();
+	for (const char* path : { "../final/model/lamp/street_lamp_01_1k.gltf", "../final/model/stool/folding_wooden_stool_1k.gltf" }) {
+		if (!HasCookedPackage(path)) Assets().prefetchModel(path);
+	}
+	Assets().prefetchModel("../final/model/bot/bot.gltf");
+	Assets().prefetchModel("../final/model/fox/fox.gltf");
+
 	// Prepare shadow map size for shadow mapping. 
 	glfwGetFramebufferSize(window, &shadowMapWidth, &shadowMapHeight);
 
-	// Background
-	glClearColor(0.2f, 0.2f, 0.25f, 0.0f);
-
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
@@ -237,12 +293,10 @@ int main(void)
 		std::cerr << "Failed to initialize audio engine." << std::endl;
 	}
 
-	// Load the music and set it to loop
+	// Stream the music rather than decoding it whole up front, and set it to loop
 	ma_sound music;
-	ma_sound_config soundConfig = ma_sound_config_init();
-	soundConfig.flags = MA_SOUND_FLAG_STREAM;
 	if (ma_sound_init_from_file(&engine, "../final/assets/Winter.mp3",
-		0, nullptr, nullptr, &music) != MA_SUCCESS) {
+		MA_SOUND_FLAG_STREAM | MA_SOUND_FLAG_ASYNC, nullptr, nullptr, &music) != MA_SUCCESS) {
 		std::cerr << "Failed to load sound." << std::endl;
 		ma_engine_uninit(&engine);
 	}
@@ -263,42 +317,55 @@ int main(void)
 		std::vector<glm::mat4> transforms;
 		transformVectors.push_back(transforms);
 	}
+	// Animation slot of each bot and fox instance
+	std::vector<std::vector<int>> animationSlots(2);
 	// Main lighting (affects ground, lamps, buildings and stools)
 	Lighting lighting;
 	lighting.initialize(shadowMapWidth, shadowMapHeight);
+	particles.initialize();
+	// Order-independent transparency, with particles at half resolution
+	Transparency transparency;
+	transparency.initialize(zNear, zFar);
+	occlusion.initialize(tileSize, 100.0f);
+	occluders.initialize();
+	InstanceCulling culling;
+	culling.tiles = &occlusion;
+	culling.occluders = &occluders;
+	particles.culling = &culling;
+	// Passes and their targets are declared each frame; the graph culls and pools them
+	RenderGraph renderGraph;
+	// Static geometry is drawn through a sorted queue, rebuilt every frame
+	RenderQueue renderQueue;
 	// Compute all instance matrices
-	updateTiles(camera.position, transformVectors, lighting, buildingIndices, 0);
+	updateTiles(camera.position, transformVectors, animationSlots, lighting, buildingIndices, 0);
 	// Set up scene objects
 	Plane ground;
-	ground.initialize(lighting.programID, transformVectors[0]);
+	ground.initialize(lighting.litPrograms, transformVectors[0]);
 	StaticModel lamp;
-	lamp.initialize(lighting.programID, transformVectors[1], "../final/model/lamp/street_lamp_01_1k.gltf");
+	lamp.initialize(lighting.litPrograms, transformVectors[1], "../final/model/lamp/street_lamp_01_1k.gltf");
 	StaticModel stool;
-	stool.initialize(lighting.programID, transformVectors[2], "../final/model/stool/folding_wooden_stool_1k.gltf");
-	Cube cyberBuilding;
-	cyberBuilding.initialize(lighting.programID, transformVectors[3], 3, 10, "../final/assets/facade0.png");
-	Cube officeBuilding;
-	officeBuilding.initialize(lighting.programID, transformVectors[4], 1, 5, "../final/assets/facade5.png");
-	Cube technoBuilding;
-	technoBuilding.initialize(lighting.programID, transformVectors[5], 3, 12, "../final/assets/facade1.png");
-	Cube steampunkBuilding;
-	steampunkBuilding.initialize(lighting.programID, transformVectors[6], 4, 8, "../final/assets/facade7.png");
+	stool.initialize(lighting.litPrograms, transformVectors[2], "../final/model/stool/folding_wooden_stool_1k.gltf");
+	// Cyber, office, techno and steampunk buildings (transformVectors[3..6]) share one draw
+	std::vector<CubeStyle> buildingStyles = {
+		{ "../final/assets/facade0.png", 3, 10 },
+		{ "../final/assets/facade5.png", 1, 5 },
+		{ "../final/assets/facade1.png", 3, 12 },
+		{ "../final/assets/facade7.png", 4, 8 }
+	};
+	Cube buildings;
+	buildings.initialize(lighting.litPrograms, buildingStyles, &transformVectors[3]);
 	// Add animated models (not affected by main lighting)
 	AnimatedModel bot;
 	bot.initialize(transformVectors[7], "../final/model/bot/bot.gltf");
 	AnimatedModel fox;
 	fox.initialize(transformVectors[8], "../final/model/fox/fox.gltf");
-
-	// Set up model vector for lighting (lamp not included as its shadow blocks most of the light)
-	std::vector<StaticModel> models;
-	models.push_back(stool);
-
-	// Set up building vector for lighting
-	std::vector<Cube> cubes;
-	cubes.push_back(cyberBuilding);
-	cubes.push_back(officeBuilding);
-	cubes.push_back(technoBuilding);
-	cubes.push_back(steampunkBuilding);
+	// Every static mesh is in the arena now; upload it in one go
+	StaticGeometry().upload();
+	// Vary the crowds: out-of-phase copies of the main clip, plus a fox that alternates its gait
+	bot.addSlot(0, 1.0f, 0.37f);
+	bot.addSlot(0, 0.9f, 0.71f);
+	fox.addSlot(0, 1.0f, 0.5f);
+	int foxGaitSlot = fox.addSlot(2, 1.0f, 0.0f);
 
 	// Camera setup
 	glm::mat4 viewMatrix, projectionMatrix, lightProjection;
@@ -309,6 +376,7 @@ int main(void)
 	float botTime = 0.0f;
 	float foxTime = 0.0f;
 	float fTime = 0.0f;
+	bool shadersReported = false;
 	unsigned long frames = 0;
 
 	// Start the music
@@ -316,8 +384,6 @@ int main(void)
 
 	do
 	{
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
 		// Update states for animation
 		double currentTime = glfwGetTime();
 		float deltaTime = float(currentTime - lastTime);
@@ -325,9 +391,7 @@ int main(void)
 
 		if (playAnimation) {
 			botTime += deltaTime * playbackSpeed;
-			bot.update(botTime);
 			foxTime += deltaTime * playbackSpeed / 1.5;
-			fox.update(foxTime);
 		}
 
 		// Check for edge turning
@@ -350,43 +414,115 @@ int main(void)
 
 		// Update tiles and objects
 		glm::vec3 cameraPos = camera.position;
-		updateTiles(camera.position, transformVectors, lighting, buildingIndices, foxTime);
-		ground.updateInstances(transformVectors[0]);
-		lamp.updateInstanceMatrices(transformVectors[1]);
-		stool.updateInstanceMatrices(transformVectors[2]);
-		cyberBuilding.updateInstances(transformVectors[3]);
-		officeBuilding.updateInstances(transformVectors[4]);
-		technoBuilding.updateInstances(transformVectors[5]);
-		steampunkBuilding.updateInstances(transformVectors[6]);
-		bot.updateInstanceMatrices(transformVectors[7]);
-		fox.updateInstanceMatrices(transformVectors[8]);
-		models.clear();
-		cubes.clear();
-		models.push_back(stool);
-		cubes.push_back(cyberBuilding);
-		cubes.push_back(officeBuilding);
-		cubes.push_back(technoBuilding);
-		cubes.push_back(steampunkBuilding);
-		for (auto& particleSystem : particleSystems) particleSystem.update(deltaTime);
+		occlusion.collect(static_cast<int>(round(cameraPos.x / tileSize)), static_cast<int>(round(cameraPos.z / tileSize)));
+		updateTiles(camera.position, transformVectors, animationSlots, lighting, buildingIndices, foxTime);
 
 		// Compute camera matrix
 		viewMatrix = camera.getViewMatrix();
 		projectionMatrix = camera.getProjectionMatrix();
 		glm::mat4 vp = projectionMatrix * viewMatrix;
 
+		// Rasterise the nearest buildings on the worker while the particles are simulated, then
+		// upload only the instances that pass both occlusion tests
+		occluders.begin(vp, cameraPos, &transformVectors[3], 4);
+		bot.updateInstanceMatrices(transformVectors[7], animationSlots[0]);
+		fox.updateInstanceMatrices(transformVectors[8], animationSlots[1]);
+		particles.update(deltaTime);
+		occluders.wait();
+		ground.updateInstances(transformVectors[0], &culling);
+		lamp.updateInstanceMatrices(transformVectors[1], &culling);
+		stool.updateInstanceMatrices(transformVectors[2], &culling);
+		buildings.updateInstances(&transformVectors[3], cameraPos, &culling);
+
+		// Each shadow layer gets only the casters inside its light's frustum and radius
+		lighting.updateLightSpace(lightProjection);
+		buildings.updateShadowCasters(lighting.shadowLights);
+		stool.updateShadowCasters(lighting.shadowLights);
+
+		// Upload decoded textures within a small budget, highest priority first
+		Assets().pumpUploads(0.004);
+
+		// Swap in shader variants that finished building since the last frame
+		BackgroundShaders().update();
+		size_t shadersPending = lighting.litPrograms.update();
+		if (shadersPending == 0 && !shadersReported) {
+			shadersReported = true;
+			if (ProgramBinaries().supported) std::cout << "Shader programs: " << ProgramBinaries().hits << " loaded from cache, " << ProgramBinaries().misses << " compiled" << std::endl;
+		}
+
+		// Queue static geometry; stools and buildings cast shadows (the lamp's shadow would block most of its light)
+		renderQueue.clear();
+		ground.submit(renderQueue);
+		buildings.submit(renderQueue, &lighting.depthProgram);
+		stool.submit(renderQueue, &lighting.depthProgram);
+		lamp.submit(renderQueue);
+		renderQueue.sort();
+
+		// Cull animated instances and evaluate skeletons at their level of detail
+		bot.updateLOD(vp, cameraPos, &culling);
+		fox.updateLOD(vp, cameraPos, &culling);
+		if (playAnimation) {
+			bot.update(botTime);
+			fox.update(foxTime);
+
+			// Alternate between running (clip 0) and walking (clip 2)
+			int gait = static_cast<int>(foxTime / 8.0f) % 2 == 0 ? 2 : 0;
+			fox.play(foxGaitSlot, gait, 0.5f);
+		}
+
 		// Render the scene
-		lighting.performShadowPass(lightProjection, models, cubes);
-		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-		sky.updatePosition(cameraPos);
-		sky.render(vp);
-		lighting.prepareLighting(cameraPos);
-		ground.render(vp);
-		for (auto& cube : cubes) cube.render(vp);
-		stool.render(vp);
-		lamp.render(vp);
-		bot.render(vp, cameraPos);
-		fox.render(vp, cameraPos);
-		for (auto& particleSystem : particleSystems) particleSystem.render(vp, cameraPos);
+		int frameWidth, frameHeight;
+		glfwGetFramebufferSize(window, &frameWidth, &frameHeight);
+		renderGraph.begin(frameWidth, frameHeight);
+		int backbuffer = renderGraph.importBackbuffer();
+		int shadowMaps = renderGraph.importTexture("shadowMaps", lighting.shadowMapArray);
+		int sceneColor = renderGraph.createTexture("sceneColor", { GL_RGBA8 });
+		int sceneDepth = renderGraph.createTexture("sceneDepth", { GL_DEPTH_COMPONENT24 });
+
+		// Each light renders its casters into its own layer through its own framebuffer
+		renderGraph.addPass("shadows", [&]() {
+			lighting.performShadowPass(renderQueue);
+		}).write(shadowMaps);
+
+		// Cleared to the background colour
+		renderGraph.addPass("opaque", [&]() {
+			lighting.prepareLighting(cameraPos);
+			if (depthPrepass) {
+				// Depth only, then shade just the fragments that match it
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				renderQueue.flush(PASS_OPAQUE, vp, &lighting.depthProgram);
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				glDepthFunc(GL_LEQUAL);
+				glDepthMask(GL_FALSE);
+			}
+			renderQueue.flush(PASS_OPAQUE, vp);
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+
+			// The sky sits on the far plane, so only uncovered pixels shade it
+			sky.updatePosition(cameraPos);
+			sky.render(vp);
+
+			// Animated models blend their edges, so they go over the sky
+			bot.render(vp, cameraPos);
+			fox.render(vp, cameraPos);
+
+			// Test every tile against the finished depth; the results cull next frame's instances
+			occlusion.issue(vp);
+		}).read(shadowMaps).color(sceneColor, LoadOp::Clear, glm::vec4(0.2f, 0.2f, 0.25f, 0.0f)).depthStencil(sceneDepth, LoadOp::Clear);
+
+		transparency.addPasses(renderGraph, sceneColor, sceneDepth,
+			[&]() { renderQueue.flush(PASS_TRANSPARENT, vp); },
+			[&]() { particles.render(vp, cameraPos); });
+
+		// Every pixel is copied, so the backbuffer needs no clear
+		renderGraph.addPass("present", [&]() {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, renderGraph.framebuffer({ sceneColor }, -1));
+			glBlitFramebuffer(0, 0, frameWidth, frameHeight, 0, 0, frameWidth, frameHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		}).read(sceneColor).color(backbuffer, LoadOp::DontCare);
+
+		renderGraph.compile();
+		renderGraph.execute();
 
 		// FPS tracking 
 		// Count number of frames over a few seconds and take average
@@ -398,7 +534,15 @@ int main(void)
 			fTime = 0;
 
 			std::stringstream stream;
-			stream << std::fixed << std::setprecision(2) << "Frames per second (FPS): " << fps;
+			stream << std::fixed << std::setprecision(2) << "Frames per second (FPS): " << fps
+				<< "  Draws: " << renderQueue.lastDrawCount
+				<< "  State changes: " << renderQueue.lastIssued
+				<< " (" << renderQueue.lastSkipped << " skipped)"
+				<< "  Passes: " << renderGraph.livePasses << " (" << renderGraph.culledPasses << " culled)"
+				<< "  Occluded tiles: " << occlusion.culledTiles()
+				<< "  Occluders: " << occluders.rasterizedOccluders;
+			if (shadersPending > 0) stream << "  Shaders building: " << shadersPending;
+			if (Assets().pending() > 0) stream << "  Assets loading: " << Assets().pending();
 			glfwSetWindowTitle(window, stream.str().c_str());
 		}
 
@@ -410,13 +554,23 @@ int main(void)
 	while (!glfwWindowShouldClose(window));
 
 	// Clean up
+	Assets().cleanup();
 	sky.cleanup();
 	bot.cleanup();
 	fox.cleanup();
 	ground.cleanup();
-	for (auto& cube : cubes) cube.cleanup();
+	lamp.cleanup();
+	stool.cleanup();
+	buildings.cleanup();
+	StaticGeometry().cleanup();
+	BackgroundShaders().cleanup();
+	ShaderVariants().cleanup();
 	lighting.cleanup();
-	for (auto& particleSystem : particleSystems) particleSystem.cleanup();
+	particles.cleanup();
+	transparency.cleanup();
+	renderGraph.cleanup();
+	occlusion.cleanup();
+	occluders.cleanup();
 
 	ma_sound_uninit(&music);
 	ma_engine_uninit(&engine);
@@ -435,6 +589,21 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 		camera.reset(); // Reset camera
 	}
 
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+	{
+		depthPrepass = !depthPrepass;	// Toggle the opaque depth prepass
+	}
+
+	if (key == GLFW_KEY_O && action == GLFW_PRESS)
+	{
+		occlusion.enabled = !occlusion.enabled;	// Toggle tile occlusion culling
+	}
+
+	if (key == GLFW_KEY_C && action == GLFW_PRESS)
+	{
+		occluders.enabled = !occluders.enabled;	// Toggle CPU occluder culling
+	}
+
 	if (key == GLFW_KEY_W && (action == GLFW_REPEAT || action == GLFW_PRESS))
 	{
 		camera.moveStat(glm::vec3(0.0f, 0.0f, -20.0f)); // Move forward
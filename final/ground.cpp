@@ -1,5 +1,8 @@
 #include <render/texture.h>
+#include <render/assets.h>
 #include <render/shader.h>
+#include <render/queue.h>
+#include <render/occlusion.h>
 
 struct Plane {
 
@@ -10,20 +13,14 @@ struct Plane {
 
 	GLuint instanceBufferID;
 	std::vector<glm::mat4> instanceTransforms;
-
-	GLfloat vertex_buffer_data[12] = {
-		-0.5f, 0.0f, -0.5f, // bottom-left
-		 0.5f, 0.0f, -0.5f, // bottom-right
-		 0.5f, 0.0f,  0.5f, // top-right
-		-0.5f, 0.0f,  0.5f  // top-left
-	};
-
-	GLfloat normal_buffer_data[12] = {
-		// All pointing upward
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f
+	size_t visibleCount;	// Leading instances in tiles that passed the occlusion test
+
+	StaticVertex vertex_data[4] = {
+		// position, normal (all pointing upward), uv
+		{ { -0.5f, 0.0f, -0.5f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f } }, // bottom-left
+		{ {  0.5f, 0.0f, -0.5f }, { 0.0f, 1.0f, 0.0f }, { 4.0f, 0.0f } }, // bottom-right
+		{ {  0.5f, 0.0f,  0.5f }, { 0.0f, 1.0f, 0.0f }, { 4.0f, 4.0f } }, // top-right
+		{ { -0.5f, 0.0f,  0.5f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 4.0f } }  // top-left
 	};
 
 	GLuint index_buffer_data[6] = {
@@ -31,177 +28,64 @@ struct Plane {
 		0, 3, 2
 	};
 
-	GLfloat uv_buffer_data[8] = {
-		0.0f, 0.0f,
-		4.0f, 0.0f,
-		4.0f, 4.0f,
-		0.0f, 4.0f
-	};
+	// Range of the quad in the shared static geometry
+	MeshRange mesh;
+	size_t instanceBufferSize;
 
 	// OpenGL buffers
-	GLuint vertexArrayID;
-	GLuint vertexBufferID;
-	GLuint indexBufferID;
-	GLuint normalBufferID;
-	GLuint uvBufferID;
 	GLuint textureID;
-	GLuint cameraMatrixID;
-	GLuint baseColorFactorID;
-	GLuint isLightID;
 
-	// Shader variable IDs
-	GLuint textureSamplerID;
-	GLuint programID;
+	// Opaque, untinted ground texture
+	DrawMaterial material;
+	const QueueProgram* program;
 
-	void initialize(GLuint programID, const std::vector<glm::mat4>& instanceTransforms) {
+	void initialize(ProgramVariants& programs, const std::vector<glm::mat4>& instanceTransforms) {
 		// Set the instance Matrices
 		this->instanceTransforms = instanceTransforms;
+		visibleCount = instanceTransforms.size();
 
-		// Create a vertex array object
-		glGenVertexArrays(1, &vertexArrayID);
-		glBindVertexArray(vertexArrayID);
-
-		// Create a vertex buffer object to store the vertex data		
-		glGenBuffers(1, &vertexBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the normal data		
-		glGenBuffers(1, &normalBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(normal_buffer_data), normal_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the UV data
-		glGenBuffers(1, &uvBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
-
-		// Create an index buffer object to store the index data that defines triangle faces
-		glGenBuffers(1, &indexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+		mesh = StaticGeometry().addMesh(vertex_data, 4, index_buffer_data, 6);
 
 		// Create instance buffer
 		glGenBuffers(1, &instanceBufferID);
 		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data(), GL_STATIC_DRAW);
-
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
-		}
+		glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		instanceBufferSize = instanceTransforms.size() * sizeof(glm::mat4);
 
-		// Create and compile our GLSL program from the shaders
-		this->programID = programID;
+		program = &programs.get(0);
 
 		// Load the texture into GPU memory
-		textureID = LoadTextureTileBox("../final/assets/ground.jpg");
-
-		// Get a handle for GLSL variables
-		cameraMatrixID = glGetUniformLocation(programID, "camera");
-		textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-		baseColorFactorID = glGetUniformLocation(programID, "baseColorFactor");
-		isLightID = glGetUniformLocation(programID, "isLight");
+		textureID = Assets().loadTexture("../final/assets/ground.jpg", PRIORITY_HIGH);
+		material.textureID = textureID;
 	}
 
-	void updateInstances(const std::vector<glm::mat4>& instanceTransforms) {
+	void updateInstances(const std::vector<glm::mat4>& instanceTransforms, const InstanceCulling* culling = nullptr) {
+		this->instanceTransforms = instanceTransforms;
+		visibleCount = PartitionVisible(this->instanceTransforms, culling, glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 0.0f, 0.5f));
+
 		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
 
 		// Check if the data size has changed
-		static size_t currentBufferSize = 0;
 		size_t newSize = instanceTransforms.size() * sizeof(glm::mat4);
-		if (newSize > currentBufferSize) {
+		if (newSize > instanceBufferSize) {
 			// Reallocate buffer if so
 			glBufferData(GL_ARRAY_BUFFER, newSize, nullptr, GL_DYNAMIC_DRAW);
-			currentBufferSize = newSize;
-		}
-		glBufferSubData(GL_ARRAY_BUFFER, 0, newSize, instanceTransforms.data());
-	}
-
-	void render(glm::mat4 cameraMatrix) {
-		glUseProgram(programID);
-
-		glBindVertexArray(vertexArrayID);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glUniform1i(textureSamplerID, 0);
-
-		// Bind the instance buffer
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
-		}
-
-		glUniformMatrix4fv(cameraMatrixID, 1, GL_FALSE, &cameraMatrix[0][0]);
-
-		// Set base colour factor to opaque
-		glm::vec4 baseColorFactor = glm::vec4(1.0);
-		glUniform4fv(baseColorFactorID, 1, &baseColorFactor[0]);
-		glUniform1i(isLightID, 0);
-
-		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0, instanceTransforms.size());
-
-		for (int i = 0; i < 4; ++i) {
-			glDisableVertexAttribArray(3 + i);
+			instanceBufferSize = newSize;
 		}
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, newSize, this->instanceTransforms.data());
 	}
 
-	void renderDepth(GLuint programID, GLuint lightMatID, const glm::mat4& lightSpaceMatrix) {
-		glUseProgram(programID);
-
-		glUniformMatrix4fv(lightMatID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
-		}
-
-		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0, instanceTransforms.size());
-		glDisableVertexAttribArray(0);
-
-		for (int i = 0; i < 4; ++i) {
-			glDisableVertexAttribArray(3 + i);
+	void submit(RenderQueue& queue, const QueueProgram* shadowProgram = nullptr) {
+		GeometryArena& geometry = StaticGeometry();
+		queue.submit(PASS_OPAQUE, *program, &material, geometry, instanceBufferID, sizeof(glm::mat4), false, mesh, visibleCount);
+		if (shadowProgram != nullptr) {
+			queue.submit(PASS_SHADOW, *shadowProgram, nullptr, geometry, instanceBufferID, sizeof(glm::mat4), false, mesh, instanceTransforms.size());
 		}
-		glBindVertexArray(0);
-		glUseProgram(0);
 	}
 
 	void cleanup() {
-		glDeleteBuffers(1, &vertexBufferID);
-		glDeleteBuffers(1, &normalBufferID);
-		glDeleteBuffers(1, &indexBufferID);
 		glDeleteBuffers(1, &instanceBufferID);
-		glDeleteVertexArrays(1, &vertexArrayID);
-		glDeleteBuffers(1, &uvBufferID);
 		glDeleteTextures(1, &textureID);
-		glDeleteProgram(programID);
 	}
 };
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <render/shader.h>
 #include <render/texture.h>
+#include <render/shadows.h>
 #include <model.cpp>
 #include <cube.cpp>
 #include <ground.cpp>
@@ -11,18 +12,19 @@ struct Light {
     float exposure;
     glm::mat4 lightSpaceMatrix;
     GLuint shadowFBO;
+    int particleEmitter;
 };
 
 class Lighting {
 public:
 
     std::vector<Light> lights;
-    GLuint programID, depthProgramID;
+    std::vector<ShadowLight> shadowLights;    // Caster culling volume of each shadow layer
+    GLuint depthProgramID;
+    ProgramVariants litPrograms;    // model.vert/model.frag per material feature set
+    QueueProgram depthProgram;
     GLuint lightSpaceID;
-    GLuint cameraPositionID;
-    GLuint lightCountID;
     GLuint shadowMapArray;
-    GLuint shadowMapArrayID;
 
     int shadowMapWidth, shadowMapHeight;
 
@@ -30,18 +32,39 @@ public:
     // - there'll never be more than 4 at any one time
     int maxLights = 9;
 
+    // Lights whose shadow coordinates model.vert computes per vertex; any beyond are projected per fragment.
+    // Each costs a vec4 varying, so two keeps the lit shader at 16 interpolated floats (the old mat4
+    // varying alone was 16) while covering the lights most fragments are within shadow range of.
+    int vertexShadowLights = 2;
+
+    // Compiled into the lit shader
+    float fogMinDistance = 1024.0f;
+    float fogMaxDistance = 2048.0f;
+
+    // model.frag only looks up shadows within FOG_MIN_DIST / 2 of a light
+    float shadowRadius = 512.0f;
+
     bool saveDepth = true;
 
+    // Sample shadows with a fixed 3x3 grid of filtered taps instead of one
+    bool widePCF = false;
+
+    // Slope-scaled and constant depth offset applied while drawing shadow maps
+    float shadowSlopeBias = 1.5f;
+    float shadowConstantBias = 4.0f;
+
     void initialize(int shadowMapWidth, int shadowMapHeight) {
         this->shadowMapWidth = shadowMapWidth;
         this->shadowMapHeight = shadowMapHeight;
 
-        // Compile programs for main and depth shaders
-        programID = LoadShadersFromFile("../final/shader/model.vert", "../final/shader/model.frag");
-        if (programID == 0)
-        {
-            std::cerr << "Failed to load main shaders." << std::endl;
-        }
+        // Variants of the main shader are compiled in the background as materials ask for them; these are shared
+        litPrograms.initialize("../final/shader/model.vert", "../final/shader/model.frag", {
+            { "MAX_LIGHTS", std::to_string(maxLights) },
+            { "SHADOWS", "1" },
+            { "VERTEX_SHADOW_LIGHTS", std::to_string(vertexShadowLights) },
+            { "FOG_MIN_DIST", std::to_string(fogMinDistance) },
+            { "FOG_MAX_DIST", std::to_string(fogMaxDistance) }
+        }, "../final/shader/fallback.vert", "../final/shader/fallback.frag");
 
         depthProgramID = LoadShadersFromFile("../final/shader/depth.vert", "../final/shader/depth.frag");
         if (depthProgramID == 0) {
@@ -50,17 +73,21 @@ public:
 
         // Get a handle for GLSL variables
         lightSpaceID = glGetUniformLocation(depthProgramID, "lightSpace");
-        shadowMapArrayID = glGetUniformLocation(programID, "shadowMapArray");
-        cameraPositionID = glGetUniformLocation(programID, "cameraPosition");
-        lightCountID = glGetUniformLocation(programID, "lightCount");
+
+        // Uniforms the render queue sets when it replays draws with this program
+        depthProgram.programID = depthProgramID;
+        depthProgram.viewMatrixID = lightSpaceID;
 
         // Construct an array of textures to contain shadow maps for each light
         glGenTextures(1, &shadowMapArray);
         glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapArray);
-        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, shadowMapWidth, shadowMapHeight, maxLights, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, shadowMapWidth, shadowMapHeight, maxLights, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
 
-        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        // Depth comparison in the sampler; linear filtering then blends the four compared texels
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
@@ -70,13 +97,21 @@ public:
         }
     }
 
-    void addLight(glm::vec3 position, glm::vec3 intensity, float exposure, std::vector<ParticleSystem>& particleSystems) {
+    void addLight(glm::vec3 position, glm::vec3 intensity, float exposure, ParticleSystem& particles) {
         for (const auto& existingLight : lights) {
             if (glm::distance(existingLight.position, position) < 0.1f) {
                 return;
             }
         }
 
+        // A light past the shadow map array has no layer to render into, so it gets neither a
+        // framebuffer nor a block of the particle pool
+        if (lights.size() >= maxLights) {
+            std::cerr << "Error: Trying to attach a shadow map layer that exceeds the texture array size." << std::endl;
+            std::cerr << "lights.size() = " << lights.size() << std::endl;
+            return;
+        }
+
         Light light;
         light.position = position;
         light.intensity = intensity;
@@ -87,100 +122,104 @@ public:
         glGenFramebuffers(1, &light.shadowFBO);
         glBindFramebuffer(GL_FRAMEBUFFER, light.shadowFBO);
 
-        // Ensure that lights.size() is within range
-        if (lights.size() >= maxLights) {
-            std::cerr << "Error: Trying to attach a shadow map layer that exceeds the texture array size." << std::endl;
-            std::cerr << "lights.size() = " << lights.size() << std::endl;
-        }
-        else {
-            // Bind the current layer of the shadow map array to the framebuffer
-            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMapArray, 0, lights.size());
-            glDrawBuffer(GL_NONE);
-            glReadBuffer(GL_NONE);
-
-            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            if (status != GL_FRAMEBUFFER_COMPLETE) {
-                std::cerr << "Error: Shadow framebuffer for light is not complete! Status: " << status << std::endl;
-            }
+        // Bind the current layer of the shadow map array to the framebuffer
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMapArray, 0, lights.size());
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Error: Shadow framebuffer for light is not complete! Status: " << status << std::endl;
         }
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        // Create a new particle system at this location
-        ParticleSystem particles;
-        particles.initialize(glm::vec3(position.x, 0.0f, position.z));
-        particleSystems.push_back(particles);
-        
+        // Take a block of the particle pool at this location
+        light.particleEmitter = particles.createEmitter(glm::vec3(position.x, 0.0f, position.z));
+
         lights.push_back(light);
     }
 
-    void trimLights(int centerX, int centerY, float tileSize, std::vector<ParticleSystem>& particleSystems) {
+    void trimLights(int centerX, int centerY, float tileSize, ParticleSystem& particles) {
         // Remove lights that are outside the 5x5 grid centered around the camera
         std::vector<Light> remainingLights;
-        std::vector<ParticleSystem> remainingParticles;
         for (int i = 0; i < lights.size(); i++) {
             int lightX = static_cast<int>(round(lights[i].position.x / tileSize));
             int lightY = static_cast<int>(round(lights[i].position.z / tileSize));
             if (abs(lightX - centerX) <= 2 && abs(lightY - centerY) <= 2) {
                 remainingLights.push_back(lights[i]);
-                remainingParticles.push_back(particleSystems[i]);
+            }
+            else {
+                particles.destroyEmitter(lights[i].particleEmitter);
             }
         }
         lights = remainingLights;
-        particleSystems = remainingParticles;
     }
 
-    void performShadowPass(glm::mat4 lightProjection, std::vector<StaticModel> models, std::vector<Cube> cubes) {
-        // Perform Shadow pass using static models and cubes
-        glUseProgram(depthProgramID);
+    void updateLightSpace(glm::mat4 lightProjection) {
+        // Light space matrices are needed before the casters are split between layers
+        shadowLights.clear();
         for (size_t i = 0; i < lights.size(); ++i) {
-            Light light = lights[i];
+            Light& light = lights[i];
 
             // Compute light space matrix
             glm::vec3 lookAt = glm::vec3(light.position.x, light.position.y - 1, light.position.z);
             glm::mat4 lightView = glm::lookAt(light.position, lookAt, glm::vec3(0, 0, 1));
             light.lightSpaceMatrix = lightProjection * lightView;
 
+            shadowLights.push_back(MakeShadowLight(light.lightSpaceMatrix, light.position, shadowRadius));
+        }
+    }
+
+    void performShadowPass(RenderQueue& queue) {
+        // Perform Shadow pass using each layer's own casters from the queue
+        glViewport(0, 0, shadowMapWidth, shadowMapHeight);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(shadowSlopeBias, shadowConstantBias);
+        for (size_t i = 0; i < lights.size(); ++i) {
+            const Light& light = lights[i];
+
             glBindFramebuffer(GL_FRAMEBUFFER, light.shadowFBO);
             glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMapArray, 0, i);
             glClear(GL_DEPTH_BUFFER_BIT);
 
-            for (auto& model : models) {
-                model.renderDepth(depthProgramID, lightSpaceID, light.lightSpaceMatrix);
-            }
-            for (auto& cube : cubes) {
-                cube.renderDepth(depthProgramID, lightSpaceID, light.lightSpaceMatrix);
-            }
+            queue.flush(PASS_SHADOW, light.lightSpaceMatrix, nullptr, i);
 
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
             if (saveDepth) saveDepthTexture(light.shadowFBO, "depth" + std::to_string(i) + ".png");
         }
+        glDisable(GL_POLYGON_OFFSET_FILL);
         saveDepth = false;
-        glUseProgram(0);
     }
 
     void prepareLighting(glm::vec3 cameraPos) {
         // To be called before rendering static models, planes and cubes
-        // Sets all the light-related parameters in the main shaders
-        glUseProgram(programID);
-
-        for (int i = 0; i < lights.size(); ++i) {
-            std::string index = std::to_string(i);
+        // Sets all the light-related parameters in every variant of the main shader
+        // (unlit variants have no light uniforms, so those calls do nothing; variants still building are skipped)
+        for (const auto& variant : litPrograms.programs) {
+            GLuint programID = variant.second.programID;
+            if (programID == 0 || programID == litPrograms.fallbackProgramID) continue;
+            glUseProgram(programID);
+
+            for (int i = 0; i < lights.size(); ++i) {
+                std::string index = std::to_string(i);
+
+                glUniform3fv(glGetUniformLocation(programID, ("lightPositions[" + index + "]").c_str()), 1, &lights[i].position[0]);
+                glUniform3fv(glGetUniformLocation(programID, ("lightIntensities[" + index + "]").c_str()), 1, &lights[i].intensity[0]);
+                glUniform1f(glGetUniformLocation(programID, ("lightExposures[" + index + "]").c_str()), lights[i].exposure);
+                glUniformMatrix4fv(glGetUniformLocation(programID, ("lightSpaceMatrices[" + index + "]").c_str()), 1, GL_FALSE, &lights[i].lightSpaceMatrix[0][0]);
+            }
 
-            glUniform3fv(glGetUniformLocation(programID, ("lightPositions[" + index + "]").c_str()), 1, &lights[i].position[0]);
-            glUniform3fv(glGetUniformLocation(programID, ("lightIntensities[" + index + "]").c_str()), 1, &lights[i].intensity[0]);
-            glUniform1f(glGetUniformLocation(programID, ("lightExposures[" + index + "]").c_str()), lights[i].exposure);
-            glUniformMatrix4fv(glGetUniformLocation(programID, ("lightSpaceMatrices[" + index + "]").c_str()), 1, GL_FALSE, &lights[i].lightSpaceMatrix[0][0]);
+            glUniform1i(glGetUniformLocation(programID, "shadowMapArray"), 1);
+            glUniform3fv(glGetUniformLocation(programID, "cameraPosition"), 1, &cameraPos[0]);
+            glUniform1i(glGetUniformLocation(programID, "lightCount"), lights.size());
+            glUniform1i(glGetUniformLocation(programID, "shadowKernel"), widePCF ? 1 : 0);
         }
 
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapArray);
-        glUniform1i(shadowMapArrayID, 1);
-
-        glUniform3fv(cameraPositionID, 1, &cameraPos[0]);
-
-        glUniform1i(lightCountID, lights.size());
+        glActiveTexture(GL_TEXTURE0);
     }
 
     void cleanup() {
@@ -188,7 +227,7 @@ public:
             glDeleteTextures(1, &shadowMapArray);
             glDeleteFramebuffers(1, &light.shadowFBO);
         }
-        glDeleteProgram(programID);
+        litPrograms.cleanup();
         glDeleteProgram(depthProgramID);
     }
 
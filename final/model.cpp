@@ -1,34 +1,41 @@
 #include <render/texture.h>
+#include <render/assets.h>
 #include <render/shader.h>
-
-#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+#include <render/queue.h>
+#include <render/occlusion.h>
+#include <render/shadows.h>
+#include <cfloat>
 
 struct StaticModel {
-    // Shader variable IDs
-    GLuint cameraMatrixID;
-    GLuint programID;
-    GLuint textureSamplerID;
-    GLuint baseColorFactorID;
-    GLuint isLightID;
-
     glm::mat4 modelMatrix;
 
     tinygltf::Model model;
 
-    // Each VAO corresponds to each mesh primitive in the GLTF model
+    // Each mesh primitive in the GLTF model is a range of the shared static geometry
     struct PrimitiveObject {
-        GLuint vao;
-        std::map<int, GLuint> vbos;
-        int indexCount;
-        GLenum indexType;
-        GLuint textureID;
-        glm::vec4 baseColorFactor;
-        bool isLight;
-        GLuint instanceVBO;
-        int instanceCount;
+        MeshRange mesh;
+        DrawMaterial material;
+        unsigned int features = 0;          // ProgramFeature bits of the material
+        const QueueProgram* program;        // Variant chosen for those features
     };
     std::vector<PrimitiveObject> primitiveObjects;
 
+    // One instance buffer shared by every primitive
+    GLuint instanceBufferID;
+    int instanceCount;
+    int visibleCount;   // Leading instances in tiles that passed the occlusion test
+    size_t instanceCapacity;
+    std::vector<glm::mat4> instanceTransforms;
+    ShadowCasterList shadowCasters;
+
+    // Local box around every primitive, for occlusion culling
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+
+    // Indices into primitiveObjects, split once at load by blend mode
+    std::vector<int> opaquePrimitives;
+    std::vector<int> transparentPrimitives;
+
     glm::mat4 getNodeTransform(const tinygltf::Node& node) {
         glm::mat4 transform(1.0f);
 
@@ -63,25 +70,8 @@ struct StaticModel {
     }
 
     bool loadModel(tinygltf::Model& model, const char* filename) {
-        tinygltf::TinyGLTF loader;
-        std::string err;
-        std::string warn;
-
-        bool res = loader.LoadASCIIFromFile(&model, &err, &warn, filename);
-        if (!warn.empty()) {
-            std::cout << "WARN: " << warn << std::endl;
-        }
-        if (!err.empty()) {
-            std::cout << "ERR: " << err << std::endl;
-        }
-        if (!res) {
-            std::cout << "Failed to load glTF: " << filename << std::endl;
-        }
-        else {
-            std::cout << "Loaded glTF: " << filename << std::endl;
-        }
-
-        return res;
+        // Parsed on the asset workers if main prefetched it
+        return Assets().takeModel(filename, model);
     }
 
     std::vector<GLuint> loadTextures(const tinygltf::Model& model) {
@@ -93,144 +83,137 @@ struct StaticModel {
 
             GLuint texID;
             glGenTextures(1, &texID);
-            glBindTexture(GL_TEXTURE_2D, texID);
 
-            // Upload texture data to OpenGL
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, image.image.data());
+            // Upload texture data to OpenGL with the other queued uploads; the image lives in this->model
+            Assets().queueUpload(PRIORITY_NORMAL, [texID, &image]() {
+                glBindTexture(GL_TEXTURE_2D, texID);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
+                    GL_RGBA, GL_UNSIGNED_BYTE, image.image.data());
 
-            // Set texture parameters
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                // Set texture parameters
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-            glGenerateMipmap(GL_TEXTURE_2D);
+                glGenerateMipmap(GL_TEXTURE_2D);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            });
 
             textureIDs[i] = texID;
-            glBindTexture(GL_TEXTURE_2D, 0);
         }
 
         return textureIDs;
     }
 
-    void initialize(GLuint programID, const std::vector<glm::mat4>& instanceTransforms, const char * filepath) {
-        // Load model from file
-        if (!loadModel(model, filepath)) {
-            return;
+    void initialize(ProgramVariants& programs, const std::vector<glm::mat4>& instanceTransforms, const char * filepath) {
+        // A cooked package is already in the arena's layout; otherwise load the model from file
+        std::shared_ptr<MappedPackage> package = std::make_shared<MappedPackage>();
+        if (package->open(filepath) && bindPackage(package, primitiveObjects)) {
+            std::cout << "Loaded cooked package: " << CookedPackagePath(filepath) << std::endl;
         }
+        else {
+            if (!loadModel(model, filepath)) {
+                return;
+            }
 
-        // Prepare buffers for rendering
-        primitiveObjects = bindModel(model);
+            // Prepare buffers for rendering
+            primitiveObjects = bindModel(model);
+        }
+        for (size_t i = 0; i < primitiveObjects.size(); ++i) {
+            PrimitiveObject& primitive = primitiveObjects[i];
+            primitive.program = &programs.get(primitive.features);
+            if (primitive.features & FEATURE_TRANSPARENT) transparentPrimitives.push_back(i);
+            else opaquePrimitives.push_back(i);
+        }
 
         // Prepare Instance buffer
-        for (auto& primitive : primitiveObjects) {
-            setupInstanceBuffer(primitive, instanceTransforms);
-        }
+        setupInstanceBuffer(instanceTransforms);
+    }
 
-        // Create and compile our GLSL program from the shaders
-        this->programID = programID;
+    void setupInstanceBuffer(const std::vector<glm::mat4>& instanceTransforms) {
+        glGenBuffers(1, &instanceBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+        glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        // Get a handle for GLSL variables
-        cameraMatrixID = glGetUniformLocation(programID, "camera");
-        textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-        baseColorFactorID = glGetUniformLocation(programID, "baseColorFactor");
-        isLightID = glGetUniformLocation(programID, "isLight");
+        this->instanceTransforms = instanceTransforms;
+        instanceCount = instanceTransforms.size();
+        visibleCount = instanceCount;
+        instanceCapacity = instanceTransforms.size();
     }
 
-    void setupInstanceBuffer(PrimitiveObject& primitiveObject, const std::vector<glm::mat4>& instanceTransforms) {
-        glGenBuffers(1, &primitiveObject.instanceVBO);
-        glBindBuffer(GL_ARRAY_BUFFER, primitiveObject.instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data(), GL_STATIC_DRAW);
+    void updateInstanceMatrices(const std::vector<glm::mat4>& newInstanceMatrices, const InstanceCulling* culling = nullptr) {
+        instanceTransforms = newInstanceMatrices;
+        visibleCount = PartitionVisible(instanceTransforms, culling, boundsMin, boundsMax);
 
-        glBindVertexArray(primitiveObject.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
 
-        // Enable and set instance attributes (4x vec4 for mat4)
-        for (int i = 0; i < 4; i++) {
-            glEnableVertexAttribArray(3 + i);
-            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4) * i));
-            glVertexAttribDivisor(3 + i, 1);
+        // Check if the data size has changed
+        if (instanceTransforms.size() <= instanceCapacity) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data());
+        } else {
+            // Reallocate buffer if so
+            glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data(), GL_DYNAMIC_DRAW);
+            instanceCapacity = instanceTransforms.size();
         }
 
+        instanceCount = instanceTransforms.size();
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        primitiveObject.instanceCount = instanceTransforms.size();
     }
 
-    void updateInstanceMatrices(const std::vector<glm::mat4>& newInstanceMatrices) {
-        for (auto& primitive : primitiveObjects) {
-            glBindBuffer(GL_ARRAY_BUFFER, primitive.instanceVBO);
-
-            // Check if the data size has changed
-            if (newInstanceMatrices.size() <= primitive.instanceCount) {
-                glBufferSubData(GL_ARRAY_BUFFER, 0, newInstanceMatrices.size() * sizeof(glm::mat4), newInstanceMatrices.data());
-            } else {
-                // Reallocate buffer if so
-                glBufferData(GL_ARRAY_BUFFER, newInstanceMatrices.size() * sizeof(glm::mat4), newInstanceMatrices.data(), GL_DYNAMIC_DRAW);
-            }
-
-            primitive.instanceCount = newInstanceMatrices.size();
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Read one vertex attribute as floats, whatever its component type (normalised integers are scaled to [0, 1])
+    static std::vector<float> readAttribute(const tinygltf::Model& model, const tinygltf::Accessor& accessor) {
+        int components = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : accessor.type;
+        std::vector<float> values(accessor.count * components, 0.0f);
+        if (accessor.bufferView < 0) {
+            return values;
         }
-    }
-
-    void bindMesh(std::vector<PrimitiveObject>& primitiveObjects,
-        tinygltf::Model& model,
-        tinygltf::Mesh& mesh) {
-        std::map<int, GLuint> vbos;
-        for (size_t i = 0; i < model.bufferViews.size(); ++i) {
-            const tinygltf::BufferView& bufferView = model.bufferViews[i];
 
-            if (bufferView.target == 0) {
-                continue;
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+        const unsigned char* data = &model.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+        int stride = accessor.ByteStride(bufferView);
+
+        for (size_t i = 0; i < accessor.count; ++i) {
+            const unsigned char* element = data + i * stride;
+            for (int c = 0; c < components; ++c) {
+                float value;
+                switch (accessor.componentType) {
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                    value = element[c] / (accessor.normalized ? 255.0f : 1.0f);
+                    break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                    value = reinterpret_cast<const uint16_t*>(element)[c] / (accessor.normalized ? 65535.0f : 1.0f);
+                    break;
+                default:
+                    value = reinterpret_cast<const float*>(element)[c];
+                    break;
+                }
+                values[i * components + c] = value;
             }
-
-            const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
-            GLuint vbo;
-            glGenBuffers(1, &vbo);
-            glBindBuffer(bufferView.target, vbo);
-            glBufferData(bufferView.target, bufferView.byteLength,
-                &buffer.data.at(0) + bufferView.byteOffset, GL_STATIC_DRAW);
-            vbos[i] = vbo;
         }
+        return values;
+    }
 
-        for (size_t i = 0; i < mesh.primitives.size(); ++i) {
-            tinygltf::Primitive primitive = mesh.primitives[i];
-
-            GLuint vao;
-            glGenVertexArrays(1, &vao);
-            glBindVertexArray(vao);
-
-            for (auto& attrib : primitive.attributes) {
-                const tinygltf::Accessor& accessor = model.accessors[attrib.second];
-                const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-                glBindBuffer(GL_ARRAY_BUFFER, vbos[accessor.bufferView]);
-
-                int size = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : accessor.type;
-                int vaa = -1;
-                if (attrib.first == "POSITION") vaa = 0;
-                if (attrib.first == "NORMAL") vaa = 1;
-                if (attrib.first == "TEXCOORD_0") vaa = 2;
-
-                if (vaa > -1) {
-                    glEnableVertexAttribArray(vaa);
-                    glVertexAttribPointer(vaa, size, accessor.componentType,
-                        accessor.normalized ? GL_TRUE : GL_FALSE,
-                        accessor.ByteStride(bufferView),
-                        BUFFER_OFFSET(accessor.byteOffset));
-                }
-                else {
-                    std::cout << "vaa missing: " << attrib.first << std::endl;
-                }
+    static std::vector<GLuint> readIndices(const tinygltf::Model& model, const tinygltf::Accessor& accessor) {
+        std::vector<GLuint> indices(accessor.count);
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+        const unsigned char* data = &model.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+
+        for (size_t i = 0; i < accessor.count; ++i) {
+            switch (accessor.componentType) {
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                indices[i] = data[i];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                indices[i] = reinterpret_cast<const uint16_t*>(data)[i];
+                break;
+            default:
+                indices[i] = reinterpret_cast<const uint32_t*>(data)[i];
+                break;
             }
-
-            PrimitiveObject primitiveObject;
-            primitiveObject.vao = vao;
-            primitiveObject.vbos = vbos;
-            primitiveObjects.push_back(primitiveObject);
-
-            glBindVertexArray(0);
         }
+        return indices;
     }
 
     std::vector<PrimitiveObject> bindModel(tinygltf::Model& model) {
@@ -239,88 +222,63 @@ struct StaticModel {
         // Load all textures
         std::vector<GLuint> textureIDs = loadTextures(model);
 
-        // Create VBOs for all buffer views
-        std::map<int, GLuint> bufferViewVBOs;
-        for (size_t i = 0; i < model.bufferViews.size(); ++i) {
-            const tinygltf::BufferView& bufferView = model.bufferViews[i];
-            const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
-
-            GLuint vbo;
-            glGenBuffers(1, &vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER, bufferView.byteLength,
-                &buffer.data[bufferView.byteOffset], GL_STATIC_DRAW);
-
-            bufferViewVBOs[i] = vbo;
-        }
-
         // Iterate through all meshes and primitives
         for (const auto& mesh : model.meshes) {
             for (const auto& primitive : mesh.primitives) {
                 PrimitiveObject primitiveObject;
 
-                // Create a VAO for the primitive
-                glGenVertexArrays(1, &primitiveObject.vao);
-                glBindVertexArray(primitiveObject.vao);
-
-                // Set up attributes (POSITION, TEXCOORD_0, NORMAL)
+                // Interleave POSITION, NORMAL and TEXCOORD_0 into the shared vertex format
+                auto position = primitive.attributes.find("POSITION");
+                if (position == primitive.attributes.end()) {
+                    continue;
+                }
+                std::vector<StaticVertex> vertices(model.accessors[position->second].count);
                 for (const auto& attrib : primitive.attributes) {
                     const std::string& attribName = attrib.first;
-                    const tinygltf::Accessor& accessor = model.accessors[attrib.second];
-                    const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-
-                    int size = 1;
-                    if (accessor.type != TINYGLTF_TYPE_SCALAR) {
-                        size = accessor.type;
+                    if (attribName != "POSITION" && attribName != "NORMAL" && attribName != "TEXCOORD_0") {
+                        continue;
                     }
 
-                    GLuint vbo = bufferViewVBOs[accessor.bufferView];
-                    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-                    int location = -1;
-                    if (attribName == "POSITION") location = 0;
-                    if (attribName == "NORMAL") location = 1;
-                    if (attribName == "TEXCOORD_0") location = 2;
-
-                    if (location != -1) {
-                        glEnableVertexAttribArray(location);
-                        glVertexAttribPointer(location, size, accessor.componentType,
-                            accessor.normalized ? GL_TRUE : GL_FALSE,
-                            accessor.ByteStride(bufferView),
-                            (void*)(accessor.byteOffset));
+                    std::vector<float> values = readAttribute(model, model.accessors[attrib.second]);
+                    for (size_t v = 0; v < vertices.size(); ++v) {
+                        if (attribName == "POSITION") vertices[v].position = glm::make_vec3(&values[v * 3]);
+                        if (attribName == "NORMAL") vertices[v].normal = glm::make_vec3(&values[v * 3]);
+                        if (attribName == "TEXCOORD_0") vertices[v].uv = glm::make_vec2(&values[v * 2]);
                     }
                 }
 
-                // Set up the element array buffer (indices)
+                // Indices are widened to 32 bits; non-indexed primitives get a trivial list
+                std::vector<GLuint> indices;
                 if (primitive.indices >= 0) {
-                    const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
-                    const tinygltf::BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
-
-                    GLuint ebo;
-                    glGenBuffers(1, &ebo);
-                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-                    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferView.byteLength,
-                        &model.buffers[indexBufferView.buffer].data[indexBufferView.byteOffset], GL_STATIC_DRAW);
+                    indices = readIndices(model, model.accessors[primitive.indices]);
+                }
+                else {
+                    indices.resize(vertices.size());
+                    for (size_t v = 0; v < indices.size(); ++v) indices[v] = v;
+                }
 
-                    primitiveObject.indexCount = indexAccessor.count;
-                    primitiveObject.indexType = indexAccessor.componentType;
+                for (const auto& vertex : vertices) {
+                    boundsMin = glm::min(boundsMin, vertex.position);
+                    boundsMax = glm::max(boundsMax, vertex.position);
                 }
 
+                primitiveObject.mesh = StaticGeometry().addMesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+
                 // Bind texture and retrieve baseColorFactor
                 if (primitive.material >= 0) {
                     const tinygltf::Material& material = model.materials[primitive.material];
 
                     if (material.pbrMetallicRoughness.baseColorTexture.index >= 0) {
                         int textureIndex = material.pbrMetallicRoughness.baseColorTexture.index;
-                        primitiveObject.textureID = textureIDs[textureIndex];
+                        primitiveObject.material.textureID = textureIDs[textureIndex];
                     }
                     else {
-                        primitiveObject.textureID = 0;
+                        primitiveObject.material.textureID = 0;
                     }
 
                     // Extract baseColorFactor
                     if (material.pbrMetallicRoughness.baseColorFactor.size() == 4) {
-                        primitiveObject.baseColorFactor = glm::vec4(
+                        primitiveObject.material.baseColorFactor = glm::vec4(
                             material.pbrMetallicRoughness.baseColorFactor[0],
                             material.pbrMetallicRoughness.baseColorFactor[1],
                             material.pbrMetallicRoughness.baseColorFactor[2],
@@ -329,123 +287,114 @@ struct StaticModel {
                     }
                     else {
                         // Default to opaque white
-                        primitiveObject.baseColorFactor = glm::vec4(1.0f);
+                        primitiveObject.material.baseColorFactor = glm::vec4(1.0f);
+                    }
+
+                    // Lights are marked with KHR_materials_unlit; glass blends or has a translucent base colour
+                    if (material.extensions.count("KHR_materials_unlit")) primitiveObject.features |= FEATURE_UNLIT;
+                    if (material.alphaMode == "BLEND" || primitiveObject.material.baseColorFactor.a < 1.0f) {
+                        primitiveObject.features |= FEATURE_TRANSPARENT;
                     }
-                    primitiveObject.isLight = (material.name == "street_lamp_01_bulb");
                 }
                 else {
                     // Default to opaque white
-                    primitiveObject.textureID = 0;
-                    primitiveObject.baseColorFactor = glm::vec4(1.0f);
+                    primitiveObject.material.textureID = 0;
+                    primitiveObject.material.baseColorFactor = glm::vec4(1.0f);
                 }
 
-                glBindVertexArray(0);
                 primitives.push_back(primitiveObject);
             }
         }
         return primitives;
     }
 
-    void render(const glm::mat4& cameraMatrix) {
-        glUseProgram(programID);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-        // Set camera
-        glUniformMatrix4fv(cameraMatrixID, 1, GL_FALSE, &cameraMatrix[0][0]);
-
-        // Separate opaque and transparent objects
-        std::vector<const PrimitiveObject*> opaqueObjects;
-        std::vector<const PrimitiveObject*> transparentObjects;
-
-        for (const auto& primitive : primitiveObjects) {
-            if (primitive.baseColorFactor.a < 1.0f) {
-                transparentObjects.push_back(&primitive);
-            }
-            else {
-                opaqueObjects.push_back(&primitive);
-            }
+    // The cooked counterpart of bindModel; on false nothing is bound, so the glTF can be loaded instead
+    bool bindPackage(const std::shared_ptr<MappedPackage>& package, std::vector<PrimitiveObject>& primitives) {
+        size_t vertexCount, indexCount, primitiveCount, textureCount, boundsCount;
+        const PackageVertex* vertices = package->section<PackageVertex>(SECTION_VERTICES, vertexCount);
+        const uint32_t* indices = package->section<uint32_t>(SECTION_INDICES, indexCount);
+        const PackagePrimitive* packagePrimitives = package->section<PackagePrimitive>(SECTION_PRIMITIVES, primitiveCount);
+        const PackageTexture* textures = package->section<PackageTexture>(SECTION_TEXTURES, textureCount);
+        const PackageBounds* bounds = package->section<PackageBounds>(SECTION_BOUNDS, boundsCount);
+        if (vertices == nullptr || indices == nullptr || packagePrimitives == nullptr || boundsCount != 1) {
+            return false;
         }
-
-        // Render opaque objects first
-        for (const auto* primitive : opaqueObjects) {
-            glBindVertexArray(primitive->vao);
-            glBindBuffer(GL_ARRAY_BUFFER, primitive->instanceVBO);
-            for (int i = 0; i < 4; ++i) {
-                glEnableVertexAttribArray(3 + i);
-                glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-                glVertexAttribDivisor(3 + i, 1);
-            }
-            if (primitive->textureID) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, primitive->textureID);
-                glUniform1i(textureSamplerID, 0);
+        for (size_t i = 0; i < primitiveCount; ++i) {
+            const PackagePrimitive& primitive = packagePrimitives[i];
+            if (static_cast<size_t>(primitive.firstVertex) + primitive.vertexCount > vertexCount ||
+                static_cast<size_t>(primitive.firstIndex) + primitive.indexCount > indexCount ||
+                primitive.texture >= static_cast<int32_t>(textureCount)) {
+                std::cerr << "Cooked package does not match its model, loading the glTF instead" << std::endl;
+                return false;
             }
-
-            glUniform1i(isLightID, primitive->isLight ? 1 : 0);
-            glUniform4fv(baseColorFactorID, 1, &primitive->baseColorFactor[0]);
-            glDrawElementsInstanced(GL_TRIANGLES, primitive->indexCount, primitive->indexType, 0, primitive->instanceCount);
-            glBindTexture(GL_TEXTURE_2D, 0);
         }
 
-        // Sort transparent objects by distance from the camera
-        std::sort(transparentObjects.begin(), transparentObjects.end(),
-            [&cameraMatrix](const PrimitiveObject* a, const PrimitiveObject* b) {
-                glm::vec3 aPos = glm::vec3(cameraMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-                glm::vec3 bPos = glm::vec3(cameraMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-                return glm::length(aPos) > glm::length(bPos);
-            });
-
-        // Render transparent objects
-        for (const auto* primitive : transparentObjects) {
-            glBindVertexArray(primitive->vao);
-            glBindBuffer(GL_ARRAY_BUFFER, primitive->instanceVBO);
-            for (int i = 0; i < 4; ++i) {
-                glEnableVertexAttribArray(3 + i);
-                glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-                glVertexAttribDivisor(3 + i, 1);
-            }
-            if (primitive->textureID) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, primitive->textureID);
-                glUniform1i(textureSamplerID, 0);
+        // Mip chains upload from the mapping, which the last queued upload releases
+        std::vector<GLuint> textureIDs(textureCount, 0);
+        for (size_t i = 0; i < textureCount; ++i) {
+            glGenTextures(1, &textureIDs[i]);
+            const PackageTexture* texture = &textures[i];
+            const uint8_t* pixels = package->texturePixels(*texture);
+            if (pixels == nullptr) {
+                continue;
             }
-            glUniform1i(isLightID, primitive->isLight ? 1 : 0);
-            glUniform4fv(baseColorFactorID, 1, &primitive->baseColorFactor[0]);
-            glDrawElementsInstanced(GL_TRIANGLES, primitive->indexCount, primitive->indexType, 0, primitive->instanceCount);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            GLuint texID = textureIDs[i];
+            Assets().queueUpload(PRIORITY_NORMAL, [texID, texture, pixels, package]() {
+                UploadCookedTexture(texID, GL_TEXTURE_2D, *texture, pixels);
+            });
         }
 
-        glDisable(GL_BLEND);
-        for (int i = 0; i < 4; ++i) {
-            glDisableVertexAttribArray(3 + i);
+        static_assert(sizeof(PackageVertex) == sizeof(StaticVertex), "cooked vertices must match StaticVertex");
+        for (size_t i = 0; i < primitiveCount; ++i) {
+            const PackagePrimitive& primitive = packagePrimitives[i];
+            PrimitiveObject primitiveObject;
+            primitiveObject.mesh = StaticGeometry().addMesh(reinterpret_cast<const StaticVertex*>(vertices + primitive.firstVertex),
+                primitive.vertexCount, indices + primitive.firstIndex, primitive.indexCount);
+            primitiveObject.material.textureID = primitive.texture >= 0 ? textureIDs[primitive.texture] : 0;
+            primitiveObject.material.baseColorFactor = glm::make_vec4(primitive.baseColorFactor);
+            if (primitive.flags & PACKAGE_MATERIAL_UNLIT) primitiveObject.features |= FEATURE_UNLIT;
+            if (primitive.flags & PACKAGE_MATERIAL_BLEND) primitiveObject.features |= FEATURE_TRANSPARENT;
+            primitives.push_back(primitiveObject);
         }
-        glUseProgram(0);
-        glBindVertexArray(0);
-    }
 
-    void renderDepth(GLuint programID, GLuint lightMatID, const glm::mat4& lightSpaceMatrix) {
-        glUseProgram(programID);
+        boundsMin = glm::make_vec3(bounds->min);
+        boundsMax = glm::make_vec3(bounds->max);
+        return true;
+    }
 
-        glUniformMatrix4fv(lightMatID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+    // Per-layer caster lists over all instances, including those occluded from the camera
+    void updateShadowCasters(const std::vector<ShadowLight>& lights) {
+        glm::vec3 localMin = boundsMin, localMax = boundsMax;
+        shadowCasters.update(instanceTransforms, lights, [&](const glm::mat4& transform, glm::vec3& worldMin, glm::vec3& worldMax) {
+            TransformBox(transform, localMin, localMax, worldMin, worldMax);
+        });
+    }
 
-        // Render each primitive
-        for (const auto& primitive : primitiveObjects) {
-            glBindVertexArray(primitive.vao);
-            glBindBuffer(GL_ARRAY_BUFFER, primitive.instanceVBO);
-            for (int i = 0; i < 4; ++i) {
-                glEnableVertexAttribArray(3 + i);
-                glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-                glVertexAttribDivisor(3 + i, 1);
-            }
-            glDrawElementsInstanced(GL_TRIANGLES, primitive.indexCount, primitive.indexType, 0, primitive.instanceCount);
+    // Shadow packets come from the lists built by updateShadowCasters
+    void submit(RenderQueue& queue, const QueueProgram* shadowProgram = nullptr) {
+        // Transparent primitives go to the transparency pass; order independent, so no sorting
+        GeometryArena& geometry = StaticGeometry();
+        for (int index : opaquePrimitives) {
+            const PrimitiveObject& primitive = primitiveObjects[index];
+            queue.submit(PASS_OPAQUE, *primitive.program, &primitive.material, geometry, instanceBufferID, sizeof(glm::mat4), false, primitive.mesh, visibleCount);
+        }
+        for (int index : transparentPrimitives) {
+            const PrimitiveObject& primitive = primitiveObjects[index];
+            queue.submit(PASS_TRANSPARENT, *primitive.program, &primitive.material, geometry, instanceBufferID, sizeof(glm::mat4), false, primitive.mesh, visibleCount);
         }
 
-        for (int i = 0; i < 4; ++i) {
-            glDisableVertexAttribArray(3 + i);
+        if (shadowProgram != nullptr) {
+            for (int layer = 0; layer < shadowCasters.ranges.size(); ++layer) {
+                const ShadowCasterList::Range& range = shadowCasters.ranges[layer];
+                for (const auto& primitive : primitiveObjects) {
+                    queue.submitShadow(layer, *shadowProgram, geometry, shadowCasters.bufferID, sizeof(glm::mat4), false, primitive.mesh, range.first, range.count);
+                }
+            }
         }
-        glBindVertexArray(0);
-        glUseProgram(0);
     }
-};
 
+    void cleanup() {
+        glDeleteBuffers(1, &instanceBufferID);
+        shadowCasters.cleanup();
+    }
+};
\ No newline at end of file
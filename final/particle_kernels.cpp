@@ -0,0 +1,198 @@
+#include <render/headers.h>
+#include <render/cpu.h>
+#include <cstdint>
+
+// SIMD kernels for the CPU particle path. AVX2 (picked at run time, see cpu.h) and SSE2 share one
+// layout: particles are stored structure-of-arrays and every emitter block is a multiple of
+// eight particles long.
+#if defined(CPU_AVX2_DISPATCH)
+#include <immintrin.h>
+#define PARTICLES_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLES_SSE2
+#endif
+
+// PCG32 generator; each emitter owns one so respawns never touch the global rand() state
+struct ParticleRandom {
+	uint64_t state = 0x853c49e6748fea9bULL;
+	uint64_t increment = 0xda3e39cb94b95bdbULL;
+
+	void seed(uint64_t initState, uint64_t sequence) {
+		state = 0;
+		increment = (sequence << 1u) | 1u;
+		next();
+		state += initState;
+		next();
+	}
+
+	uint32_t next() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + increment;
+		uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = static_cast<uint32_t>(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31u));
+	}
+
+	// Uniform in [0, 1)
+	float uniform() {
+		return (next() >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+struct ParticleStreams {
+	std::vector<float> x, y, z;
+	std::vector<float> speed;
+	std::vector<float> lifetime;
+	std::vector<float> age;
+	std::vector<float> alpha;
+
+	void resize(size_t count) {
+		x.assign(count, 0.0f);
+		y.assign(count, 0.0f);
+		z.assign(count, 0.0f);
+		speed.assign(count, 0.0f);
+		lifetime.assign(count, 1.0f);
+		age.assign(count, 0.0f);
+		alpha.assign(count, 0.0f);
+	}
+};
+
+// Eight xorshift32 lanes used for the per-frame drift direction
+static inline void xorshiftLanes(uint32_t* lanes) {
+	for (int i = 0; i < 8; ++i) {
+		uint32_t v = lanes[i];
+		v ^= v << 13;
+		v ^= v >> 17;
+		v ^= v << 5;
+		lanes[i] = v;
+	}
+}
+
+#if defined(PARTICLES_AVX2)
+// The AVX2 part of advanceParticles, eight particles a step; returns where it stopped
+CPU_AVX2_TARGET static int advanceParticlesAVX2(ParticleStreams& s, int i, int end, float deltaTime, uint32_t* driftLanes, std::vector<int>& dead) {
+	const __m256 dt = _mm256_set1_ps(deltaTime);
+	const __m256 halfDt = _mm256_set1_ps(0.5f * deltaTime);
+	const __m256 fade = _mm256_set1_ps(0.6f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256i signMask = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+	__m256i rng = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(driftLanes));
+
+	for (; i + 8 <= end; i += 8) {
+		__m256 age = _mm256_add_ps(_mm256_loadu_ps(&s.age[i]), dt);
+		__m256 lifetime = _mm256_loadu_ps(&s.lifetime[i]);
+		__m256 y = _mm256_add_ps(_mm256_loadu_ps(&s.y[i]), _mm256_mul_ps(_mm256_loadu_ps(&s.speed[i]), dt));
+
+		// Random sign from the top bit of each lane
+		rng = _mm256_xor_si256(rng, _mm256_slli_epi32(rng, 13));
+		rng = _mm256_xor_si256(rng, _mm256_srli_epi32(rng, 17));
+		rng = _mm256_xor_si256(rng, _mm256_slli_epi32(rng, 5));
+		__m256 drift = _mm256_xor_ps(halfDt, _mm256_castsi256_ps(_mm256_and_si256(rng, signMask)));
+		__m256 x = _mm256_add_ps(_mm256_loadu_ps(&s.x[i]), drift);
+
+		__m256 alpha = _mm256_sub_ps(fade, _mm256_mul_ps(_mm256_div_ps(age, lifetime), fade));
+		alpha = _mm256_min_ps(_mm256_max_ps(alpha, zero), one);
+
+		_mm256_storeu_ps(&s.x[i], x);
+		_mm256_storeu_ps(&s.y[i], y);
+		_mm256_storeu_ps(&s.age[i], age);
+		_mm256_storeu_ps(&s.alpha[i], alpha);
+
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(age, lifetime, _CMP_GE_OQ));
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+			if (mask & 1) dead.push_back(i + lane);
+		}
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(driftLanes), rng);
+	return i;
+}
+#endif
+
+// Advance particles [first, first + count): age, rise, drift and fade. Indices of particles that
+// reached the end of their life are appended to dead for the caller to respawn.
+static void advanceParticles(ParticleStreams& s, int first, int count, float deltaTime, uint32_t* driftLanes, std::vector<int>& dead) {
+	int end = first + count;
+	int i = first;
+
+#if defined(PARTICLES_AVX2)
+	if (HasAVX2()) i = advanceParticlesAVX2(s, i, end, deltaTime, driftLanes, dead);
+#endif
+#if defined(PARTICLES_SSE2)
+	{
+		const __m128 dt = _mm_set1_ps(deltaTime);
+		const __m128 halfDt = _mm_set1_ps(0.5f * deltaTime);
+		const __m128 fade = _mm_set1_ps(0.6f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128i signMask = _mm_set1_epi32(static_cast<int>(0x80000000u));
+		__m128i rng = _mm_loadu_si128(reinterpret_cast<const __m128i*>(driftLanes));
+
+		for (; i + 4 <= end; i += 4) {
+			__m128 age = _mm_add_ps(_mm_loadu_ps(&s.age[i]), dt);
+			__m128 lifetime = _mm_loadu_ps(&s.lifetime[i]);
+			__m128 y = _mm_add_ps(_mm_loadu_ps(&s.y[i]), _mm_mul_ps(_mm_loadu_ps(&s.speed[i]), dt));
+
+			// Random sign from the top bit of each lane
+			rng = _mm_xor_si128(rng, _mm_slli_epi32(rng, 13));
+			rng = _mm_xor_si128(rng, _mm_srli_epi32(rng, 17));
+			rng = _mm_xor_si128(rng, _mm_slli_epi32(rng, 5));
+			__m128 drift = _mm_xor_ps(halfDt, _mm_castsi128_ps(_mm_and_si128(rng, signMask)));
+			__m128 x = _mm_add_ps(_mm_loadu_ps(&s.x[i]), drift);
+
+			__m128 alpha = _mm_sub_ps(fade, _mm_mul_ps(_mm_div_ps(age, lifetime), fade));
+			alpha = _mm_min_ps(_mm_max_ps(alpha, zero), one);
+
+			_mm_storeu_ps(&s.x[i], x);
+			_mm_storeu_ps(&s.y[i], y);
+			_mm_storeu_ps(&s.age[i], age);
+			_mm_storeu_ps(&s.alpha[i], alpha);
+
+			int mask = _mm_movemask_ps(_mm_cmpge_ps(age, lifetime));
+			for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+				if (mask & 1) dead.push_back(i + lane);
+			}
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(driftLanes), rng);
+	}
+#endif
+
+	// Scalar tail (the whole range when no SIMD is available)
+	for (; i < end; i += 8) {
+		xorshiftLanes(driftLanes);
+		for (int lane = 0; lane < 8 && i + lane < end; ++lane) {
+			int p = i + lane;
+			s.age[p] += deltaTime;
+			s.y[p] += s.speed[p] * deltaTime;
+			s.x[p] += (driftLanes[lane] & 0x80000000u) ? -0.5f * deltaTime : 0.5f * deltaTime;
+			s.alpha[p] = glm::clamp(0.6f - (s.age[p] / s.lifetime[p]) * 0.6f, 0.0f, 1.0f);
+			if (s.age[p] >= s.lifetime[p]) dead.push_back(p);
+		}
+	}
+}
+
+// Interleave particles [first, first + count) into vec4(position, alpha) for upload
+static void packParticles(const ParticleStreams& s, int first, int count, glm::vec4* out) {
+	int end = first + count;
+	int i = first;
+
+#if defined(PARTICLES_SSE2)
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_loadu_ps(&s.x[i]);
+		__m128 y = _mm_loadu_ps(&s.y[i]);
+		__m128 z = _mm_loadu_ps(&s.z[i]);
+		__m128 a = _mm_loadu_ps(&s.alpha[i]);
+		_MM_TRANSPOSE4_PS(x, y, z, a);
+		_mm_storeu_ps(&out[i][0], x);
+		_mm_storeu_ps(&out[i + 1][0], y);
+		_mm_storeu_ps(&out[i + 2][0], z);
+		_mm_storeu_ps(&out[i + 3][0], a);
+	}
+#endif
+
+	for (; i < end; ++i) {
+		out[i] = glm::vec4(s.x[i], s.y[i], s.z[i], s.alpha[i]);
+	}
+}
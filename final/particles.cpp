@@ -1,25 +1,75 @@
 #include <render/texture.h>
+#include <render/assets.h>
 #include <render/shader.h>
+#include <render/frustum.h>
+#include <render/occlusion.h>
+#include <particle_kernels.cpp>
+
+// Simulation state of one particle on the GPU path, interleaved as captured by transform feedback
+struct ParticleState {
+	glm::vec4 positionSpeed;	// xyz = position, w = rise speed
+	glm::vec3 lifeAgeSeed;		// x = lifetime, y = age, z = RNG state
+};
 
-struct Particle {
-	glm::vec3 position;
-	glm::vec3 scale;
-	float speed;
-	float lifetime;
-	float currentTime;
-	float alpha;
+// A lamp's block of the particle pool
+struct ParticleEmitter {
+	glm::vec3 center;
+	bool active;
+	bool visible;
+	ParticleRandom random;		// Respawns on the CPU path
+	uint32_t driftLanes[8];		// Per-frame drift on the CPU path
+	float angle;				// Shared mode: rotation of the canonical field about the lamp
+	float phase;				// Shared mode: offset into each particle's life, in lifetimes
+	int liveCount;				// Particles of the block currently in use (see updateBudget)
+	float sizeScale;			// Grows as liveCount drops to keep the same coverage
 };
 
+// Global particle pool: every emitter owns a fixed block of particles in one set of buffers and
+// all visible emitters are drawn with a single instanced draw. Freed blocks go on a free list and
+// are reused lowest-first, so the live range stays compact without moving any particles.
 struct ParticleSystem {
 
+	static const int MAX_EMITTERS = 16;
+	static const int DIRECTION_COUNT = 1024;
+
 	glm::mat4 modelMatrix;
 
+	// Simulate on the GPU with transform feedback; the CPU path is kept for contexts without it.
+	// Headless nodes on the CPU path can raise particlesPerEmitter (e.g. 8192 for 128k particles).
+	bool gpuSimulation = true;
+	int particlesPerEmitter = 1000;
+	float emitterRadius = 200.0f;
+
+	// Shared simulation (GPU path): every lamp is statistically identical, so only sharedFields
+	// canonical fields are simulated and each lamp draws one of them rotated and phase shifted
+	bool sharedSimulation = true;
+	int sharedFields = 2;
+
+	// Live particles shared between visible emitters by projected size and fog, so the total
+	// stays bounded however many lamps are in view. Hidden emitters idle at minimumParticles.
+	int particleBudget = 4000;
+	int minimumParticles = 64;
+	float maxSizeScale = 3.0f;
+	float fogMinDistance = 1024.0f;
+	float fogMaxDistance = 2048.0f;
+
+	ParticleEmitter emitters[MAX_EMITTERS];
+	std::vector<int> freeEmitters;
+	int emitterHighWater = 0;	// One past the highest block in use
+
+	// Visible block range drawn this frame
+	int firstVisibleEmitter = 0;
+	int visibleEmitterEnd = 0;
+
+	// Emitters that fail the occlusion tests are treated as hidden
+	const InstanceCulling* culling = nullptr;
+
+	// CPU path: SoA simulation streams, packed into vec4(position, alpha) per particle for upload
 	GLuint instanceBufferID;
-	std::vector<glm::mat4> instanceTransforms;
-	std::vector<float> alphas;
-	std::vector<Particle> particles;
-
-	glm::vec3 center;
+	ParticleStreams streams;
+	std::vector<glm::vec4> positionAlphas;
+	std::vector<int> deadParticles;
+	glm::vec2 directions[DIRECTION_COUNT];	// Unit circle, so respawns skip cos/sin
 
 	GLfloat vertex_buffer_data[12] = {
 		-0.5f, -0.5f, 0.0f, // bottom-left
@@ -48,55 +98,216 @@ struct ParticleSystem {
 	GLuint textureID;
 	GLuint cameraMatrixID;
 	GLuint cameraPositionID;
-	GLuint alphaBufferID;
+	GLuint emitterScalesID;
+	GLuint particlesPerEmitterID;
+	GLuint firstParticleID;
 
 	// Shader variable IDs
 	GLuint textureSamplerID;
 	GLuint programID;
 
-	void initialize(glm::vec3 center) {
-		// Initialize particles
-		this->center = center;
-		initializeParticles(1000);
-
-		// Create a vertex array object
-		glGenVertexArrays(1, &vertexArrayID);
-		glBindVertexArray(vertexArrayID);
+	// GPU simulation: ping-pong between two state buffers, each with an update and a render VAO
+	GLuint stateBufferIDs[2];
+	GLuint updateArrayIDs[2];
+	GLuint stateArrayIDs[2];
+	int currentState = 0;
+	GLuint updateProgramID;
+	GLuint stateProgramID;
+	GLuint deltaTimeID;
+	GLuint updateEmittersID;
+	GLuint updateParticlesPerEmitterID;
+	GLuint emitterRadiusID;
+	GLuint stateCameraMatrixID;
+	GLuint stateCameraPositionID;
+	GLuint stateTextureSamplerID;
+	GLuint stateEmittersID;
+	GLuint stateParticlesPerEmitterID;
+	GLuint stateFirstParticleID;
+	GLuint stateEmitterScalesID;
+
+	// Shared simulation: the mesh holds one quad per lamp and the instances are the field's particles
+	GLuint sharedArrayIDs[2];
+	GLuint sharedIndexBufferID;
+	GLuint sharedProgramID;
+	GLuint sharedCameraMatrixID;
+	GLuint sharedCameraPositionID;
+	GLuint sharedTextureSamplerID;
+	GLuint sharedPlacementsID;
+	GLuint sharedPlacementLODsID;
+
+	void initialize() {
+		// Keep every block a whole number of SIMD widths
+		particlesPerEmitter = (particlesPerEmitter + 7) & ~7;
+		sharedFields = glm::clamp(sharedFields, 1, MAX_EMITTERS);
+
+		for (int i = MAX_EMITTERS - 1; i >= 0; --i) {
+			emitters[i].active = false;
+			emitters[i].visible = false;
+			freeEmitters.push_back(i);
+		}
 
-		// Create a vertex buffer object to store the vertex data		
+		// Quad geometry
 		glGenBuffers(1, &vertexBufferID);
 		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
 
-		// Create a vertex buffer object to store the UV data
 		glGenBuffers(1, &uvBufferID);
 		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
 
-		// Create an index buffer object to store the index data that defines triangle faces
 		glGenBuffers(1, &indexBufferID);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
 
-		// Create instance buffer
-		glGenBuffers(1, &instanceBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(glm::mat4), instanceTransforms.data(), GL_STATIC_DRAW);
+		// Load the texture into GPU memory
+		textureID = Assets().loadTexture("../final/assets/particle.png", PRIORITY_LOW);
+
+		if (gpuSimulation) initializeSimulation();
+		else initializeInstances();
+	}
+
+	void initializeSimulation() {
+		std::vector<ParticleState> states = deadStates(MAX_EMITTERS * particlesPerEmitter);
+
+		glGenBuffers(2, stateBufferIDs);
+		glGenVertexArrays(2, updateArrayIDs);
+		glGenVertexArrays(2, stateArrayIDs);
+		for (int i = 0; i < 2; ++i) {
+			glBindBuffer(GL_ARRAY_BUFFER, stateBufferIDs[i]);
+			glBufferData(GL_ARRAY_BUFFER, states.size() * sizeof(ParticleState), states.data(), GL_DYNAMIC_COPY);
+
+			// Update: one point per particle
+			glBindVertexArray(updateArrayIDs[i]);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleState), (void*)0);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleState), (void*)sizeof(glm::vec4));
+
+			// Render: one quad instance per particle (instance attributes are pointed in render)
+			glBindVertexArray(stateArrayIDs[i]);
+			glEnableVertexAttribArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+			glEnableVertexAttribArray(2);
+			glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+
+			glEnableVertexAttribArray(3);
+			glVertexAttribDivisor(3, 1);
+			glEnableVertexAttribArray(4);
+			glVertexAttribDivisor(4, 1);
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// Create and compile our GLSL programs from the shaders
+		updateProgramID = LoadTransformFeedbackShaderFromFile("../final/shader/particle_update.vert", { "outPositionSpeed", "outLifeAgeSeed" });
+		stateProgramID = LoadShadersFromFile("../final/shader/particle_state.vert", "../final/shader/particle.frag");
+		if (updateProgramID == 0 || stateProgramID == 0)
+		{
+			std::cerr << "Failed to load particle simulation shaders." << std::endl;
+		}
+
+		// Get a handle for GLSL variables
+		deltaTimeID = glGetUniformLocation(updateProgramID, "deltaTime");
+		updateEmittersID = glGetUniformLocation(updateProgramID, "emitters");
+		updateParticlesPerEmitterID = glGetUniformLocation(updateProgramID, "particlesPerEmitter");
+		emitterRadiusID = glGetUniformLocation(updateProgramID, "emitterRadius");
+		stateCameraMatrixID = glGetUniformLocation(stateProgramID, "cameraMVP");
+		stateCameraPositionID = glGetUniformLocation(stateProgramID, "cameraPos");
+		stateTextureSamplerID = glGetUniformLocation(stateProgramID, "textureSampler");
+		stateEmittersID = glGetUniformLocation(stateProgramID, "emitters");
+		stateParticlesPerEmitterID = glGetUniformLocation(stateProgramID, "particlesPerEmitter");
+		stateFirstParticleID = glGetUniformLocation(stateProgramID, "firstParticle");
+		stateEmitterScalesID = glGetUniformLocation(stateProgramID, "emitterScales");
+
+		if (sharedSimulation) initializeShared();
+	}
+
+	// Zeroed state is a dead particle, which respawns on the first update its emitter is active
+	std::vector<ParticleState> deadStates(int count) const {
+		std::vector<ParticleState> states(count);
+		for (size_t i = 0; i < states.size(); ++i) {
+			states[i].positionSpeed = glm::vec4(0.0f);
+			states[i].lifeAgeSeed = glm::vec3(0.0f, 0.0f, static_cast<float>(rand() & 0xFFFFFF));
+		}
+		return states;
+	}
+
+	void initializeShared() {
+		// Quad q of the mesh uses vertices 4q..4q+3; the shader derives corners from gl_VertexID
+		std::vector<GLuint> indices;
+		for (GLuint q = 0; q < MAX_EMITTERS; ++q) {
+			GLuint quad[6] = { 4 * q, 4 * q + 1, 4 * q + 2, 4 * q, 4 * q + 2, 4 * q + 3 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+
+		glGenBuffers(1, &sharedIndexBufferID);
+		glBindBuffer(GL_ARRAY_BUFFER, sharedIndexBufferID);
+		glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glGenVertexArrays(2, sharedArrayIDs);
+		for (int i = 0; i < 2; ++i) {
+			glBindVertexArray(sharedArrayIDs[i]);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sharedIndexBufferID);
 
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
+			glEnableVertexAttribArray(3);
+			glVertexAttribDivisor(3, 1);
+			glEnableVertexAttribArray(4);
+			glVertexAttribDivisor(4, 1);
 		}
+		glBindVertexArray(0);
 
-		// Create alpha buffer
-		glGenBuffers(1, &alphaBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, alphaBufferID);
-		glBufferData(GL_ARRAY_BUFFER, alphas.size() * sizeof(float), alphas.data(), GL_DYNAMIC_DRAW);
+		sharedProgramID = LoadShadersFromFile("../final/shader/particle_shared.vert", "../final/shader/particle.frag");
+		if (sharedProgramID == 0)
+		{
+			std::cerr << "Failed to load shared particle shaders." << std::endl;
+		}
+
+		sharedCameraMatrixID = glGetUniformLocation(sharedProgramID, "cameraMVP");
+		sharedCameraPositionID = glGetUniformLocation(sharedProgramID, "cameraPos");
+		sharedTextureSamplerID = glGetUniformLocation(sharedProgramID, "textureSampler");
+		sharedPlacementsID = glGetUniformLocation(sharedProgramID, "placements");
+		sharedPlacementLODsID = glGetUniformLocation(sharedProgramID, "placementLODs");
+	}
+
+	void initializeInstances() {
+		// CPU path: the whole pool is allocated up front, inactive blocks have zero alpha and are not rasterised
+		streams.resize(MAX_EMITTERS * particlesPerEmitter);
+		positionAlphas.assign(MAX_EMITTERS * particlesPerEmitter, glm::vec4(0.0f));
+		deadParticles.reserve(particlesPerEmitter);
+		for (int i = 0; i < DIRECTION_COUNT; ++i) {
+			float angle = 2.0f * glm::pi<float>() * i / DIRECTION_COUNT;
+			directions[i] = glm::vec2(cos(angle), sin(angle));
+		}
+
+		// Create a vertex array object
+		glGenVertexArrays(1, &vertexArrayID);
+		glBindVertexArray(vertexArrayID);
 
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
-		glVertexAttribDivisor(1, 1);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glEnableVertexAttribArray(2);
+		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+
+		// Create instance buffer
+		glGenBuffers(1, &instanceBufferID);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+		glBufferData(GL_ARRAY_BUFFER, positionAlphas.size() * sizeof(glm::vec4), positionAlphas.data(), GL_DYNAMIC_DRAW);
+		glEnableVertexAttribArray(3);
+		glVertexAttribDivisor(3, 1);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		// Create and compile our GLSL program from the shaders
 		programID = LoadShadersFromFile("../final/shader/particle.vert", "../final/shader/particle.frag");
@@ -105,180 +316,359 @@ struct ParticleSystem {
 			std::cerr << "Failed to load main shaders." << std::endl;
 		}
 
-		// Load the texture into GPU memory
-		textureID = LoadTextureTileBox("../final/assets/particle.png");
-
 		// Get a handle for GLSL variables
 		cameraMatrixID = glGetUniformLocation(programID, "cameraMVP");
 		cameraPositionID = glGetUniformLocation(programID, "cameraPos");
+		emitterScalesID = glGetUniformLocation(programID, "emitterScales");
+		particlesPerEmitterID = glGetUniformLocation(programID, "particlesPerEmitter");
+		firstParticleID = glGetUniformLocation(programID, "firstParticle");
 		textureSamplerID = glGetUniformLocation(programID, "textureSampler");
 	}
 
-	void initializeParticles(int amount) {
-		for (int i = 0; i < amount; ++i) {
-			Particle p;
-
-			// Set attributes for each particle
-			float angle = static_cast<float>(rand()) / RAND_MAX * 2.0f * glm::pi<float>();
-			float radius = static_cast<float>(rand()) / RAND_MAX * 200.0f;
-			float randomX = radius * cos(angle);
-			float randomZ = radius * sin(angle);
-			float randomStartHeight = 0.0f + static_cast<float>(rand() % 50);
-			float randomSpeed = 5.0f + static_cast<float>(rand() % 15);
-			float randomLifetime = static_cast<float>(rand() % 10);
-
-			p.position = glm::vec3(center.x + randomX, randomStartHeight, center.z + randomZ);
-			p.scale = glm::vec3(1.0f);
-			p.speed = randomSpeed;
-			p.currentTime = 0.0f;
-
-			float distanceFromCenter = glm::length(glm::vec2(randomX, randomZ));
-			float maxDistance = 200.0f;
-			p.lifetime = glm::mix(2.0f, 10.0f, 1.0f - (distanceFromCenter / maxDistance));
-			p.lifetime += randomLifetime;
-			p.alpha = 0.6f - (distanceFromCenter / maxDistance);
-			p.alpha = glm::clamp(p.alpha, 0.0f, 1.0f);
-
-			particles.push_back(p);
-
-			// Create instance transforms
-			glm::mat4 transform(1.0f);
-			transform = glm::translate(transform, p.position);
-			transform = glm::scale(transform, p.scale);
-			instanceTransforms.push_back(transform);
-			alphas.push_back(p.alpha);  // Store the computed alpha
+	int createEmitter(glm::vec3 center) {
+		if (freeEmitters.empty()) {
+			std::cerr << "Error: Particle pool has no free emitter blocks." << std::endl;
+			return -1;
+		}
+
+		// Take the lowest free block to keep the live range compact
+		std::vector<int>::iterator lowest = std::min_element(freeEmitters.begin(), freeEmitters.end());
+		int emitter = *lowest;
+		freeEmitters.erase(lowest);
+
+		emitters[emitter].center = center;
+		emitters[emitter].angle = static_cast<float>(rand()) / RAND_MAX * 2.0f * glm::pi<float>();
+		emitters[emitter].phase = static_cast<float>(rand()) / RAND_MAX;
+		emitters[emitter].active = true;
+		emitters[emitter].visible = true;
+		emitters[emitter].liveCount = particlesPerEmitter;
+		emitters[emitter].sizeScale = 1.0f;
+		emitterHighWater = std::max(emitterHighWater, emitter + 1);
+
+		// A block freed and reused in the same frame still holds the old lamp's particles, which
+		// would otherwise fly around the old centre until each one's life ran out. Shared fields
+		// are simulated around the origin rather than per block, so they have nothing to reset.
+		if (gpuSimulation && !sharedSimulation) {
+			std::vector<ParticleState> states = deadStates(particlesPerEmitter);
+			glBindBuffer(GL_ARRAY_BUFFER, stateBufferIDs[currentState]);
+			glBufferSubData(GL_ARRAY_BUFFER, emitter * particlesPerEmitter * sizeof(ParticleState), states.size() * sizeof(ParticleState), states.data());
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
+		if (!gpuSimulation) {
+			ParticleEmitter& e = emitters[emitter];
+			e.random.seed(static_cast<uint64_t>(rand()), static_cast<uint64_t>(emitter));
+			for (int i = 0; i < 8; ++i) e.driftLanes[i] = e.random.next() | 1u;
+			for (int i = 0; i < particlesPerEmitter; ++i) {
+				respawnParticle(emitter * particlesPerEmitter + i, e);
+			}
+		}
+		return emitter;
 	}
 
-	void updateInstances(const std::vector<glm::mat4>& instanceTransforms, const std::vector<float>& alphas) {
-		// Update instance buffer
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		static size_t currentBufferSize = 0;
-		size_t newSize = instanceTransforms.size() * sizeof(glm::mat4);
-		if (newSize > currentBufferSize) {
-			glBufferData(GL_ARRAY_BUFFER, newSize, nullptr, GL_DYNAMIC_DRAW);
-			currentBufferSize = newSize;
+	void destroyEmitter(int emitter) {
+		if (emitter < 0 || emitter >= MAX_EMITTERS || !emitters[emitter].active) {
+			return;
+		}
+		emitters[emitter].active = false;
+		emitters[emitter].visible = false;
+		freeEmitters.push_back(emitter);
+
+		while (emitterHighWater > 0 && !emitters[emitterHighWater - 1].active) {
+			emitterHighWater--;
 		}
-		glBufferSubData(GL_ARRAY_BUFFER, 0, newSize, instanceTransforms.data());
-
-		// Update alpha buffer
-		glBindBuffer(GL_ARRAY_BUFFER, alphaBufferID);
-		currentBufferSize = 0;
-		newSize = alphas.size() * sizeof(float);
-		if (newSize > currentBufferSize) {
-			glBufferData(GL_ARRAY_BUFFER, newSize, nullptr, GL_DYNAMIC_DRAW);
-			currentBufferSize = newSize;
+
+		if (!gpuSimulation) {
+			int first = emitter * particlesPerEmitter;
+			std::fill(positionAlphas.begin() + first, positionAlphas.begin() + first + particlesPerEmitter, glm::vec4(0.0f));
+			updateInstances(first, particlesPerEmitter);
 		}
-		glBufferSubData(GL_ARRAY_BUFFER, 0, newSize, alphas.data());
 	}
 
-	void update(float deltaTime) {
-		for (size_t i = 0; i < particles.size(); ++i) {
-			Particle& particle = particles[i];
-
-			// Update particle's lifetime
-			particle.currentTime += deltaTime;
-			if (particle.currentTime >= particle.lifetime) {
-				// Reset the particle
-				float angle = static_cast<float>(rand()) / RAND_MAX * 2.0f * glm::pi<float>();
-				float radius = static_cast<float>(rand()) / RAND_MAX * 200.0f;
-				float randomX = radius * cos(angle);
-				float randomZ = radius * sin(angle);
-				float randomStartHeight = 0.0f + static_cast<float>(rand() % 50);
-				float randomSpeed = 5.0f + static_cast<float>(rand() % 15);
-				float randomLifetime = static_cast<float>(rand() % 10);
-				particle.position = glm::vec3(center.x + randomX, randomStartHeight, center.z + randomZ);
-				particle.scale = glm::vec3(1.0f);
-				particle.speed = randomSpeed;
-				particle.currentTime = 0.0f;
-				float distanceFromCenter = glm::length(glm::vec2(randomX, randomZ));
-				float maxDistance = 200.0f;
-				particle.lifetime = glm::mix(2.0f, 10.0f, 1.0f - (distanceFromCenter / maxDistance));
-				particle.lifetime += randomLifetime;
-				particle.alpha = 0.6f - (distanceFromCenter / maxDistance);
-				particle.alpha = glm::clamp(particle.alpha, 0.0f, 1.0f);
+	void updateVisibility(const glm::mat4& cameraMatrix) {
+		// Particles rise up to ~450 units above the emitter disc
+		Frustum frustum = ExtractFrustum(cameraMatrix);
+		firstVisibleEmitter = emitterHighWater;
+		visibleEmitterEnd = 0;
+		for (int i = 0; i < emitterHighWater; ++i) {
+			glm::vec3 center = emitters[i].center + glm::vec3(0.0f, 225.0f, 0.0f);
+			emitters[i].visible = emitters[i].active && SphereInFrustum(frustum, center, 300.0f);
+			if (culling != nullptr) emitters[i].visible = emitters[i].visible && culling->isVisible(center - glm::vec3(300.0f), center + glm::vec3(300.0f));
+			if (emitters[i].visible) {
+				firstVisibleEmitter = std::min(firstVisibleEmitter, i);
+				visibleEmitterEnd = i + 1;
 			}
-			else {
-				// Move particle upward
-				particle.position.y += particle.speed * deltaTime;
+		}
+	}
 
-				// Add slight horizontal drift
-				float drift = (rand() % 2 == 0 ? 1 : -1) * 0.5f * deltaTime;
-				particle.position.x += drift;
+	void updateBudget(const glm::vec3& cameraPos) {
+		// Weight each visible emitter by its projected area, faded out with the fog
+		float weights[MAX_EMITTERS];
+		float totalWeight = 0.0f;
+		for (int i = 0; i < emitterHighWater; ++i) {
+			weights[i] = 0.0f;
+			if (!emitters[i].visible) continue;
+
+			glm::vec3 center = emitters[i].center + glm::vec3(0.0f, 225.0f, 0.0f);
+			float distance = glm::max(glm::length(center - cameraPos), emitterRadius);
+			float fog = glm::smoothstep(fogMinDistance, fogMaxDistance, distance - emitterRadius);
+			float size = emitterRadius / distance;
+			weights[i] = size * size * (1.0f - fog);
+			totalWeight += weights[i];
+		}
 
-				// Fade towards death
-				particle.alpha = 0.6f - (particle.currentTime / particle.lifetime)*0.6f;
-				particle.alpha = glm::clamp(particle.alpha, 0.0f, 1.0f);
+		// Emitters whose share exceeds their block run full and pass the surplus on
+		bool full[MAX_EMITTERS] = {};
+		float remaining = static_cast<float>(particleBudget);
+		for (int pass = 0; pass < MAX_EMITTERS; ++pass) {
+			bool changed = false;
+			for (int i = 0; i < emitterHighWater; ++i) {
+				if (full[i] || weights[i] <= 0.0f) continue;
+				if (remaining * weights[i] / totalWeight >= particlesPerEmitter) {
+					full[i] = true;
+					remaining -= particlesPerEmitter;
+					totalWeight -= weights[i];
+					changed = true;
+				}
 			}
+			if (!changed || totalWeight <= 0.0f) break;
+		}
+
+		for (int i = 0; i < emitterHighWater; ++i) {
+			int count = minimumParticles;
+			if (full[i]) count = particlesPerEmitter;
+			else if (weights[i] > 0.0f) count = static_cast<int>(remaining * weights[i] / totalWeight);
 
-			// Update instance transform
-			glm::mat4 transform(1.0f);
-			transform = glm::translate(transform, particle.position);
-			transform = glm::scale(transform, particle.scale);
-			instanceTransforms[i] = transform;
-			alphas[i] = particle.alpha; // Store the computed alpha
+			// Whole SIMD widths, as the blocks are
+			count = glm::clamp((count + 7) & ~7, minimumParticles, particlesPerEmitter);
+			emitters[i].liveCount = count;
+			emitters[i].sizeScale = glm::min(sqrt(static_cast<float>(particlesPerEmitter) / count), maxSizeScale);
 		}
+	}
 
-		// Update instance and alpha buffers
-		updateInstances(instanceTransforms, alphas);
+	void packScales(float* data) {
+		for (int i = 0; i < MAX_EMITTERS; ++i) {
+			data[i] = emitters[i].active ? emitters[i].sizeScale : 1.0f;
+		}
 	}
 
-	void render(glm::mat4 cameraMatrix, glm::vec3 cameraPos) {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glUseProgram(programID);
+	bool useSharedSimulation() const {
+		return gpuSimulation && sharedSimulation;
+	}
 
-		glBindVertexArray(vertexArrayID);
+	int simulatedParticleCount() const {
+		if (emitterHighWater == 0) return 0;
+		return (useSharedSimulation() ? sharedFields : emitterHighWater) * particlesPerEmitter;
+	}
 
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	void packEmitters(glm::vec4* data, bool visibleOnly) {
+		if (useSharedSimulation() && !visibleOnly) {
+			// The canonical fields are simulated around the origin and placed per lamp when drawn
+			for (int i = 0; i < MAX_EMITTERS; ++i) {
+				data[i] = glm::vec4(0.0f, 0.0f, 0.0f, i < sharedFields ? static_cast<float>(particlesPerEmitter) : 0.0f);
+			}
+			return;
+		}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+		// xyz = centre, w = live particles to simulate or draw (0 for none)
+		for (int i = 0; i < MAX_EMITTERS; ++i) {
+			bool enabled = visibleOnly ? emitters[i].visible : emitters[i].active;
+			data[i] = glm::vec4(emitters[i].center, enabled ? static_cast<float>(emitters[i].liveCount) : 0.0f);
+		}
+	}
 
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	void simulate(float deltaTime) {
+		int count = simulatedParticleCount();
+		if (count == 0) {
+			return;
+		}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glUniform1i(textureSamplerID, 0);
+		// Advance every particle in one transform feedback pass, reading one state buffer and writing the other
+		glm::vec4 emitterData[MAX_EMITTERS];
+		packEmitters(emitterData, false);
+
+		glUseProgram(updateProgramID);
+		glUniform1f(deltaTimeID, deltaTime);
+		glUniform4fv(updateEmittersID, MAX_EMITTERS, &emitterData[0][0]);
+		glUniform1i(updateParticlesPerEmitterID, particlesPerEmitter);
+		glUniform1f(emitterRadiusID, emitterRadius);
+
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(updateArrayIDs[currentState]);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, stateBufferIDs[1 - currentState]);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, count);
+		glEndTransformFeedback();
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		glDisable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(0);
+
+		currentState = 1 - currentState;
+	}
 
-		// Bind the instance buffer
+	void respawnParticle(int i, ParticleEmitter& emitter) {
+		// Same distribution as particle_update.vert
+		ParticleRandom& random = emitter.random;
+		const glm::vec2& direction = directions[random.next() & (DIRECTION_COUNT - 1)];
+		float radius = random.uniform() * emitterRadius;
+
+		streams.x[i] = emitter.center.x + radius * direction.x;
+		streams.y[i] = floor(random.uniform() * 50.0f);
+		streams.z[i] = emitter.center.z + radius * direction.y;
+		streams.speed[i] = 5.0f + floor(random.uniform() * 15.0f);
+		streams.lifetime[i] = glm::mix(2.0f, 10.0f, 1.0f - radius / emitterRadius) + floor(random.uniform() * 10.0f);
+		streams.age[i] = 0.0f;
+		streams.alpha[i] = 0.6f;
+	}
+
+	void updateInstances(int first, int count) {
 		glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
-		for (int i = 0; i < 4; ++i) {
-			glEnableVertexAttribArray(3 + i);
-			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-			glVertexAttribDivisor(3 + i, 1);
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(glm::vec4), count * sizeof(glm::vec4), &positionAlphas[first]);
+	}
+
+	void update(float deltaTime) {
+		if (gpuSimulation) {
+			simulate(deltaTime);
+			return;
+		}
+
+		for (int e = 0; e < emitterHighWater; ++e) {
+			if (!emitters[e].active) continue;
+
+			// Particles past the live count keep their state and are not drawn
+			int first = e * particlesPerEmitter;
+			int live = emitters[e].liveCount;
+			deadParticles.clear();
+			advanceParticles(streams, first, live, deltaTime, emitters[e].driftLanes, deadParticles);
+			for (int i : deadParticles) respawnParticle(i, emitters[e]);
+			packParticles(streams, first, live, positionAlphas.data());
+			std::fill(positionAlphas.begin() + first + live, positionAlphas.begin() + first + particlesPerEmitter, glm::vec4(0.0f));
 		}
 
-		// Bind the alpha buffer
-		glBindBuffer(GL_ARRAY_BUFFER, alphaBufferID);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
-		glVertexAttribDivisor(1, 1);
+		// Update instance buffer
+		if (emitterHighWater > 0) updateInstances(0, emitterHighWater * particlesPerEmitter);
+	}
+
+	void renderShared(const glm::mat4& cameraMatrix, const glm::vec3& cameraPos) {
+		glUseProgram(sharedProgramID);
+		glBindVertexArray(sharedArrayIDs[currentState]);
+		glBindBuffer(GL_ARRAY_BUFFER, stateBufferIDs[currentState]);
 
-		glUniformMatrix4fv(cameraMatrixID, 1, GL_FALSE, &cameraMatrix[0][0]);
-		glUniform3fv(cameraPositionID, 1, &cameraPos[0]);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glUniform1i(sharedTextureSamplerID, 0);
+
+		glUniformMatrix4fv(sharedCameraMatrixID, 1, GL_FALSE, &cameraMatrix[0][0]);
+		glUniform3fv(sharedCameraPositionID, 1, &cameraPos[0]);
+
+		// One draw per field: instances are the field's particles, quads are the lamps using it
+		for (int field = 0; field < sharedFields; ++field) {
+			glm::vec4 placements[MAX_EMITTERS];
+			glm::vec2 placementLODs[MAX_EMITTERS];
+			int placementCount = 0;
+			for (int i = field; i < emitterHighWater; i += sharedFields) {
+				if (!emitters[i].visible) continue;
+				placementLODs[placementCount] = glm::vec2(static_cast<float>(emitters[i].liveCount), emitters[i].sizeScale);
+				placements[placementCount++] = glm::vec4(emitters[i].center.x, emitters[i].center.z, emitters[i].angle, emitters[i].phase);
+			}
+			if (placementCount == 0) continue;
 
-		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0, instanceTransforms.size());
+			int firstParticle = field * particlesPerEmitter;
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleState), (void*)(firstParticle * sizeof(ParticleState)));
+			glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleState), (void*)(firstParticle * sizeof(ParticleState) + sizeof(glm::vec4)));
+			glUniform4fv(sharedPlacementsID, placementCount, &placements[0][0]);
+			glUniform2fv(sharedPlacementLODsID, placementCount, &placementLODs[0][0]);
 
-		for (int i = 0; i < 4; ++i) {
-			glDisableVertexAttribArray(3 + i);
+			glDrawElementsInstanced(GL_TRIANGLES, 6 * placementCount, GL_UNSIGNED_INT, (void*)0, particlesPerEmitter);
 		}
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-		glDisable(GL_BLEND);
+	}
+
+	void render(glm::mat4 cameraMatrix, glm::vec3 cameraPos) {
+		updateVisibility(cameraMatrix);
+		updateBudget(cameraPos);
+		if (visibleEmitterEnd <= firstVisibleEmitter) {
+			return;
+		}
+
+		// Blending is set up by the transparency pass (see transparency.cpp)
+		if (useSharedSimulation()) {
+			renderShared(cameraMatrix, cameraPos);
+			glBindVertexArray(0);
+			return;
+		}
+
+		// One draw covering the blocks from the first to the last visible emitter
+		int firstParticle = firstVisibleEmitter * particlesPerEmitter;
+		int particleCount = (visibleEmitterEnd - firstVisibleEmitter) * particlesPerEmitter;
+		float emitterScales[MAX_EMITTERS];
+		packScales(emitterScales);
+
+		if (gpuSimulation) {
+			glm::vec4 emitterData[MAX_EMITTERS];
+			packEmitters(emitterData, true);
+
+			glUseProgram(stateProgramID);
+			glBindVertexArray(stateArrayIDs[currentState]);
+
+			// Start the instance attributes at the first visible block
+			glBindBuffer(GL_ARRAY_BUFFER, stateBufferIDs[currentState]);
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleState), (void*)(firstParticle * sizeof(ParticleState)));
+			glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleState), (void*)(firstParticle * sizeof(ParticleState) + sizeof(glm::vec4)));
+
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, textureID);
+			glUniform1i(stateTextureSamplerID, 0);
+
+			glUniformMatrix4fv(stateCameraMatrixID, 1, GL_FALSE, &cameraMatrix[0][0]);
+			glUniform3fv(stateCameraPositionID, 1, &cameraPos[0]);
+			glUniform4fv(stateEmittersID, MAX_EMITTERS, &emitterData[0][0]);
+			glUniform1i(stateParticlesPerEmitterID, particlesPerEmitter);
+			glUniform1i(stateFirstParticleID, firstParticle);
+			glUniform1fv(stateEmitterScalesID, MAX_EMITTERS, emitterScales);
+		}
+		else {
+			glUseProgram(programID);
+			glBindVertexArray(vertexArrayID);
+
+			// Start the instance attributes at the first visible block
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)(firstParticle * sizeof(glm::vec4)));
+
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, textureID);
+			glUniform1i(textureSamplerID, 0);
+
+			glUniformMatrix4fv(cameraMatrixID, 1, GL_FALSE, &cameraMatrix[0][0]);
+			glUniform3fv(cameraPositionID, 1, &cameraPos[0]);
+			glUniform1fv(emitterScalesID, MAX_EMITTERS, emitterScales);
+			glUniform1i(particlesPerEmitterID, particlesPerEmitter);
+			glUniform1i(firstParticleID, firstParticle);
+		}
+
+		glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0, particleCount);
+
+		glBindVertexArray(0);
 	}
 
 	void cleanup() {
 		glDeleteBuffers(1, &vertexBufferID);
 		glDeleteBuffers(1, &indexBufferID);
-		glDeleteBuffers(1, &instanceBufferID);
-		glDeleteVertexArrays(1, &vertexArrayID);
 		glDeleteBuffers(1, &uvBufferID);
 		glDeleteTextures(1, &textureID);
+		if (gpuSimulation) {
+			glDeleteBuffers(2, stateBufferIDs);
+			glDeleteVertexArrays(2, updateArrayIDs);
+			glDeleteVertexArrays(2, stateArrayIDs);
+			glDeleteProgram(updateProgramID);
+			glDeleteProgram(stateProgramID);
+			if (sharedSimulation) {
+				glDeleteVertexArrays(2, sharedArrayIDs);
+				glDeleteBuffers(1, &sharedIndexBufferID);
+				glDeleteProgram(sharedProgramID);
+			}
+			return;
+		}
+		glDeleteBuffers(1, &instanceBufferID);
+		glDeleteVertexArrays(1, &vertexArrayID);
 		glDeleteProgram(programID);
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,134 @@
+#include <render/headers.h>
+#include <clip.cpp>
+#include <deque>
+
+// Skeleton poses in structure-of-arrays form, one entry per glTF node
+struct Pose {
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+
+	void resize(size_t nodeCount) {
+		translations.resize(nodeCount);
+		rotations.resize(nodeCount);
+		scales.resize(nodeCount);
+	}
+
+	size_t size() const {
+		return translations.size();
+	}
+
+	void copyFrom(const Pose& other) {
+		// Same sizes, so these never reallocate
+		std::copy(other.translations.begin(), other.translations.end(), translations.begin());
+		std::copy(other.rotations.begin(), other.rotations.end(), rotations.begin());
+		std::copy(other.scales.begin(), other.scales.end(), scales.begin());
+	}
+};
+
+// Set of poses allocated up front so blending never touches the heap. If more are ever live at
+// once the pool grows by one; a deque, so poses already handed out stay where they are.
+struct PosePool {
+	std::deque<Pose> poses;
+	std::vector<int> freeList;
+	size_t nodeCount = 0;
+
+	void initialize(size_t nodeCount, int capacity) {
+		this->nodeCount = nodeCount;
+		poses.clear();
+		poses.resize(capacity);
+		freeList.clear();
+		for (int i = capacity - 1; i >= 0; --i) {
+			poses[i].resize(nodeCount);
+			freeList.push_back(i);
+		}
+	}
+
+	// Always a valid index
+	int acquire() {
+		if (freeList.empty()) {
+			std::cerr << "Warning: Pose pool exhausted, growing it to " << poses.size() + 1 << " poses." << std::endl;
+			poses.emplace_back();
+			poses.back().resize(nodeCount);
+			return static_cast<int>(poses.size()) - 1;
+		}
+		int index = freeList.back();
+		freeList.pop_back();
+		return index;
+	}
+
+	void release(int index) {
+		if (index >= 0) freeList.push_back(index);
+	}
+
+	Pose& operator[](int index) {
+		return poses[index];
+	}
+};
+
+// Write the clip's tracks at the given time over a pose that already holds the rest values.
+// Nodes deeper than maxDepth are skipped (maxDepth < 0 samples everything).
+static void sampleClip(const CompressedClip& clip, float time, const std::vector<int>& nodeDepths, int maxDepth, Pose& out) {
+	for (const auto& track : clip.tracks) {
+		int node = track.targetNode;
+		if (maxDepth >= 0 && nodeDepths[node] > maxDepth) continue;
+
+		if (track.path == TRACK_TRANSLATION) out.translations[node] = clip.sampleVec3(track, time);
+		else if (track.path == TRACK_ROTATION) out.rotations[node] = clip.sampleQuat(track, time);
+		else if (track.path == TRACK_SCALE) out.scales[node] = clip.sampleVec3(track, time);
+	}
+}
+
+// out = mix(a, b, weight); out may alias a or b
+static void blendPoses(const Pose& a, const Pose& b, float weight, Pose& out) {
+	size_t n = out.size();
+	const glm::vec3* ta = a.translations.data(); const glm::vec3* tb = b.translations.data();
+	const glm::vec3* sa = a.scales.data(); const glm::vec3* sb = b.scales.data();
+	const glm::quat* ra = a.rotations.data(); const glm::quat* rb = b.rotations.data();
+	glm::vec3* to = out.translations.data();
+	glm::vec3* so = out.scales.data();
+	glm::quat* ro = out.rotations.data();
+
+	for (size_t i = 0; i < n; ++i) to[i] = ta[i] + (tb[i] - ta[i]) * weight;
+	for (size_t i = 0; i < n; ++i) so[i] = sa[i] + (sb[i] - sa[i]) * weight;
+	for (size_t i = 0; i < n; ++i) {
+		// Normalised lerp along the shorter arc
+		float w = glm::dot(ra[i], rb[i]) < 0.0f ? -weight : weight;
+		glm::quat q(ra[i].w * (1.0f - weight) + rb[i].w * w, ra[i].x * (1.0f - weight) + rb[i].x * w,
+			ra[i].y * (1.0f - weight) + rb[i].y * w, ra[i].z * (1.0f - weight) + rb[i].z * w);
+		ro[i] = glm::normalize(q);
+	}
+}
+
+// out = base + weight * (additive - reference); out may alias base
+static void addPose(const Pose& base, const Pose& additive, const Pose& reference, float weight, Pose& out) {
+	size_t n = out.size();
+	for (size_t i = 0; i < n; ++i) {
+		out.translations[i] = base.translations[i] + (additive.translations[i] - reference.translations[i]) * weight;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		out.scales[i] = base.scales[i] * glm::mix(glm::vec3(1.0f), additive.scales[i] / reference.scales[i], weight);
+	}
+	for (size_t i = 0; i < n; ++i) {
+		glm::quat delta = additive.rotations[i] * glm::inverse(reference.rotations[i]);
+		if (delta.w < 0.0f) delta = -delta;
+		glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+		glm::quat scaled = glm::normalize(glm::quat(
+			glm::mix(identity.w, delta.w, weight), glm::mix(identity.x, delta.x, weight),
+			glm::mix(identity.y, delta.y, weight), glm::mix(identity.z, delta.z, weight)));
+		out.rotations[i] = glm::normalize(scaled * base.rotations[i]);
+	}
+}
+
+// Local transform matrices (T * R * S) for every node in the pose
+static void poseToMatrices(const Pose& pose, std::vector<glm::mat4>& localTransforms) {
+	size_t n = pose.size();
+	for (size_t i = 0; i < n; ++i) {
+		glm::mat4 m = glm::mat4_cast(pose.rotations[i]);
+		m[0] *= pose.scales[i].x;
+		m[1] *= pose.scales[i].y;
+		m[2] *= pose.scales[i].z;
+		m[3] = glm::vec4(pose.translations[i], 1.0f);
+		localTransforms[i] = m;
+	}
+}
@@ -0,0 +1,223 @@
+#include "assets.h"
+
+// Parse a glTF file, with its images, reporting like the models did when they loaded inline
+static bool parseModel(const std::string& path, tinygltf::Model& model, std::string& err, std::string& warn) {
+	tinygltf::TinyGLTF loader;
+	return loader.LoadASCIIFromFile(&model, &err, &warn, path);
+}
+
+static bool reportModel(const std::string& path, bool loaded, const std::string& err, const std::string& warn) {
+	if (!warn.empty()) {
+		std::cout << "WARN: " << warn << std::endl;
+	}
+	if (!err.empty()) {
+		std::cout << "ERR: " << err << std::endl;
+	}
+	if (!loaded) {
+		std::cout << "Failed to load glTF: " << path << std::endl;
+	}
+	else {
+		std::cout << "Loaded glTF: " << path << std::endl;
+	}
+	return loaded;
+}
+
+// Something valid to sample while the real image decodes
+static GLuint createPlaceholder(GLenum target) {
+	const uint8_t grey[3] = { 64, 64, 64 };
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(target, texture);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (target == GL_TEXTURE_2D_ARRAY) {
+		glTexImage3D(target, 0, GL_RGB, 1, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+	}
+	else {
+		glTexImage2D(target, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(target, 0);
+	return texture;
+}
+
+void AssetLoader::initialize(unsigned int threadCount) {
+	if (threadCount == 0) {
+		unsigned int hardware = std::thread::hardware_concurrency();
+		threadCount = hardware > 1 ? hardware - 1 : 1;
+	}
+	stopping = false;
+	for (unsigned int i = 0; i < threadCount; ++i) {
+		workers.emplace_back(&AssetLoader::worker, this);
+	}
+}
+
+void AssetLoader::worker() {
+	while (true) {
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !decodes.empty(); });
+			if (stopping) return;
+			task = decodes.top();
+			decodes.pop();
+		}
+		task.run();
+	}
+}
+
+void AssetLoader::enqueue(int priority, std::function<void()> decode) {
+	if (workers.empty()) {
+		decode();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		decodes.push({ priority, sequence++, decode });
+	}
+	wake.notify_one();
+}
+
+void AssetLoader::queueUpload(int priority, std::function<void()> upload) {
+	outstanding++;
+	std::lock_guard<std::mutex> lock(uploadMutex);
+	uploads.push({ priority, sequence++, upload });
+	uploadReady.notify_one();
+}
+
+void AssetLoader::prefetchModel(const std::string& path, int priority) {
+	if (models.count(path) > 0) {
+		return;
+	}
+	std::shared_ptr<ModelAsset> asset = std::make_shared<ModelAsset>();
+	std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+	asset->loaded = promise->get_future();
+	models[path] = asset;
+
+	// The asset is only read back after the future is ready
+	ModelAsset* target = asset.get();
+	enqueue(priority, [path, target, promise]() {
+		promise->set_value(parseModel(path, target->model, target->err, target->warn));
+	});
+}
+
+bool AssetLoader::takeModel(const std::string& path, tinygltf::Model& model) {
+	auto found = models.find(path);
+	if (found == models.end()) {
+		std::string err, warn;
+		bool loaded = parseModel(path, model, err, warn);
+		return reportModel(path, loaded, err, warn);
+	}
+
+	std::shared_ptr<ModelAsset> asset = found->second;
+	models.erase(found);
+	bool loaded = asset->loaded.get();
+	model = std::move(asset->model);
+	return reportModel(path, loaded, asset->err, asset->warn);
+}
+
+bool AssetLoader::queueCookedTexture(GLuint texture, GLenum target, const std::string& sourcePath, const char* suffix, uint32_t layers, int priority) {
+	std::shared_ptr<MappedPackage> package = std::make_shared<MappedPackage>();
+	if (!package->open(sourcePath, suffix)) {
+		return false;
+	}
+	size_t count = 0;
+	const PackageTexture* cooked = package->section<PackageTexture>(SECTION_TEXTURES, count);
+	const uint8_t* pixels = count > 0 ? package->texturePixels(*cooked) : nullptr;
+	if (pixels == nullptr || cooked->layers != layers) {
+		std::cerr << "Cooked package holds no matching texture: " << CookedPackagePath(sourcePath, suffix) << std::endl;
+		return false;
+	}
+
+	// The upload keeps the package mapped until it has run
+	queueUpload(priority, [texture, target, package, cooked, pixels]() {
+		UploadCookedTexture(texture, target, *cooked, pixels);
+	});
+	return true;
+}
+
+GLuint AssetLoader::loadTexture(const char* path, int priority) {
+	GLuint texture = createPlaceholder(GL_TEXTURE_2D);
+	if (queueCookedTexture(texture, GL_TEXTURE_2D, path, "", 1, priority)) {
+		return texture;
+	}
+	std::string file = path;
+	outstanding++;
+	enqueue(priority, [this, texture, file, priority]() {
+		std::shared_ptr<ImageData> image = std::make_shared<ImageData>();
+		DecodeImage(file.c_str(), 3, *image);
+		std::lock_guard<std::mutex> lock(uploadMutex);
+		uploads.push({ priority, sequence++, [texture, image]() { UploadTextureTileBox(texture, *image); } });
+		uploadReady.notify_one();
+	});
+	return texture;
+}
+
+GLuint AssetLoader::loadTextureArray(const std::vector<const char*>& paths, int priority) {
+	GLuint texture = createPlaceholder(GL_TEXTURE_2D_ARRAY);
+	if (!paths.empty() && queueCookedTexture(texture, GL_TEXTURE_2D_ARRAY, paths[0], ".array", paths.size(), priority)) {
+		return texture;
+	}
+	std::vector<std::string> files(paths.begin(), paths.end());
+	outstanding++;
+	enqueue(priority, [this, texture, files, priority]() {
+		std::vector<const char*> filePaths;
+		for (const auto& file : files) filePaths.push_back(file.c_str());
+		std::shared_ptr<ImageData> layers = std::make_shared<ImageData>(DecodeTextureArray(filePaths));
+		std::lock_guard<std::mutex> lock(uploadMutex);
+		uploads.push({ priority, sequence++, [texture, layers]() { UploadTextureArray(texture, *layers); } });
+		uploadReady.notify_one();
+	});
+	return texture;
+}
+
+void AssetLoader::pumpUploads(double budgetSeconds) {
+	double start = glfwGetTime();
+	do {
+		Task task;
+		{
+			std::lock_guard<std::mutex> lock(uploadMutex);
+			if (uploads.empty()) return;
+			task = uploads.top();
+			uploads.pop();
+		}
+		task.run();
+		outstanding--;
+	} while (glfwGetTime() - start < budgetSeconds);
+}
+
+void AssetLoader::finish() {
+	while (outstanding > 0) {
+		{
+			std::unique_lock<std::mutex> lock(uploadMutex);
+			uploadReady.wait(lock, [this]() { return !uploads.empty(); });
+		}
+		pumpUploads(1e9);
+	}
+}
+
+void AssetLoader::cleanup() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		decodes = std::priority_queue<Task>();
+	}
+	wake.notify_all();
+	for (auto& thread : workers) {
+		thread.join();
+	}
+	workers.clear();
+
+	// Prefetches nobody took; those still queued were dropped above
+	models.clear();
+
+	std::lock_guard<std::mutex> lock(uploadMutex);
+	uploads = std::priority_queue<Task>();
+	outstanding = 0;
+}
+
+AssetLoader& Assets() {
+	static AssetLoader loader;
+	return loader;
+}
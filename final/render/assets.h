@@ -0,0 +1,104 @@
+#ifndef _ASSETS_H_
+#define _ASSETS_H_
+
+#include "headers.h"
+#include "texture.h"
+#include "package.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+// Higher runs first, both when decoding and when uploading
+enum AssetPriority {
+	PRIORITY_LOW = 0,		// Backdrop and effects: sky, particles
+	PRIORITY_NORMAL = 1,	// Props
+	PRIORITY_HIGH = 2		// What fills most of the first frame: ground and buildings
+};
+
+// Startup loading on a pool of worker threads. glTF parsing (including tinygltf's image decode)
+// and stb decodes of standalone textures run on the workers; every GL call stays on the main
+// thread, which drains the finished uploads highest priority first through pumpUploads().
+//
+// Assets with a cooked package (see package.h) skip the workers: the package is mapped and its
+// mip chain uploaded straight from the mapping, which is released once the upload has run.
+//
+// Textures are created straight away with a 1x1 placeholder, so objects can keep their IDs and
+// the first frames render while larger images are still decoding. Models are needed for layout
+// and bounds, so takeModel() waits for its parse; prefetchModel() starts that parse early.
+//
+// Before initialize there are no workers, and decodes run inline on the calling thread.
+struct AssetLoader {
+	struct Task {
+		int priority;
+		unsigned long long sequence;	// Earlier requests first within a priority
+		std::function<void()> run;
+
+		bool operator<(const Task& other) const {
+			return priority != other.priority ? priority < other.priority : sequence > other.sequence;
+		}
+	};
+
+	struct ModelAsset {
+		tinygltf::Model model;
+		std::string err, warn;
+		std::future<bool> loaded;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::priority_queue<Task> decodes;
+	bool stopping = false;
+
+	std::mutex uploadMutex;
+	std::priority_queue<Task> uploads;
+	std::condition_variable uploadReady;
+
+	std::atomic<unsigned long long> sequence{ 0 };	// Shared by both queues
+	int outstanding = 0;	// Requests not yet uploaded; main thread only
+
+	std::unordered_map<std::string, std::shared_ptr<ModelAsset>> models;
+
+	// 0 threads uses one fewer than the hardware has
+	void initialize(unsigned int threadCount = 0);
+
+	// Start parsing a glTF now; takeModel() with the same path collects it
+	void prefetchModel(const std::string& path, int priority = PRIORITY_NORMAL);
+
+	// The parsed model, waiting for a prefetch if there is one and parsing inline otherwise
+	bool takeModel(const std::string& path, tinygltf::Model& model);
+
+	// Repeat-wrapped, mipmapped textures filled in once decoded. An array's package is named after
+	// its first layer, e.g. assets/facade0.png.array.pkg
+	GLuint loadTexture(const char* path, int priority = PRIORITY_NORMAL);
+	GLuint loadTextureArray(const std::vector<const char*>& paths, int priority = PRIORITY_NORMAL);
+
+	// Queue the upload of a texture's cooked package if it has an up-to-date one with that many layers
+	bool queueCookedTexture(GLuint texture, GLenum target, const std::string& sourcePath, const char* suffix, uint32_t layers, int priority);
+
+	// Queue GL work for the main thread, e.g. uploading pixels a parsed model already holds
+	void queueUpload(int priority, std::function<void()> upload);
+
+	// Run finished uploads, highest priority first, until the budget is spent (at least one runs)
+	void pumpUploads(double budgetSeconds);
+
+	// Block until every request so far is decoded and uploaded
+	void finish();
+
+	int pending() const { return outstanding; }
+
+	void cleanup();
+
+	void worker();
+	void enqueue(int priority, std::function<void()> decode);
+};
+
+AssetLoader& Assets();
+
+#endif
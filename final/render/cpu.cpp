@@ -0,0 +1,29 @@
+#include "cpu.h"
+#if defined(CPU_AVX2_DISPATCH) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static bool detectAVX2() {
+#if !defined(CPU_AVX2_DISPATCH)
+	return false;
+#elif defined(_MSC_VER)
+	// AVX needs the OS to save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+	// Also checks that the OS saves the YMM registers
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+bool HasAVX2() {
+	static const bool supported = detectAVX2();
+	return supported;
+}
@@ -0,0 +1,20 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+// Runtime selection of the SIMD paths. The game is built for the baseline instruction set;
+// functions marked CPU_AVX2_TARGET are compiled for AVX2 on their own and must only be called
+// once HasAVX2() has said so. CPU_AVX2_DISPATCH is defined where the compiler can do that.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_AVX2_TARGET __attribute__((target("avx2")))
+#define CPU_AVX2_DISPATCH
+#elif defined(_MSC_VER)
+#define CPU_AVX2_TARGET
+#define CPU_AVX2_DISPATCH
+#endif
+#endif
+
+// Whether the processor and OS support AVX2; checked once
+bool HasAVX2();
+
+#endif
@@ -0,0 +1,76 @@
+#include "framebuffer.h"
+
+GLuint CreateTargetTexture(int width, int height, GLenum internalFormat) {
+	GLenum format = GL_RGBA;
+	GLenum type = GL_UNSIGNED_BYTE;
+	if (internalFormat == GL_DEPTH_COMPONENT24) {
+		format = GL_DEPTH_COMPONENT;
+		type = GL_FLOAT;
+	}
+	else if (internalFormat == GL_R8 || internalFormat == GL_R16F) {
+		format = GL_RED;
+	}
+	if (internalFormat == GL_RGBA16F || internalFormat == GL_R16F) {
+		type = GL_FLOAT;
+	}
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+RenderTarget CreateRenderTarget(int width, int height, const std::vector<GLenum>& colorFormats, bool withDepth, GLuint sharedDepth) {
+	RenderTarget target;
+	target.width = width;
+	target.height = height;
+
+	glGenFramebuffers(1, &target.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+
+	std::vector<GLenum> drawBuffers;
+	for (size_t i = 0; i < colorFormats.size(); ++i) {
+		GLuint texture = CreateTargetTexture(width, height, colorFormats[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, texture, 0);
+		target.colorTextures.push_back(texture);
+		drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+	}
+	if (drawBuffers.empty()) {
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	else {
+		glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+	}
+
+	if (sharedDepth != 0) {
+		target.depthTexture = sharedDepth;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, sharedDepth, 0);
+	}
+	else if (withDepth) {
+		target.depthTexture = CreateTargetTexture(width, height, GL_DEPTH_COMPONENT24);
+		target.ownsDepth = true;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target.depthTexture, 0);
+	}
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "Error: Render target is not complete! Status: " << status << std::endl;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return target;
+}
+
+void DestroyRenderTarget(RenderTarget& target) {
+	if (!target.colorTextures.empty()) glDeleteTextures(target.colorTextures.size(), target.colorTextures.data());
+	if (target.ownsDepth) glDeleteTextures(1, &target.depthTexture);
+	if (target.framebuffer != 0) glDeleteFramebuffers(1, &target.framebuffer);
+	target = RenderTarget();
+}
@@ -0,0 +1,24 @@
+#ifndef _FRAMEBUFFER_H_
+#define _FRAMEBUFFER_H_
+
+#include "headers.h"
+
+// Offscreen framebuffer with any number of colour textures and a sampleable depth texture
+struct RenderTarget {
+	GLuint framebuffer = 0;
+	std::vector<GLuint> colorTextures;
+	GLuint depthTexture = 0;
+	bool ownsDepth = false;
+	int width = 0;
+	int height = 0;
+};
+
+// Nearest-filtered, edge-clamped texture for a render target attachment
+GLuint CreateTargetTexture(int width, int height, GLenum internalFormat);
+
+// A non-zero sharedDepth attaches another target's depth texture instead of creating one
+RenderTarget CreateRenderTarget(int width, int height, const std::vector<GLenum>& colorFormats, bool withDepth, GLuint sharedDepth = 0);
+
+void DestroyRenderTarget(RenderTarget& target);
+
+#endif
@@ -0,0 +1,59 @@
+#include "frustum.h"
+
+// Gribb/Hartmann plane extraction from a combined view-projection matrix
+Frustum ExtractFrustum(const glm::mat4& m) {
+	Frustum frustum;
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	frustum.planes[0] = row3 + row0;	// Left
+	frustum.planes[1] = row3 - row0;	// Right
+	frustum.planes[2] = row3 + row1;	// Bottom
+	frustum.planes[3] = row3 - row1;	// Top
+	frustum.planes[4] = row3 + row2;	// Near
+	frustum.planes[5] = row3 - row2;	// Far
+
+	for (int i = 0; i < 6; ++i) {
+		frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+	}
+	return frustum;
+}
+
+bool SphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius) {
+	for (int i = 0; i < 6; ++i) {
+		if (glm::dot(glm::vec3(frustum.planes[i]), center) + frustum.planes[i].w < -radius) return false;
+	}
+	return true;
+}
+
+bool BoxInFrustum(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+	for (int i = 0; i < 6; ++i) {
+		// Test the corner furthest along the plane normal
+		glm::vec3 n(frustum.planes[i]);
+		glm::vec3 p(n.x >= 0.0f ? boxMax.x : boxMin.x,
+			n.y >= 0.0f ? boxMax.y : boxMin.y,
+			n.z >= 0.0f ? boxMax.z : boxMin.z);
+		if (glm::dot(n, p) + frustum.planes[i].w < 0.0f) return false;
+	}
+	return true;
+}
+
+bool BoxInSphere(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& center, float radius) {
+	// Distance from the centre to the nearest point of the box
+	glm::vec3 offset = glm::clamp(center, boxMin, boxMax) - center;
+	return glm::dot(offset, offset) <= radius * radius;
+}
+
+void TransformBox(const glm::mat4& transform, const glm::vec3& localMin, const glm::vec3& localMax, glm::vec3& worldMin, glm::vec3& worldMax) {
+	// Arvo: the transformed extent along each axis is the absolute matrix times the local extent
+	glm::vec3 center = glm::vec3(transform * glm::vec4(0.5f * (localMin + localMax), 1.0f));
+	glm::vec3 extent = 0.5f * (localMax - localMin);
+	glm::vec3 worldExtent(0.0f);
+	for (int column = 0; column < 3; ++column) {
+		worldExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+	}
+	worldMin = center - worldExtent;
+	worldMax = center + worldExtent;
+}
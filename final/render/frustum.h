@@ -0,0 +1,22 @@
+#ifndef _FRUSTUM_H_
+#define _FRUSTUM_H_
+
+#include "headers.h"
+
+// View frustum as six inward-facing planes (xyz = normal, w = distance)
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+bool SphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius);
+
+bool BoxInFrustum(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+bool BoxInSphere(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& center, float radius);
+
+// World-space box around a local box under a transform
+void TransformBox(const glm::mat4& transform, const glm::vec3& localMin, const glm::vec3& localMax, glm::vec3& worldMin, glm::vec3& worldMax);
+
+#endif
@@ -0,0 +1,96 @@
+#include "geometry.h"
+
+MeshRange GeometryArena::addMesh(const StaticVertex* meshVertices, size_t vertexCount, const GLuint* meshIndices, size_t indexCount) {
+	if (uploaded) {
+		std::cerr << "Error: Static mesh added after the geometry arena was uploaded; it will not be drawn." << std::endl;
+		return MeshRange();
+	}
+
+	MeshRange mesh;
+	mesh.firstIndex = indices.size();
+	mesh.indexCount = indexCount;
+	mesh.baseVertex = vertices.size();
+	vertices.insert(vertices.end(), meshVertices, meshVertices + vertexCount);
+	indices.insert(indices.end(), meshIndices, meshIndices + indexCount);
+	return mesh;
+}
+
+void GeometryArena::upload() {
+	if (uploaded) return;
+	uploaded = true;
+
+	glGenVertexArrays(1, &vertexArrayID);
+	glGenBuffers(1, &vertexBufferID);
+	glGenBuffers(1, &indexBufferID);
+
+	glBindVertexArray(vertexArrayID);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(StaticVertex), vertices.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(StaticVertex), (void*)offsetof(StaticVertex, uv));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+	for (int i = 0; i < 5; ++i) {
+		glVertexAttribDivisor(3 + i, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The GPU has its own copy now
+	std::vector<StaticVertex>().swap(vertices);
+	std::vector<GLuint>().swap(indices);
+}
+
+void GeometryArena::bind() {
+	glBindVertexArray(vertexArrayID);
+}
+
+void GeometryArena::bindInstances(GLuint instanceBuffer, GLsizei stride, bool withMaterial, GLint firstInstance) {
+	if (instanceBuffer == boundInstanceBuffer && stride == boundInstanceStride && withMaterial == boundInstanceMaterial
+		&& firstInstance == boundFirstInstance) {
+		return;
+	}
+
+	size_t base = static_cast<size_t>(firstInstance) * stride;
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (int i = 0; i < 4; ++i) {
+		glEnableVertexAttribArray(3 + i);
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, stride, (void*)(base + i * sizeof(glm::vec4)));
+	}
+	if (withMaterial) {
+		glEnableVertexAttribArray(7);
+		glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, stride, (void*)(base + sizeof(glm::mat4)));
+	}
+	else {
+		// Shaders read the current value of a disabled attribute
+		glDisableVertexAttribArray(7);
+		glVertexAttrib4f(7, 0.0f, 0.0f, 0.0f, 0.0f);
+	}
+
+	boundInstanceBuffer = instanceBuffer;
+	boundInstanceStride = stride;
+	boundInstanceMaterial = withMaterial;
+	boundFirstInstance = firstInstance;
+}
+
+void GeometryArena::draw(const MeshRange& mesh, GLsizei instanceCount) {
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+		(void*)(mesh.firstIndex * sizeof(GLuint)), instanceCount, mesh.baseVertex);
+}
+
+void GeometryArena::cleanup() {
+	glDeleteBuffers(1, &vertexBufferID);
+	glDeleteBuffers(1, &indexBufferID);
+	glDeleteVertexArrays(1, &vertexArrayID);
+	*this = GeometryArena();
+}
+
+GeometryArena& StaticGeometry() {
+	static GeometryArena arena;
+	return arena;
+}
@@ -0,0 +1,58 @@
+#ifndef _GEOMETRY_H_
+#define _GEOMETRY_H_
+
+#include "headers.h"
+#include <cstddef>
+
+// Interleaved vertex shared by every static mesh (the skybox stores its colour in normal)
+struct StaticVertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+// Where a mesh lives in the arena
+struct MeshRange {
+	GLuint firstIndex = 0;
+	GLsizei indexCount = 0;
+	GLint baseVertex = 0;
+};
+
+// All static meshes in one vertex buffer and one index buffer behind a single VAO for the
+// StaticVertex format (locations 0-2). Instance attributes (mat4 at 3-6, optional vec4 at 7)
+// are re-pointed only when a draw uses a different instance buffer or first instance.
+struct GeometryArena {
+	GLuint vertexArrayID = 0;
+	GLuint vertexBufferID = 0;
+	GLuint indexBufferID = 0;
+
+	// Meshes added so far, empty after upload()
+	std::vector<StaticVertex> vertices;
+	std::vector<GLuint> indices;
+	bool uploaded = false;
+
+	GLuint boundInstanceBuffer = 0;
+	GLsizei boundInstanceStride = 0;
+	bool boundInstanceMaterial = false;
+	GLint boundFirstInstance = 0;
+
+	// Load time only: appends the mesh to the CPU-side copy; nothing reaches the GPU until upload()
+	MeshRange addMesh(const StaticVertex* meshVertices, size_t vertexCount, const GLuint* meshIndices, size_t indexCount);
+
+	// Once every static mesh has been added: creates both buffers and frees the CPU-side copy.
+	// Later calls do nothing, and later meshes are refused (an empty range draws nothing).
+	void upload();
+
+	void bind();
+
+	// GL 3.3 has no base instance, so draws starting part way into a buffer offset the pointers
+	void bindInstances(GLuint instanceBuffer, GLsizei stride, bool withMaterial, GLint firstInstance = 0);
+
+	void draw(const MeshRange& mesh, GLsizei instanceCount);
+
+	void cleanup();
+};
+
+GeometryArena& StaticGeometry();
+
+#endif
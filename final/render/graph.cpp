@@ -0,0 +1,235 @@
+#include "graph.h"
+#include "framebuffer.h"
+
+void RenderGraph::begin(int width, int height) {
+	if (width != frameWidth || height != frameHeight) {
+		cleanup();
+		frameWidth = width;
+		frameHeight = height;
+	}
+	resources.clear();
+	passes.clear();
+}
+
+int RenderGraph::createTexture(const char* name, GraphTextureDesc desc) {
+	Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	resources.push_back(resource);
+	return resources.size() - 1;
+}
+
+int RenderGraph::importTexture(const char* name, GLuint texture) {
+	Resource resource;
+	resource.name = name;
+	resource.imported = true;
+	resource.texture = texture;
+	resources.push_back(resource);
+	return resources.size() - 1;
+}
+
+int RenderGraph::importBackbuffer() {
+	return importTexture("backbuffer", 0);
+}
+
+GraphPass& RenderGraph::addPass(const char* name, std::function<void()> execute) {
+	passes.emplace_back();
+	GraphPass& pass = passes.back();
+	pass.name = name;
+	pass.execute = execute;
+	return pass;
+}
+
+void RenderGraph::compile() {
+	// Walk backwards: a pass lives if it has side effects, writes an imported resource, or
+	// writes something a later live pass needs
+	std::vector<bool> needed(resources.size(), false);
+	for (int i = passes.size() - 1; i >= 0; --i) {
+		GraphPass& pass = passes[i];
+		std::vector<const GraphAttachment*> writes;
+		for (const auto& color : pass.colors) writes.push_back(&color);
+		if (pass.depth.resource >= 0 && pass.depthWrite) writes.push_back(&pass.depth);
+
+		pass.live = pass.sideEffect;
+		for (const auto* attachment : writes) {
+			if (needed[attachment->resource] || resources[attachment->resource].imported) pass.live = true;
+		}
+		for (int resource : pass.externalWrites) {
+			if (needed[resource] || resources[resource].imported) pass.live = true;
+		}
+		if (!pass.live) continue;
+
+		// Only loaded attachments depend on what earlier passes wrote
+		for (const auto* attachment : writes) {
+			needed[attachment->resource] = attachment->load == LoadOp::Load;
+		}
+		for (int resource : pass.externalWrites) {
+			needed[resource] = false;
+		}
+		for (int resource : pass.reads) {
+			needed[resource] = true;
+		}
+		if (pass.depth.resource >= 0 && !pass.depthWrite) {
+			needed[pass.depth.resource] = true;
+		}
+	}
+
+	// Lifetimes of everything the live passes touch
+	for (auto& resource : resources) {
+		resource.firstPass = resource.lastPass = -1;
+		if (!resource.imported) resource.texture = 0;
+	}
+	livePasses = culledPasses = 0;
+	for (size_t i = 0; i < passes.size(); ++i) {
+		GraphPass& pass = passes[i];
+		if (!pass.live) {
+			culledPasses++;
+			continue;
+		}
+		livePasses++;
+
+		std::vector<int> used = pass.reads;
+		used.insert(used.end(), pass.externalWrites.begin(), pass.externalWrites.end());
+		for (const auto& color : pass.colors) used.push_back(color.resource);
+		if (pass.depth.resource >= 0) used.push_back(pass.depth.resource);
+		for (int resource : used) {
+			Resource& r = resources[resource];
+			if (r.firstPass < 0) r.firstPass = i;
+			r.lastPass = i;
+		}
+
+		// Passes draw at the size of their first attachment
+		pass.width = frameWidth;
+		pass.height = frameHeight;
+		int sized = !pass.colors.empty() ? pass.colors[0].resource : pass.depth.resource;
+		if (sized >= 0 && !resources[sized].imported) {
+			pass.width = std::max(1, frameWidth / resources[sized].desc.divisor);
+			pass.height = std::max(1, frameHeight / resources[sized].desc.divisor);
+		}
+	}
+
+	// Transient textures take any pooled texture of the same format and size that is free by
+	// the time they are first written
+	for (auto& pooled : pool) pooled.busyUntil = -1;
+	for (size_t i = 0; i < passes.size(); ++i) {
+		for (auto& resource : resources) {
+			if (resource.imported || resource.firstPass != static_cast<int>(i)) continue;
+
+			int width = std::max(1, frameWidth / resource.desc.divisor);
+			int height = std::max(1, frameHeight / resource.desc.divisor);
+			PooledTexture* match = nullptr;
+			for (auto& pooled : pool) {
+				if (pooled.format == resource.desc.format && pooled.width == width && pooled.height == height && pooled.busyUntil < static_cast<int>(i)) {
+					match = &pooled;
+					break;
+				}
+			}
+			if (match == nullptr) {
+				pool.push_back({ resource.desc.format, width, height, CreateTargetTexture(width, height, resource.desc.format), -1 });
+				match = &pool.back();
+			}
+			match->busyUntil = resource.lastPass;
+			resource.texture = match->texture;
+		}
+	}
+	pooledTextures = pool.size();
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void RenderGraph::execute() {
+	GLuint boundFramebuffer = ~0u;
+	int viewportWidth = -1, viewportHeight = -1;
+
+	for (auto& pass : passes) {
+		if (!pass.live) continue;
+
+		// Passes with no graph attachments bind whatever they need themselves
+		if (pass.colors.empty() && pass.depth.resource < 0) {
+			pass.execute();
+			boundFramebuffer = ~0u;
+			viewportWidth = viewportHeight = -1;
+			continue;
+		}
+
+		std::vector<int> colors;
+		bool backbuffer = false;
+		for (const auto& color : pass.colors) {
+			colors.push_back(color.resource);
+			if (resources[color.resource].imported && resources[color.resource].texture == 0) backbuffer = true;
+		}
+		GLuint target = backbuffer ? 0 : framebuffer(colors, pass.depth.resource);
+		if (target != boundFramebuffer) {
+			glBindFramebuffer(GL_FRAMEBUFFER, target);
+			boundFramebuffer = target;
+		}
+		if (pass.width != viewportWidth || pass.height != viewportHeight) {
+			glViewport(0, 0, pass.width, pass.height);
+			viewportWidth = pass.width;
+			viewportHeight = pass.height;
+		}
+
+		for (size_t i = 0; i < pass.colors.size(); ++i) {
+			if (pass.colors[i].load == LoadOp::Clear) glClearBufferfv(GL_COLOR, i, &pass.colors[i].clearValue[0]);
+		}
+		if (pass.depth.resource >= 0 && pass.depth.load == LoadOp::Clear) {
+			glDepthMask(GL_TRUE);
+			glClearBufferfv(GL_DEPTH, 0, &pass.depth.clearValue[0]);
+		}
+
+		pass.execute();
+	}
+}
+
+GLuint RenderGraph::texture(int resource) const {
+	return resources[resource].texture;
+}
+
+GLuint RenderGraph::framebuffer(const std::vector<int>& colors, int depth) {
+	std::vector<GLuint> key;
+	for (int resource : colors) key.push_back(resources[resource].texture);
+	key.push_back(depth >= 0 ? resources[depth].texture : 0);
+
+	auto found = framebuffers.find(key);
+	if (found != framebuffers.end()) {
+		return found->second;
+	}
+
+	// Created on first use, so keep whatever the caller has bound
+	GLint previous;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	std::vector<GLenum> drawBuffers;
+	for (size_t i = 0; i < colors.size(); ++i) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, key[i], 0);
+		drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+	}
+	if (drawBuffers.empty()) {
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	else {
+		glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+	}
+	if (depth >= 0) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, key.back(), 0);
+	}
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "Error: Render graph framebuffer is not complete! Status: " << status << std::endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+	framebuffers[key] = fbo;
+	return fbo;
+}
+
+void RenderGraph::cleanup() {
+	for (auto& entry : framebuffers) glDeleteFramebuffers(1, &entry.second);
+	for (auto& pooled : pool) glDeleteTextures(1, &pooled.texture);
+	framebuffers.clear();
+	pool.clear();
+}
@@ -0,0 +1,122 @@
+#ifndef _GRAPH_H_
+#define _GRAPH_H_
+
+#include "headers.h"
+#include <deque>
+#include <functional>
+#include <map>
+
+// What happens to an attachment's previous contents when a pass starts writing it
+enum class LoadOp {
+	Load,		// Keep (the previous writer is a dependency)
+	Clear,		// Clear to the attachment's value
+	DontCare	// Every pixel will be overwritten
+};
+
+// A graph texture, sized relative to the frame (divisor 2 = half resolution)
+struct GraphTextureDesc {
+	GLenum format;
+	int divisor = 1;
+};
+
+struct GraphAttachment {
+	int resource = -1;
+	LoadOp load = LoadOp::Load;
+	glm::vec4 clearValue = glm::vec4(0.0f);
+};
+
+struct GraphPass {
+	std::string name;
+	std::vector<int> reads;
+	std::vector<GraphAttachment> colors;
+	GraphAttachment depth;
+	bool depthWrite = true;
+	std::vector<int> externalWrites;	// Written through the pass's own framebuffers
+	bool sideEffect = false;			// Never culled
+	std::function<void()> execute;
+
+	// Filled in by compile
+	bool live = false;
+	int width = 0, height = 0;
+
+	GraphPass& read(int resource) {
+		reads.push_back(resource);
+		return *this;
+	}
+	GraphPass& color(int resource, LoadOp load, glm::vec4 clearValue = glm::vec4(0.0f)) {
+		colors.push_back({ resource, load, clearValue });
+		return *this;
+	}
+	GraphPass& depthStencil(int resource, LoadOp load, float clearDepth = 1.0f) {
+		depth = { resource, load, glm::vec4(clearDepth) };
+		depthWrite = true;
+		return *this;
+	}
+	// Depth attached for testing only; counts as a read
+	GraphPass& depthTest(int resource) {
+		depth = { resource, LoadOp::Load, glm::vec4(1.0f) };
+		depthWrite = false;
+		return *this;
+	}
+	GraphPass& write(int resource) {
+		externalWrites.push_back(resource);
+		return *this;
+	}
+};
+
+// Frame graph: passes and the textures they read and write are declared every frame, then
+// compile() culls passes nothing depends on and assigns transient textures to a pool so
+// textures whose lifetimes do not overlap share memory. execute() binds each pass's
+// framebuffer and issues only the clears its attachments ask for.
+//
+// Imported resources (the backbuffer, the shadow map array) persist across frames, so passes
+// writing them are always kept.
+struct RenderGraph {
+	struct Resource {
+		std::string name;
+		GraphTextureDesc desc;
+		bool imported = false;
+		GLuint texture = 0;		// Physical texture for this frame (0 for the backbuffer)
+		int firstPass = -1, lastPass = -1;
+	};
+
+	struct PooledTexture {
+		GLenum format;
+		int width, height;
+		GLuint texture;
+		int busyUntil;
+	};
+
+	int frameWidth = 0, frameHeight = 0;
+	std::vector<Resource> resources;
+	std::deque<GraphPass> passes;
+	std::vector<PooledTexture> pool;
+	std::map<std::vector<GLuint>, GLuint> framebuffers;
+
+	// Statistics of the last executed frame
+	int livePasses = 0;
+	int culledPasses = 0;
+	int pooledTextures = 0;
+
+	// Start declaring a frame; a new frame size drops every pooled texture
+	void begin(int width, int height);
+
+	int createTexture(const char* name, GraphTextureDesc desc);
+	int importTexture(const char* name, GLuint texture);
+	int importBackbuffer();
+
+	GraphPass& addPass(const char* name, std::function<void()> execute);
+
+	void compile();
+	void execute();
+
+	// Physical texture of a resource; valid while the pass that reads it executes
+	GLuint texture(int resource) const;
+
+	// Framebuffer with the given resources attached (depth may be -1), created on first use
+	GLuint framebuffer(const std::vector<int>& colors, int depth);
+
+	void cleanup();
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "occluders.h"
+#include "cpu.h"
+#include <cfloat>
+
+// Both the rasteriser and the test run a row of pixels per step: eight with AVX2 (picked at run
+// time, see cpu.h), four with SSE2, one otherwise. WIDTH is a multiple of eight, so aligned steps
+// never leave the row.
+#if defined(CPU_AVX2_DISPATCH)
+#include <immintrin.h>
+#define OCCLUDERS_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUDERS_SSE2
+#endif
+
+// Slack for interpolation error, so a box never hides behind its own faces
+static const float depthBias = 1e-5f;
+
+// Twelve triangles over the corners of the building box (corner bits: 1 = +x, 2 = +y, 4 = +z).
+// Winding doesn't matter; drawTriangle orders each one itself.
+static const int boxTriangles[36] = {
+	0, 1, 3, 0, 3, 2,	// -z
+	4, 6, 7, 4, 7, 5,	// +z
+	0, 2, 6, 0, 6, 4,	// -x
+	1, 5, 7, 1, 7, 3,	// +x
+	0, 4, 5, 0, 5, 1,	// -y
+	2, 3, 7, 2, 7, 6	// +y
+};
+
+static glm::vec4 boxCorner(int corner) {
+	const glm::vec3& lo = BUILDING_BOUNDS_MIN;
+	const glm::vec3& hi = BUILDING_BOUNDS_MAX;
+	return glm::vec4((corner & 1) ? hi.x : lo.x, (corner & 2) ? hi.y : lo.y, (corner & 4) ? hi.z : lo.z, 1.0f);
+}
+
+// Clip space to buffer pixels, with depth in [0, 1]
+static glm::vec3 toWindow(const glm::vec4& clip) {
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	return glm::vec3((ndc.x * 0.5f + 0.5f) * SoftwareOcclusion::WIDTH, (ndc.y * 0.5f + 0.5f) * SoftwareOcclusion::HEIGHT, ndc.z * 0.5f + 0.5f);
+}
+
+// Clip a triangle to the near plane (z >= -w); returns the number of polygon vertices (0, 3 or 4)
+static int clipNear(const glm::vec4* triangle, glm::vec4* polygon) {
+	int count = 0;
+	for (int i = 0; i < 3; ++i) {
+		const glm::vec4& a = triangle[i];
+		const glm::vec4& b = triangle[(i + 1) % 3];
+		float da = a.z + a.w;
+		float db = b.z + b.w;
+		if (da >= 0.0f) polygon[count++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f)) polygon[count++] = a + (b - a) * (da / (da - db));
+	}
+	return count;
+}
+
+void SoftwareOcclusion::initialize() {
+	depth.assign(WIDTH * HEIGHT, 1.0f);
+	worker = std::thread(&SoftwareOcclusion::run, this);
+}
+
+void SoftwareOcclusion::begin(const glm::mat4& cameraMatrix, const glm::vec3& cameraPos, const std::vector<glm::mat4>* transformVectors, int vectorCount) {
+	if (!enabled) return;
+
+	// The worker may still be reading last frame's occluders
+	wait();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	this->cameraMatrix = cameraMatrix;
+	this->cameraPos = cameraPos;
+	occluders.clear();
+	for (int i = 0; i < vectorCount; ++i) {
+		occluders.insert(occluders.end(), transformVectors[i].begin(), transformVectors[i].end());
+	}
+	pending = true;
+	wake.notify_one();
+}
+
+void SoftwareOcclusion::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return !pending; });
+}
+
+void SoftwareOcclusion::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this]() { return pending || quit; });
+		if (quit) return;
+
+		lock.unlock();
+		rasterize();
+		lock.lock();
+
+		pending = false;
+		finished.notify_all();
+	}
+}
+
+void SoftwareOcclusion::rasterize() {
+	std::fill(depth.begin(), depth.end(), 1.0f);
+
+	// The nearest boxes cover the most pixels
+	size_t count = std::min(occluders.size(), static_cast<size_t>(maxOccluders));
+	glm::vec3 eye = cameraPos;
+	auto distance = [&eye](const glm::mat4& transform) {
+		glm::vec2 offset(transform[3].x - eye.x, transform[3].z - eye.z);
+		return glm::dot(offset, offset);
+	};
+	std::partial_sort(occluders.begin(), occluders.begin() + count, occluders.end(), [&distance](const glm::mat4& a, const glm::mat4& b) {
+		return distance(a) < distance(b);
+	});
+
+	for (size_t i = 0; i < count; ++i) {
+		glm::mat4 boxMatrix = cameraMatrix * occluders[i];
+		glm::vec4 corners[8];
+		for (int corner = 0; corner < 8; ++corner) {
+			corners[corner] = boxMatrix * boxCorner(corner);
+		}
+
+		// Buildings right next to the camera cross the near plane, and they hide the most
+		for (int t = 0; t < 36; t += 3) {
+			glm::vec4 triangle[3] = { corners[boxTriangles[t]], corners[boxTriangles[t + 1]], corners[boxTriangles[t + 2]] };
+			glm::vec4 polygon[4];
+			int vertexCount = clipNear(triangle, polygon);
+			for (int v = 2; v < vertexCount; ++v) {
+				drawTriangle(toWindow(polygon[0]), toWindow(polygon[v - 1]), toWindow(polygon[v]));
+			}
+		}
+	}
+	rasterizedOccluders = static_cast<int>(count);
+}
+
+// A triangle ready to fill: the edge functions E(x, y) = A x + B y + C of the edges opposite each
+// corner, depth as a plane in window space, and the pixels whose centres may lie inside
+struct TriangleSetup {
+	float a0, b0, c0, a1, b1, c1, a2, b2, c2;
+	float zx, zy, z0;
+	int minX, maxX, minY, maxY;
+};
+
+#if defined(OCCLUDERS_AVX2)
+CPU_AVX2_TARGET static void fillTriangleAVX2(float* depth, const TriangleSetup& t) {
+	const __m256 offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 edgeX0 = _mm256_set1_ps(t.a0), edgeX1 = _mm256_set1_ps(t.a1), edgeX2 = _mm256_set1_ps(t.a2);
+	const __m256 depthX = _mm256_set1_ps(t.zx);
+	for (int y = t.minY; y <= t.maxY; ++y) {
+		float py = y + 0.5f;
+		const __m256 row0 = _mm256_set1_ps(t.b0 * py + t.c0), row1 = _mm256_set1_ps(t.b1 * py + t.c1), row2 = _mm256_set1_ps(t.b2 * py + t.c2);
+		const __m256 rowDepth = _mm256_set1_ps(t.zy * py + t.z0);
+		float* row = depth + y * SoftwareOcclusion::WIDTH;
+		for (int x = t.minX & ~7; x <= t.maxX; x += 8) {
+			__m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), offsets);
+			__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeX0, px), row0), zero, _CMP_GE_OQ);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeX1, px), row1), zero, _CMP_GE_OQ));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeX2, px), row2), zero, _CMP_GE_OQ));
+			if (_mm256_movemask_ps(inside) == 0) continue;
+
+			__m256 z = _mm256_add_ps(_mm256_mul_ps(depthX, px), rowDepth);
+			__m256 old = _mm256_loadu_ps(row + x);
+			_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, z), inside));
+		}
+	}
+}
+
+// Skips whole steps of row[x..maxX] nearer than depth; the caller checks the rest
+CPU_AVX2_TARGET static int findFartherAVX2(const float* row, int x, int maxX, float depth) {
+	const __m256 threshold = _mm256_set1_ps(depth);
+	for (; x + 8 <= maxX + 1; x += 8) {
+		if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + x), threshold, _CMP_GE_OQ)) != 0) return x;
+	}
+	return x;
+}
+#endif
+
+#if defined(OCCLUDERS_SSE2)
+static void fillTriangleSSE2(float* depth, const TriangleSetup& t) {
+	const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 edgeX0 = _mm_set1_ps(t.a0), edgeX1 = _mm_set1_ps(t.a1), edgeX2 = _mm_set1_ps(t.a2);
+	const __m128 depthX = _mm_set1_ps(t.zx);
+	for (int y = t.minY; y <= t.maxY; ++y) {
+		float py = y + 0.5f;
+		const __m128 row0 = _mm_set1_ps(t.b0 * py + t.c0), row1 = _mm_set1_ps(t.b1 * py + t.c1), row2 = _mm_set1_ps(t.b2 * py + t.c2);
+		const __m128 rowDepth = _mm_set1_ps(t.zy * py + t.z0);
+		float* row = depth + y * SoftwareOcclusion::WIDTH;
+		for (int x = t.minX & ~3; x <= t.maxX; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+			__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX0, px), row0), zero);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX1, px), row1), zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeX2, px), row2), zero));
+			if (_mm_movemask_ps(inside) == 0) continue;
+
+			__m128 z = _mm_add_ps(_mm_mul_ps(depthX, px), rowDepth);
+			__m128 old = _mm_loadu_ps(row + x);
+			__m128 nearer = _mm_min_ps(old, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+		}
+	}
+}
+#else
+static void fillTriangle(float* depth, const TriangleSetup& t) {
+	for (int y = t.minY; y <= t.maxY; ++y) {
+		float py = y + 0.5f;
+		float* row = depth + y * SoftwareOcclusion::WIDTH;
+		for (int x = t.minX; x <= t.maxX; ++x) {
+			float px = x + 0.5f;
+			if (t.a0 * px + t.b0 * py + t.c0 < 0.0f || t.a1 * px + t.b1 * py + t.c1 < 0.0f || t.a2 * px + t.b2 * py + t.c2 < 0.0f) continue;
+			row[x] = std::min(row[x], t.zx * px + t.zy * py + t.z0);
+		}
+	}
+}
+#endif
+
+void SoftwareOcclusion::drawTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+	// Counter-clockwise, so the edge functions are positive inside
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (!(area != 0.0f)) return;
+	if (area < 0.0f) {
+		std::swap(b, c);
+		area = -area;
+	}
+
+	// Pixels whose centres may lie inside, clamped to the buffer
+	float left = glm::clamp(std::floor(std::min(a.x, std::min(b.x, c.x))), 0.0f, WIDTH - 1.0f);
+	float right = glm::clamp(std::ceil(std::max(a.x, std::max(b.x, c.x))), 0.0f, WIDTH - 1.0f);
+	float bottom = glm::clamp(std::floor(std::min(a.y, std::min(b.y, c.y))), 0.0f, HEIGHT - 1.0f);
+	float top = glm::clamp(std::ceil(std::max(a.y, std::max(b.y, c.y))), 0.0f, HEIGHT - 1.0f);
+	TriangleSetup t;
+	t.minX = static_cast<int>(left);
+	t.maxX = static_cast<int>(right);
+	t.minY = static_cast<int>(bottom);
+	t.maxY = static_cast<int>(top);
+
+	// Edge functions E(x, y) = A x + B y + C of the edges opposite a, b and c
+	t.a0 = b.y - c.y; t.b0 = c.x - b.x; t.c0 = b.x * c.y - b.y * c.x;
+	t.a1 = c.y - a.y; t.b1 = a.x - c.x; t.c1 = c.x * a.y - c.y * a.x;
+	t.a2 = a.y - b.y; t.b2 = b.x - a.x; t.c2 = a.x * b.y - a.y * b.x;
+
+	// Depth is affine in window space: the edge functions are barycentrics scaled by the area
+	float invArea = 1.0f / area;
+	t.zx = (t.a0 * a.z + t.a1 * b.z + t.a2 * c.z) * invArea;
+	t.zy = (t.b0 * a.z + t.b1 * b.z + t.b2 * c.z) * invArea;
+	t.z0 = (t.c0 * a.z + t.c1 * b.z + t.c2 * c.z) * invArea;
+
+#if defined(OCCLUDERS_AVX2)
+	if (HasAVX2()) {
+		fillTriangleAVX2(depth.data(), t);
+		return;
+	}
+#endif
+#if defined(OCCLUDERS_SSE2)
+	fillTriangleSSE2(depth.data(), t);
+#else
+	fillTriangle(depth.data(), t);
+#endif
+}
+
+bool SoftwareOcclusion::isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+	if (!enabled) return true;
+
+	// Screen rectangle and nearest depth of the box
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (int corner = 0; corner < 8; ++corner) {
+		glm::vec3 position((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y, (corner & 4) ? boundsMax.z : boundsMin.z);
+		glm::vec4 clip = cameraMatrix * glm::vec4(position, 1.0f);
+		if (clip.z < -clip.w) return true;
+		glm::vec3 window = toWindow(clip);
+		lo = glm::min(lo, window);
+		hi = glm::max(hi, window);
+	}
+	if (hi.x < 0.0f || lo.x > WIDTH || hi.y < 0.0f || lo.y > HEIGHT || lo.z > 1.0f) return false;
+
+	int minX = static_cast<int>(glm::clamp(std::floor(lo.x), 0.0f, WIDTH - 1.0f));
+	int maxX = static_cast<int>(glm::clamp(std::ceil(hi.x), 0.0f, WIDTH - 1.0f));
+	int minY = static_cast<int>(glm::clamp(std::floor(lo.y), 0.0f, HEIGHT - 1.0f));
+	int maxY = static_cast<int>(glm::clamp(std::ceil(hi.y), 0.0f, HEIGHT - 1.0f));
+	float nearest = lo.z - depthBias;
+
+	// Visible as soon as one pixel of the rectangle is farther than the box's nearest point
+	for (int y = minY; y <= maxY; ++y) {
+		const float* row = &depth[y * WIDTH];
+		int x = minX;
+#if defined(OCCLUDERS_AVX2)
+		if (HasAVX2()) x = findFartherAVX2(row, x, maxX, nearest);
+#endif
+#if defined(OCCLUDERS_SSE2)
+		const __m128 threshold = _mm_set1_ps(nearest);
+		for (; x + 4 <= maxX + 1; x += 4) {
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), threshold)) != 0) return true;
+		}
+#endif
+		for (; x <= maxX; ++x) {
+			if (row[x] >= nearest) return true;
+		}
+	}
+	return false;
+}
+
+void SoftwareOcclusion::cleanup() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_one();
+	if (worker.joinable()) worker.join();
+}
@@ -0,0 +1,60 @@
+#ifndef _OCCLUDERS_H_
+#define _OCCLUDERS_H_
+
+#include "headers.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Local box of the building mesh (cube.cpp), shared by its occluders and its camera and shadow culling
+static const glm::vec3 BUILDING_BOUNDS_MIN(-0.5f, 0.0f, -0.5f);
+static const glm::vec3 BUILDING_BOUNDS_MAX(0.5f, 1.0f, 0.5f);
+
+// CPU occlusion culling against the nearest buildings. Their boxes are rasterised into a small
+// depth buffer on a worker thread while the main thread carries on with the frame, then instance
+// bounds are tested against it before upload. Unlike the tile queries there is no frame of
+// latency and no GPU round trip, which matters on software GL where queries are slow.
+struct SoftwareOcclusion {
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+
+	bool enabled = true;
+	int maxOccluders = 48;	// Nearest building boxes rasterised per frame
+
+	// Window depth in [0, 1], row-major from the bottom row, cleared to the far plane
+	std::vector<float> depth;
+	int rasterizedOccluders = 0;
+
+	// Handed to the worker by begin
+	glm::mat4 cameraMatrix;
+	glm::vec3 cameraPos;
+	std::vector<glm::mat4> occluders;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	bool pending = false;
+	bool quit = false;
+
+	void initialize();
+
+	// Start rasterising this frame's buildings; transforms place the building box (BUILDING_BOUNDS_MIN to
+	// BUILDING_BOUNDS_MAX) like the building instances
+	void begin(const glm::mat4& cameraMatrix, const glm::vec3& cameraPos, const std::vector<glm::mat4>* transformVectors, int vectorCount);
+
+	// Block until the occluders passed to begin are in the depth buffer
+	void wait();
+
+	// World-space box against the occluders. Boxes crossing the near plane are always visible and
+	// boxes entirely off screen never are.
+	bool isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+
+	void cleanup();
+
+	void run();
+	void rasterize();
+	void drawTriangle(glm::vec3 a, glm::vec3 b, glm::vec3 c);
+};
+
+#endif
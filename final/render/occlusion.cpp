@@ -0,0 +1,172 @@
+#include "occlusion.h"
+#include "shader.h"
+#include "frustum.h"
+
+static unsigned long long tileKey(int x, int y) {
+	return (static_cast<unsigned long long>(static_cast<unsigned int>(x)) << 32) | static_cast<unsigned int>(y);
+}
+
+static void tileFromKey(unsigned long long key, int& x, int& y) {
+	x = static_cast<int>(static_cast<unsigned int>(key >> 32));
+	y = static_cast<int>(static_cast<unsigned int>(key & 0xFFFFFFFFu));
+}
+
+void TileOcclusion::initialize(float tileSize, float groundHeight) {
+	this->tileSize = tileSize;
+	this->groundHeight = groundHeight;
+
+	programID = LoadShadersFromFile("../final/shader/occlusion.vert", "../final/shader/depth.frag");
+	if (programID == 0) {
+		std::cerr << "Failed to load occlusion shaders." << std::endl;
+	}
+	boxMatrixID = glGetUniformLocation(programID, "boxMatrix");
+
+	// Unit box over [-0.5, 0.5] x [0, 1] x [-0.5, 0.5]; only positions are used
+	StaticVertex corners[8];
+	for (int i = 0; i < 8; ++i) {
+		corners[i].position = glm::vec3((i & 1) ? 0.5f : -0.5f, (i & 2) ? 1.0f : 0.0f, (i & 4) ? 0.5f : -0.5f);
+		corners[i].normal = glm::vec3(0.0f);
+		corners[i].uv = glm::vec2(0.0f);
+	}
+	GLuint indices[36] = {
+		0, 1, 3, 0, 3, 2,	// -z
+		4, 6, 7, 4, 7, 5,	// +z
+		0, 2, 6, 0, 6, 4,	// -x
+		1, 5, 7, 1, 7, 3,	// +x
+		0, 4, 5, 0, 5, 1,	// bottom
+		2, 3, 7, 2, 7, 6	// top
+	};
+	box = StaticGeometry().addMesh(corners, 8, indices, 36);
+}
+
+void TileOcclusion::tileOf(const glm::vec3& position, int& x, int& y) const {
+	x = static_cast<int>(round(position.x / tileSize));
+	y = static_cast<int>(round(position.z / tileSize));
+}
+
+bool TileOcclusion::isTileVisible(int x, int y) const {
+	if (!enabled) return true;
+	if (abs(x - centerX) <= alwaysVisibleRadius && abs(y - centerY) <= alwaysVisibleRadius) return true;
+
+	auto found = tiles.find(tileKey(x, y));
+	return found == tiles.end() || found->second.hiddenFrames < hideAfterFrames;
+}
+
+bool TileOcclusion::isVisible(const glm::vec3& position) const {
+	int x, y;
+	tileOf(position, x, y);
+	return isTileVisible(x, y);
+}
+
+void TileOcclusion::setTile(int x, int y, float halfWidth, float height) {
+	TileQuery& tile = tiles[tileKey(x, y)];
+	tile.halfWidth = halfWidth;
+	tile.height = height;
+	tile.lastFrame = frame;
+}
+
+void TileOcclusion::collect(int cameraTileX, int cameraTileY) {
+	centerX = cameraTileX;
+	centerY = cameraTileY;
+	frame++;
+
+	for (auto it = tiles.begin(); it != tiles.end();) {
+		TileQuery& tile = it->second;
+		if (tile.pending) {
+			GLuint available = 0;
+			glGetQueryObjectuiv(tile.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint samples = 0;
+				glGetQueryObjectuiv(tile.query, GL_QUERY_RESULT, &samples);
+				tile.hiddenFrames = samples ? 0 : tile.hiddenFrames + 1;
+				tile.pending = false;
+			}
+		}
+
+		// Forget tiles that have left the grid
+		if (!tile.pending && frame - tile.lastFrame > 1) {
+			if (tile.query != 0) glDeleteQueries(1, &tile.query);
+			it = tiles.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void TileOcclusion::issue(const glm::mat4& cameraMatrix) {
+	if (!enabled) return;
+
+	// Test only: no colour, no depth writes, and both faces since the camera may be inside a box
+	glUseProgram(programID);
+	StaticGeometry().bind();
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+
+	for (auto& entry : tiles) {
+		TileQuery& tile = entry.second;
+		int x, y;
+		tileFromKey(entry.first, x, y);
+		if (tile.pending || tile.lastFrame != frame) continue;
+		if (abs(x - centerX) <= alwaysVisibleRadius && abs(y - centerY) <= alwaysVisibleRadius) continue;
+
+		if (tile.query == 0) glGenQueries(1, &tile.query);
+
+		glm::mat4 boxMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(x * tileSize, groundHeight, y * tileSize));
+		boxMatrix = glm::scale(boxMatrix, glm::vec3(2.0f * tile.halfWidth, tile.height, 2.0f * tile.halfWidth));
+		boxMatrix = cameraMatrix * boxMatrix;
+		glUniformMatrix4fv(boxMatrixID, 1, GL_FALSE, &boxMatrix[0][0]);
+
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, tile.query);
+		glDrawElementsBaseVertex(GL_TRIANGLES, box.indexCount, GL_UNSIGNED_INT, (void*)(box.firstIndex * sizeof(GLuint)), box.baseVertex);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		tile.pending = true;
+	}
+
+	glEnable(GL_CULL_FACE);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+int TileOcclusion::culledTiles() const {
+	int culled = 0;
+	for (const auto& entry : tiles) {
+		int x, y;
+		tileFromKey(entry.first, x, y);
+		if (!isTileVisible(x, y)) culled++;
+	}
+	return culled;
+}
+
+bool InstanceCulling::isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+	if (tiles != nullptr && !tiles->isVisible(0.5f * (boundsMin + boundsMax))) return false;
+	if (occluders != nullptr && !occluders->isVisible(boundsMin, boundsMax)) return false;
+	return true;
+}
+
+bool InstanceCulling::isVisible(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+	glm::vec3 worldMin, worldMax;
+	TransformBox(transform, boundsMin, boundsMax, worldMin, worldMax);
+	return isVisible(worldMin, worldMax);
+}
+
+size_t PartitionVisible(std::vector<glm::mat4>& transforms, const InstanceCulling* culling, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+	if (culling == nullptr) {
+		return transforms.size();
+	}
+	auto split = std::stable_partition(transforms.begin(), transforms.end(), [&](const glm::mat4& transform) {
+		return culling->isVisible(transform, boundsMin, boundsMax);
+	});
+	return split - transforms.begin();
+}
+
+void TileOcclusion::cleanup() {
+	for (auto& entry : tiles) {
+		if (entry.second.query != 0) glDeleteQueries(1, &entry.second.query);
+	}
+	tiles.clear();
+	glDeleteProgram(programID);
+}
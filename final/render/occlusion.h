@@ -0,0 +1,77 @@
+#ifndef _OCCLUSION_H_
+#define _OCCLUSION_H_
+
+#include "headers.h"
+#include "geometry.h"
+#include "occluders.h"
+#include <unordered_map>
+
+// Tile-granular occlusion culling with GL_ANY_SAMPLES_PASSED queries. After the opaque scene,
+// each tile's bounding box is drawn against the scene depth inside a query; results are read
+// back a frame or more later, whenever they are available, so the CPU never waits on the GPU.
+//
+// A tile is only culled after hideAfterFrames consecutive hidden results and comes back on the
+// first visible one, so tiles near an occluder's silhouette don't pop.
+struct TileOcclusion {
+	struct TileQuery {
+		GLuint query = 0;
+		bool pending = false;
+		int hiddenFrames = 0;
+		float halfWidth = 0.0f;
+		float height = 0.0f;
+		int lastFrame = 0;
+	};
+
+	bool enabled = true;
+	int hideAfterFrames = 3;
+	int alwaysVisibleRadius = 1;	// Tiles this close to the camera's are never culled
+
+	float tileSize;
+	float groundHeight;
+	int centerX = 0, centerY = 0;
+	int frame = 0;
+	std::unordered_map<unsigned long long, TileQuery> tiles;
+
+	GLuint programID;
+	GLuint boxMatrixID;
+	MeshRange box;
+
+	void initialize(float tileSize, float groundHeight);
+
+	// Tile a world position lies in
+	void tileOf(const glm::vec3& position, int& x, int& y) const;
+
+	bool isTileVisible(int x, int y) const;
+	bool isVisible(const glm::vec3& position) const;
+
+	// Declare a tile of the current grid and how far from its centre and how high its contents reach
+	void setTile(int x, int y, float halfWidth, float height);
+
+	// Read back every finished query; call once per frame before the instance lists are built
+	void collect(int cameraTileX, int cameraTileY);
+
+	// Draw the tile boxes against the bound depth buffer; call after the opaque scene
+	void issue(const glm::mat4& cameraMatrix);
+
+	int culledTiles() const;
+
+	void cleanup();
+};
+
+// The occlusion tests applied to instances before upload; either may be absent
+struct InstanceCulling {
+	const TileOcclusion* tiles = nullptr;
+	const SoftwareOcclusion* occluders = nullptr;
+
+	// World-space box
+	bool isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+
+	// Local box under an instance transform
+	bool isVisible(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+};
+
+// Move instances whose local box is visible to the front, keeping their order; returns how many
+// there are. Everything is visible without culling.
+size_t PartitionVisible(std::vector<glm::mat4>& transforms, const InstanceCulling* culling, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+#endif
@@ -0,0 +1,260 @@
+#include "package.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+static const char packageMagic[4] = { 'A', 'P', 'K', 'G' };
+static const uint64_t packageAlignment = 16;
+
+// Relative to the working directory, like every other asset path
+static const char* cookedDirectory = "../final/cooked/";
+
+size_t PackageTextureBytes(const PackageTexture& texture) {
+	size_t bytes = 0;
+	uint32_t width = texture.width, height = texture.height;
+	for (uint32_t level = 0; level < texture.levels; ++level) {
+		bytes += static_cast<size_t>(width) * height * texture.layers * texture.channels;
+		width = PackageMipExtent(width);
+		height = PackageMipExtent(height);
+	}
+	return bytes;
+}
+
+std::string CookedPackagePath(const std::string& sourcePath, const char* suffix) {
+	// The path under final/, so sources with the same name in different directories don't collide
+	std::string name = sourcePath;
+	std::replace(name.begin(), name.end(), '\\', '/');
+	while (true) {
+		if (name.compare(0, 2, "./") == 0) name.erase(0, 2);
+		else if (name.compare(0, 3, "../") == 0) name.erase(0, 3);
+		else break;
+	}
+	if (name.compare(0, 6, "final/") == 0) name.erase(0, 6);
+	return cookedDirectory + name + suffix + ".pkg";
+}
+
+bool HasCookedPackage(const std::string& sourcePath, const char* suffix) {
+	MappedPackage package;
+	package.quiet = true;
+	return package.open(sourcePath, suffix);
+}
+
+bool StatFile(const std::string& path, uint64_t& size, int64_t& modified) {
+#ifdef _WIN32
+	struct _stat64 status;
+	if (_stat64(path.c_str(), &status) != 0) return false;
+#else
+	struct stat status;
+	if (stat(path.c_str(), &status) != 0) return false;
+#endif
+	size = static_cast<uint64_t>(status.st_size);
+	modified = static_cast<int64_t>(status.st_mtime);
+	return true;
+}
+
+static void makeDirectories(const std::string& filePath) {
+	for (size_t slash = filePath.find_first_of("/\\", 1); slash != std::string::npos; slash = filePath.find_first_of("/\\", slash + 1)) {
+		std::string directory = filePath.substr(0, slash);
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+}
+
+bool MappedPackage::open(const std::string& sourcePath, const char* suffix) {
+	close();
+	std::string path = CookedPackagePath(sourcePath, suffix);
+
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	file = fileHandle;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(PackageHeader))) {
+		if (!quiet) std::cerr << "Cooked package is too small: " << path << std::endl;
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (view == nullptr) {
+		if (!quiet) std::cerr << "Unable to map cooked package: " << path << std::endl;
+		close();
+		return false;
+	}
+	data = static_cast<const uint8_t*>(view);
+	size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(PackageHeader))) {
+		if (!quiet) std::cerr << "Cooked package is too small: " << path << std::endl;
+		close();
+		return false;
+	}
+	void* view = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	if (view == MAP_FAILED) {
+		if (!quiet) std::cerr << "Unable to map cooked package: " << path << std::endl;
+		close();
+		return false;
+	}
+	data = static_cast<const uint8_t*>(view);
+	size = static_cast<size_t>(status.st_size);
+#endif
+
+	// Check the table once here, so section() only has to look up tags
+	const PackageHeader* header = reinterpret_cast<const PackageHeader*>(data);
+	bool valid = std::memcmp(header->magic, packageMagic, sizeof(packageMagic)) == 0 && header->version == PACKAGE_VERSION &&
+		header->sectionCount <= (size - sizeof(PackageHeader)) / sizeof(PackageSection);
+	const PackageSection* sections = reinterpret_cast<const PackageSection*>(data + sizeof(PackageHeader));
+	for (uint32_t i = 0; valid && i < header->sectionCount; ++i) {
+		const PackageSection& section = sections[i];
+		valid = section.offset % packageAlignment == 0 && section.offset <= size && section.elementSize > 0 &&
+			section.count <= (size - section.offset) / section.elementSize;
+	}
+	if (!valid) {
+		if (!quiet) std::cerr << "Cooked package is out of date or damaged, loading the source instead: " << path << std::endl;
+		close();
+		return false;
+	}
+
+	// Every file it was cooked from must be unchanged, or the package describes an older asset
+	size_t sourceCount = 0;
+	const PackageSource* sources = section<PackageSource>(SECTION_SOURCES, sourceCount);
+	size_t slash = sourcePath.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "" : sourcePath.substr(0, slash + 1);
+	bool current = sourceCount > 0;
+	for (size_t i = 0; current && i < sourceCount; ++i) {
+		uint64_t size = 0;
+		int64_t modified = 0;
+		std::string name(sources[i].name, strnlen(sources[i].name, sizeof(sources[i].name)));
+		current = StatFile(directory + name, size, modified) && size == sources[i].size && modified == sources[i].modified;
+	}
+	if (!current) {
+		if (!quiet) std::cerr << "Cooked package is older than its sources, loading them instead: " << path << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedPackage::close() {
+#ifdef _WIN32
+	if (data != nullptr) UnmapViewOfFile(data);
+	if (mapping != nullptr) CloseHandle(mapping);
+	if (file != nullptr) CloseHandle(file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	if (data != nullptr) munmap(const_cast<uint8_t*>(data), size);
+	if (file >= 0) ::close(file);
+	file = -1;
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+const PackageSection* MappedPackage::findSection(uint32_t tag, size_t elementSize) const {
+	if (data == nullptr) {
+		return nullptr;
+	}
+	const PackageHeader* header = reinterpret_cast<const PackageHeader*>(data);
+	const PackageSection* sections = reinterpret_cast<const PackageSection*>(data + sizeof(PackageHeader));
+	for (uint32_t i = 0; i < header->sectionCount; ++i) {
+		if (sections[i].tag == tag) {
+			return sections[i].elementSize == elementSize ? &sections[i] : nullptr;
+		}
+	}
+	return nullptr;
+}
+
+const uint8_t* MappedPackage::texturePixels(const PackageTexture& texture) const {
+	size_t count = 0;
+	const uint8_t* pixels = section<uint8_t>(SECTION_PIXELS, count);
+	if (pixels == nullptr || texture.firstPixel > count || PackageTextureBytes(texture) > count - texture.firstPixel) {
+		return nullptr;
+	}
+	return pixels + texture.firstPixel;
+}
+
+bool PackageWriter::addSource(const std::string& path, const std::string& name) {
+	PackageSource source = {};
+	if (name.size() >= sizeof(source.name) || !StatFile(path, source.size, source.modified)) {
+		std::cerr << "Unable to record package source: " << path << std::endl;
+		return false;
+	}
+	std::memcpy(source.name, name.c_str(), name.size());
+	sources.push_back(source);
+	return true;
+}
+
+bool PackageWriter::write(const std::string& path) const {
+	// The sources go first, so the game checks them before reading anything else
+	PackageWriter package;
+	package.add(SECTION_SOURCES, sources);
+	package.sections.insert(package.sections.end(), sections.begin(), sections.end());
+	const std::vector<Section>& payloads = package.sections;
+
+	PackageHeader header;
+	std::memcpy(header.magic, packageMagic, sizeof(packageMagic));
+	header.version = PACKAGE_VERSION;
+	header.sectionCount = static_cast<uint32_t>(payloads.size());
+	header.reserved = 0;
+
+	// Lay the payloads out after the table, each on an aligned offset
+	std::vector<PackageSection> table(payloads.size());
+	uint64_t offset = sizeof(PackageHeader) + payloads.size() * sizeof(PackageSection);
+	for (size_t i = 0; i < payloads.size(); ++i) {
+		offset = (offset + packageAlignment - 1) / packageAlignment * packageAlignment;
+		table[i].tag = payloads[i].tag;
+		table[i].elementSize = payloads[i].elementSize;
+		table[i].offset = offset;
+		table[i].count = payloads[i].count;
+		offset += payloads[i].bytes.size();
+	}
+
+	// Write beside the package and rename over it, so the game never maps half a file
+	makeDirectories(path);
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(PackageSection));
+		const char padding[packageAlignment] = {};
+		uint64_t written = sizeof(PackageHeader) + table.size() * sizeof(PackageSection);
+		for (size_t i = 0; i < payloads.size(); ++i) {
+			file.write(padding, table[i].offset - written);
+			file.write(reinterpret_cast<const char*>(payloads[i].bytes.data()), payloads[i].bytes.size());
+			written = table[i].offset + payloads[i].bytes.size();
+		}
+		if (!file) {
+			std::cerr << "Unable to write cooked package: " << temporary << std::endl;
+			file.close();
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+	std::remove(path.c_str());
+	return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,202 @@
+#ifndef _PACKAGE_H_
+#define _PACKAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cooked asset packages, written offline by asset_cooker and mapped read-only at run time.
+// A package is a header, a table of sections and the section payloads, each 16-byte aligned.
+// A payload is an array of one of the plain records below, already in the layout its loader
+// wants, so reading one is a bounds check and a pointer cast.
+//
+// Packages mirror the source tree under final/, e.g. ../final/assets/ground.jpg is cooked to
+// ../final/cooked/assets/ground.jpg.pkg. Each records the size and modification time of every
+// file it was cooked from, and is ignored once any of them changes.
+
+#define PACKAGE_TAG(a, b, c, d) (static_cast<uint32_t>(a) | static_cast<uint32_t>(b) << 8 | \
+	static_cast<uint32_t>(c) << 16 | static_cast<uint32_t>(d) << 24)
+
+static const uint32_t PACKAGE_VERSION = 2;
+
+enum PackageSectionTag {
+	SECTION_SOURCES = PACKAGE_TAG('S', 'R', 'C', 'S'),		// PackageSource, the cooked asset first
+	SECTION_VERTICES = PACKAGE_TAG('V', 'R', 'T', 'X'),		// PackageVertex
+	SECTION_INDICES = PACKAGE_TAG('I', 'N', 'D', 'X'),		// uint32_t, from each primitive's first vertex
+	SECTION_PRIMITIVES = PACKAGE_TAG('P', 'R', 'I', 'M'),	// PackagePrimitive
+	SECTION_BOUNDS = PACKAGE_TAG('B', 'N', 'D', 'S'),		// PackageBounds, one per model
+	SECTION_TEXTURES = PACKAGE_TAG('T', 'E', 'X', 'R'),		// PackageTexture
+	SECTION_PIXELS = PACKAGE_TAG('P', 'I', 'X', 'L'),		// uint8_t, every level of every texture
+	SECTION_CLIPS = PACKAGE_TAG('C', 'L', 'I', 'P'),		// PackageClip
+	SECTION_TRACKS = PACKAGE_TAG('T', 'R', 'A', 'K'),		// PackageTrack
+	SECTION_KEY_TIMES = PACKAGE_TAG('K', 'T', 'I', 'M'),	// uint16_t, one per key
+	SECTION_KEY_VALUES = PACKAGE_TAG('K', 'V', 'A', 'L')	// uint16_t, three per key
+};
+
+struct PackageHeader {
+	char magic[4];			// "APKG"
+	uint32_t version;
+	uint32_t sectionCount;	// PackageSections straight after the header
+	uint32_t reserved;
+};
+
+struct PackageSection {
+	uint32_t tag;
+	uint32_t elementSize;	// Checked against the record the loader expects
+	uint64_t offset;		// From the start of the file
+	uint64_t count;
+};
+
+// A file the package was cooked from, named relative to the cooked asset's directory
+struct PackageSource {
+	uint64_t size;
+	int64_t modified;		// Seconds since the epoch
+	char name[240];
+};
+
+// Same layout as StaticVertex
+struct PackageVertex {
+	float position[3];
+	float normal[3];
+	float uv[2];
+};
+
+enum PackageMaterialFlags {
+	PACKAGE_MATERIAL_UNLIT = 1 << 0,	// KHR_materials_unlit
+	PACKAGE_MATERIAL_BLEND = 1 << 1		// Blend alpha mode or a translucent base colour
+};
+
+// Vertices are welded, triangles ordered for the post-transform cache, and vertices ordered by first use
+struct PackagePrimitive {
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t texture;		// Base colour, into SECTION_TEXTURES; -1 for none
+	uint32_t flags;			// PackageMaterialFlags
+	float baseColorFactor[4];
+};
+
+struct PackageBounds {
+	float min[3];
+	float max[3];
+};
+
+// A complete mip chain down to 1x1; level n+1 follows level n, each layers * width * height * channels
+// bytes, with every dimension halved (rounding down, at least 1) as GL expects
+struct PackageTexture {
+	uint32_t width;
+	uint32_t height;
+	uint32_t layers;		// 1 for a 2D texture
+	uint32_t channels;		// 3 or 4
+	uint32_t levels;
+	uint32_t reserved;
+	uint64_t firstPixel;	// Into SECTION_PIXELS
+};
+
+// A CompressedClip; its tracks and keys are ranges of the shared pools
+struct PackageClip {
+	char name[48];
+	float duration;
+	uint32_t firstTrack;
+	uint32_t trackCount;
+	uint32_t firstKey;
+	uint32_t keyCount;
+	uint32_t reserved;
+};
+
+// A CompressedTrack; firstKey counts from the clip's first key, as in memory
+struct PackageTrack {
+	int32_t targetNode;
+	int32_t path;
+	uint32_t step;
+	uint32_t firstKey;
+	uint32_t keyCount;
+	float rangeMin[3];
+	float rangeExtent[3];
+};
+
+inline uint32_t PackageMipExtent(uint32_t extent) {
+	return extent > 1 ? extent / 2 : 1;
+}
+
+// Bytes in the whole mip chain
+size_t PackageTextureBytes(const PackageTexture& texture);
+
+// Where a source asset's package lives: its path with leading ../ and final/ dropped, under
+// final/cooked, plus the suffix and .pkg
+std::string CookedPackagePath(const std::string& sourcePath, const char* suffix = "");
+
+// Whether the asset has a package that is still up to date
+bool HasCookedPackage(const std::string& sourcePath, const char* suffix = "");
+
+// Size and modification time, as recorded in PackageSource
+bool StatFile(const std::string& path, uint64_t& size, int64_t& modified);
+
+// A package mapped read-only; pointers into it stay valid until close()
+struct MappedPackage {
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int file = -1;
+#endif
+	bool quiet = false;		// Don't report damaged or stale packages
+
+	MappedPackage() {}
+	MappedPackage(const MappedPackage&) = delete;
+	MappedPackage& operator=(const MappedPackage&) = delete;
+	~MappedPackage() { close(); }
+
+	// Map the source asset's package. False, quietly, if there is none; a package that is
+	// damaged, or older than one of its sources, is reported and left closed.
+	bool open(const std::string& sourcePath, const char* suffix = "");
+	void close();
+
+	// The section's records, or null (count 0) if it is missing or doesn't hold T
+	template <typename T>
+	const T* section(uint32_t tag, size_t& count) const {
+		const PackageSection* found = findSection(tag, sizeof(T));
+		count = found != nullptr ? static_cast<size_t>(found->count) : 0;
+		return found != nullptr ? reinterpret_cast<const T*>(data + found->offset) : nullptr;
+	}
+
+	// The texture's level 0, or null if its chain runs past SECTION_PIXELS
+	const uint8_t* texturePixels(const PackageTexture& texture) const;
+
+	const PackageSection* findSection(uint32_t tag, size_t elementSize) const;
+};
+
+// Collects sections in memory for asset_cooker and writes them out in one go
+struct PackageWriter {
+	struct Section {
+		uint32_t tag;
+		uint32_t elementSize;
+		uint64_t count;
+		std::vector<uint8_t> bytes;
+	};
+	std::vector<Section> sections;
+	std::vector<PackageSource> sources;
+
+	// Record a file the package is cooked from under the name the game will look it up by
+	bool addSource(const std::string& path, const std::string& name);
+
+	template <typename T>
+	void add(uint32_t tag, const std::vector<T>& elements) {
+		Section section;
+		section.tag = tag;
+		section.elementSize = sizeof(T);
+		section.count = elements.size();
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(elements.data());
+		section.bytes.assign(bytes, bytes + elements.size() * sizeof(T));
+		sections.push_back(section);
+	}
+
+	// Creates the package's directory if needed
+	bool write(const std::string& path) const;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "program_cache.h"
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// Start of every cache file, followed by the binary format, its length and the binary itself
+static const char programBinaryMagic[4] = { 'G', 'L', 'P', 'B' };
+
+static void makeDirectory(const std::string& path) {
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+static std::string glString(GLenum name) {
+	const GLubyte* value = glGetString(name);
+	return value != nullptr ? reinterpret_cast<const char*>(value) : "";
+}
+
+void ProgramBinaryCache::initialize(const char* directory) {
+	this->directory = directory;
+	driver = glString(GL_VENDOR) + "|" + glString(GL_RENDERER) + "|" + glString(GL_VERSION);
+
+	// The entry points are outside the 3.3 profile glad is generated for, so look them up directly
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	bool core = major > 4 || (major == 4 && minor >= 1);
+	if (core || glfwExtensionSupported("GL_ARB_get_program_binary")) {
+		getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(glfwGetProcAddress("glGetProgramBinary"));
+		programBinary = reinterpret_cast<ProgramBinaryProc>(glfwGetProcAddress("glProgramBinary"));
+		programParameteri = reinterpret_cast<ProgramParameteriProc>(glfwGetProcAddress("glProgramParameteri"));
+	}
+
+	// Some drivers expose the extension with no formats, in which case nothing can be saved
+	GLint formats = 0;
+	if (getProgramBinary != nullptr && programBinary != nullptr && programParameteri != nullptr) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	}
+	supported = formats > 0;
+
+	if (supported) {
+		makeDirectory(this->directory);
+	}
+	else {
+		std::cout << "Program binaries unavailable, shaders are compiled from source." << std::endl;
+	}
+}
+
+std::string ProgramBinaryCache::key(const std::vector<std::string>& parts) const {
+	// 64-bit FNV-1a over the driver and each part, with lengths so boundaries can't shift
+	unsigned long long hash = 14695981039346656037ull;
+	auto mix = [&hash](const std::string& text) {
+		unsigned long long length = text.size();
+		for (int i = 0; i < 8; ++i) {
+			hash ^= (length >> (8 * i)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+		for (unsigned char c : text) {
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+	};
+	mix(driver);
+	for (const auto& part : parts) mix(part);
+
+	std::stringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return name.str();
+}
+
+std::string ProgramBinaryCache::path(const std::string& key) const {
+	return directory + "/" + key + ".bin";
+}
+
+GLuint ProgramBinaryCache::load(const std::string& key) {
+	if (!enabled || !supported) {
+		return 0;
+	}
+
+	std::ifstream file(path(key), std::ios::binary);
+	char magic[4];
+	GLenum format = 0;
+	GLint length = 0;
+	if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, programBinaryMagic, sizeof(magic)) != 0 ||
+		!file.read(reinterpret_cast<char*>(&format), sizeof(format)) ||
+		!file.read(reinterpret_cast<char*>(&length), sizeof(length)) || length <= 0) {
+		misses++;
+		return 0;
+	}
+	std::vector<char> binary(length);
+	if (!file.read(binary.data(), length)) {
+		misses++;
+		return 0;
+	}
+
+	// The driver may still reject a binary it wrote, e.g. after a change the strings don't show
+	GLuint programID = glCreateProgram();
+	programBinary(programID, format, binary.data(), length);
+	GLint success = GL_FALSE;
+	glGetProgramiv(programID, GL_LINK_STATUS, &success);
+	if (!success) {
+		glDeleteProgram(programID);
+		misses++;
+		return 0;
+	}
+	hits++;
+	return programID;
+}
+
+void ProgramBinaryCache::prepare(GLuint programID) {
+	if (enabled && supported) {
+		programParameteri(programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+}
+
+void ProgramBinaryCache::store(const std::string& key, GLuint programID) {
+	if (!enabled || !supported || programID == 0) {
+		return;
+	}
+
+	GLint length = 0;
+	glGetProgramiv(programID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	getProgramBinary(programID, length, &written, &format, binary.data());
+	if (written <= 0) {
+		return;
+	}
+
+	// Write beside the entry and rename over it, so a reader never sees half a file
+	std::string target = path(key);
+	std::string temporary = target + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write(programBinaryMagic, sizeof(programBinaryMagic));
+		file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+		file.write(reinterpret_cast<const char*>(&written), sizeof(written));
+		file.write(binary.data(), written);
+		if (!file) {
+			std::cerr << "Unable to write program binary: " << temporary << std::endl;
+			file.close();
+			std::remove(temporary.c_str());
+			return;
+		}
+	}
+	std::remove(target.c_str());
+	std::rename(temporary.c_str(), target.c_str());
+}
+
+ProgramBinaryCache& ProgramBinaries() {
+	static ProgramBinaryCache cache;
+	return cache;
+}
@@ -0,0 +1,49 @@
+#ifndef _PROGRAM_CACHE_H_
+#define _PROGRAM_CACHE_H_
+
+#include "headers.h"
+#include <atomic>
+
+// Linked program binaries saved to disk with ARB_get_program_binary (core in 4.1), so later runs
+// skip compiling and linking. Entries are keyed by a hash of every stage's final source (defines
+// included), anything else that affects linking, and the driver's vendor, renderer and version
+// strings; a driver update therefore just misses. Without the extension, before initialize, or on
+// any failure, callers compile from source as before.
+struct ProgramBinaryCache {
+	typedef void (GLAD_API_PTR* GetProgramBinaryProc)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+	typedef void (GLAD_API_PTR* ProgramBinaryProc)(GLuint, GLenum, const void*, GLsizei);
+	typedef void (GLAD_API_PTR* ProgramParameteriProc)(GLuint, GLenum, GLint);
+
+	bool enabled = true;
+	bool supported = false;
+	std::string directory;
+	std::string driver;
+
+	GetProgramBinaryProc getProgramBinary = nullptr;
+	ProgramBinaryProc programBinary = nullptr;
+	ProgramParameteriProc programParameteri = nullptr;
+
+	// Programs may be built on a worker thread too
+	std::atomic<int> hits{ 0 }, misses{ 0 };
+
+	// Needs a current context; creates the directory if it does not exist
+	void initialize(const char* directory);
+
+	// Hash of the program's inputs, to pass to load and store
+	std::string key(const std::vector<std::string>& parts) const;
+
+	// A linked program from the cache, or 0 if there is no usable entry
+	GLuint load(const std::string& key);
+
+	// Ask the driver to keep the binary retrievable; call between glCreateProgram and glLinkProgram
+	void prepare(GLuint programID);
+
+	// Save a successfully linked program
+	void store(const std::string& key, GLuint programID);
+
+	std::string path(const std::string& key) const;
+};
+
+ProgramBinaryCache& ProgramBinaries();
+
+#endif
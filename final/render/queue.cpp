@@ -0,0 +1,270 @@
+#include "queue.h"
+
+void GLStateCache::reset() {
+	program = ~0u;
+	vertexArray = ~0u;
+	activeUnit = ~0u;
+	for (int i = 0; i < MAX_UNITS; ++i) {
+		textureTargets[i] = GL_NONE;
+		textures[i] = ~0u;
+	}
+	material = nullptr;
+	instanceBuffer = ~0u;
+	firstInstance = -1;
+}
+
+bool GLStateCache::useProgram(GLuint programID) {
+	if (program == programID) {
+		skipped++;
+		return false;
+	}
+	glUseProgram(programID);
+	program = programID;
+	material = nullptr;
+	issued++;
+	return true;
+}
+
+bool GLStateCache::bindVertexArray(GLuint vertexArrayID) {
+	if (vertexArray == vertexArrayID) {
+		skipped++;
+		return false;
+	}
+	glBindVertexArray(vertexArrayID);
+	vertexArray = vertexArrayID;
+	instanceBuffer = ~0u;
+	firstInstance = -1;
+	issued++;
+	return true;
+}
+
+bool GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint textureID) {
+	if (unit < MAX_UNITS && textures[unit] == textureID && textureTargets[unit] == target) {
+		skipped++;
+		return false;
+	}
+	if (activeUnit != unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		activeUnit = unit;
+	}
+	glBindTexture(target, textureID);
+	if (unit < MAX_UNITS) {
+		textures[unit] = textureID;
+		textureTargets[unit] = target;
+	}
+	issued++;
+	return true;
+}
+
+bool GLStateCache::setMaterial(const QueueProgram& program, const DrawMaterial* newMaterial) {
+	if (newMaterial == nullptr) {
+		return false;
+	}
+	if (material == newMaterial) {
+		skipped++;
+		return false;
+	}
+	bindTexture(newMaterial->textureUnit, newMaterial->textureTarget, newMaterial->textureID);
+	glUniform4fv(program.baseColorFactorID, 1, &newMaterial->baseColorFactor[0]);
+	material = newMaterial;
+	issued++;
+	return true;
+}
+
+bool GLStateCache::bindInstances(GeometryArena& geometry, GLuint buffer, GLsizei stride, bool withMaterial, GLint first) {
+	if (instanceBuffer == buffer && firstInstance == first) {
+		skipped++;
+		return false;
+	}
+	geometry.bindInstances(buffer, stride, withMaterial, first);
+	instanceBuffer = buffer;
+	firstInstance = first;
+	issued++;
+	return true;
+}
+
+static const char* featureNames[] = { "UNLIT", "TRANSPARENT", "INSTANCE_MATERIAL" };
+
+void ProgramVariants::initialize(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines,
+	const char* fallbackVertexPath, const char* fallbackFragmentPath) {
+	this->vertexPath = vertexPath;
+	this->fragmentPath = fragmentPath;
+	this->defines = defines;
+	if (fallbackVertexPath != nullptr && fallbackFragmentPath != nullptr) {
+		fallbackProgramID = LoadShadersFromFile(fallbackVertexPath, fallbackFragmentPath);
+	}
+}
+
+// Point a QueueProgram at a built program and look up its uniforms
+static void bindVariant(QueueProgram& program, GLuint programID, const char* viewMatrixName,
+	const std::vector<std::pair<std::string, GLint>>& samplerUnits) {
+	program.programID = programID;
+	program.viewMatrixID = glGetUniformLocation(programID, viewMatrixName);
+	program.textureSamplerID = glGetUniformLocation(programID, "textureSampler");
+	program.baseColorFactorID = glGetUniformLocation(programID, "baseColorFactor");
+	if (programID == 0 || samplerUnits.empty()) {
+		return;
+	}
+	glUseProgram(programID);
+	for (const auto& sampler : samplerUnits) {
+		glUniform1i(glGetUniformLocation(programID, sampler.first.c_str()), sampler.second);
+	}
+	glUseProgram(0);
+}
+
+const QueueProgram& ProgramVariants::get(unsigned int features) {
+	auto found = programs.find(features);
+	if (found != programs.end()) {
+		return found->second;
+	}
+
+	// Every feature is defined, so shaders can test them with #if
+	ShaderDefines variantDefines = defines;
+	for (size_t i = 0; i < sizeof(featureNames) / sizeof(featureNames[0]); ++i) {
+		variantDefines.push_back({ featureNames[i], (features & (1u << i)) ? "1" : "0" });
+	}
+
+	QueueProgram& program = programs[features];
+	ProgramFuture future = ShaderVariants().get(vertexPath, fragmentPath, variantDefines);
+	if (future.ready()) {
+		bindVariant(program, future.get(), viewMatrixName, samplerUnits);
+	}
+	else {
+		// A stand-in opaque surface would cover the OIT targets wrongly, so transparent ones wait
+		bindVariant(program, (features & FEATURE_TRANSPARENT) ? 0 : fallbackProgramID, viewMatrixName, {});
+		pending[features] = future;
+	}
+	return program;
+}
+
+void ProgramVariants::setSamplerUnit(const std::string& name, GLint unit) {
+	samplerUnits.push_back({ name, unit });
+	for (const auto& program : programs) {
+		if (pending.count(program.first) > 0 || program.second.programID == 0) continue;
+		glUseProgram(program.second.programID);
+		glUniform1i(glGetUniformLocation(program.second.programID, name.c_str()), unit);
+	}
+	glUseProgram(0);
+}
+
+size_t ProgramVariants::update() {
+	for (auto it = pending.begin(); it != pending.end();) {
+		const ProgramFuture& future = it->second;
+		if (!future.ready() && !future.failed()) {
+			++it;
+			continue;
+		}
+		if (future.failed()) {
+			// Keep drawing with the fallback
+			std::cerr << "Failed to load shader variant " << it->first << " of " << fragmentPath << "." << std::endl;
+		}
+		else {
+			bindVariant(programs[it->first], future.get(), viewMatrixName, samplerUnits);
+		}
+		it = pending.erase(it);
+	}
+	return pending.size();
+}
+
+void ProgramVariants::cleanup() {
+	// The variants themselves belong to ShaderVariants()
+	programs.clear();
+	pending.clear();
+	glDeleteProgram(fallbackProgramID);
+	fallbackProgramID = 0;
+}
+
+void RenderQueue::clear() {
+	lastDrawCount = packets.size();
+	lastIssued = state.issued;
+	lastSkipped = state.skipped;
+	state.issued = 0;
+	state.skipped = 0;
+	packets.clear();
+}
+
+void RenderQueue::submit(RenderPass pass, const QueueProgram& program, const DrawMaterial* material, GeometryArena& geometry,
+	GLuint instanceBufferID, GLsizei instanceStride, bool instanceMaterial, const MeshRange& mesh, GLsizei instanceCount, float depth) {
+	if (instanceCount <= 0) {
+		return;
+	}
+
+	// Materials are numbered in the order they are first seen so equal materials sort together
+	uint64_t materialID = 0;
+	if (material != nullptr) {
+		auto found = materialIDs.find(material);
+		if (found == materialIDs.end()) {
+			found = materialIDs.emplace(material, materialIDs.size() + 1).first;
+		}
+		materialID = found->second;
+	}
+	uint64_t depthBits = static_cast<uint64_t>(glm::clamp(depth, 0.0f, 1.0f) * 0xFFFFFF);
+
+	DrawPacket packet;
+	packet.key = (static_cast<uint64_t>(pass & 0xF) << 60)
+		| (static_cast<uint64_t>(program.programID & 0xFFF) << 48)
+		| ((materialID & 0xFFFF) << 32)
+		| (static_cast<uint64_t>(geometry.vertexArrayID & 0xFF) << 24)
+		| depthBits;
+	packet.program = &program;
+	packet.material = material;
+	packet.geometry = &geometry;
+	packet.instanceBufferID = instanceBufferID;
+	packet.instanceStride = instanceStride;
+	packet.instanceMaterial = instanceMaterial;
+	packet.mesh = mesh;
+	packet.firstInstance = 0;
+	packet.instanceCount = instanceCount;
+	packet.layer = -1;
+	packets.push_back(packet);
+}
+
+void RenderQueue::submitShadow(int layer, const QueueProgram& program, GeometryArena& geometry,
+	GLuint instanceBufferID, GLsizei instanceStride, bool instanceMaterial, const MeshRange& mesh, GLint firstInstance, GLsizei instanceCount) {
+	if (instanceCount <= 0) {
+		return;
+	}
+
+	// The layer takes the place of depth, so each layer's packets sort together
+	submit(PASS_SHADOW, program, nullptr, geometry, instanceBufferID, instanceStride, instanceMaterial, mesh, instanceCount);
+	DrawPacket& packet = packets.back();
+	packet.key = (packet.key & ~static_cast<uint64_t>(0xFFFFFF)) | static_cast<uint64_t>(layer & 0xFFFFFF);
+	packet.firstInstance = firstInstance;
+	packet.layer = layer;
+}
+
+void RenderQueue::sort() {
+	// Stable so equal keys keep their submission order from frame to frame
+	std::stable_sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b) {
+		return a.key < b.key;
+	});
+}
+
+void RenderQueue::flush(RenderPass pass, const glm::mat4& viewMatrix, const QueueProgram* depthOnly, int layer) {
+	uint64_t first = static_cast<uint64_t>(pass) << 60;
+	auto begin = std::lower_bound(packets.begin(), packets.end(), first, [](const DrawPacket& packet, uint64_t key) {
+		return packet.key < key;
+	});
+
+	state.reset();
+	for (auto it = begin; it != packets.end() && (it->key >> 60) == static_cast<uint64_t>(pass); ++it) {
+		const DrawPacket& packet = *it;
+		if (layer >= 0 && packet.layer >= 0 && packet.layer != layer) continue;
+		const QueueProgram& program = depthOnly != nullptr ? *depthOnly : *packet.program;
+		if (program.programID == 0) continue;	// Still being built, with nothing to stand in
+
+		if (state.useProgram(program.programID)) {
+			// Uniforms shared by the whole pass
+			glUniformMatrix4fv(program.viewMatrixID, 1, GL_FALSE, &viewMatrix[0][0]);
+			glUniform1i(program.textureSamplerID, 0);
+		}
+		if (depthOnly == nullptr) state.setMaterial(program, packet.material);
+		state.bindVertexArray(packet.geometry->vertexArrayID);
+		state.bindInstances(*packet.geometry, packet.instanceBufferID, packet.instanceStride, packet.instanceMaterial, packet.firstInstance);
+		packet.geometry->draw(packet.mesh, packet.instanceCount);
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
@@ -0,0 +1,143 @@
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include "headers.h"
+#include "geometry.h"
+#include "shader.h"
+#include "shader_compiler.h"
+#include <cstdint>
+#include <unordered_map>
+
+enum RenderPass {
+	PASS_SHADOW = 0,
+	PASS_OPAQUE = 1,
+	PASS_TRANSPARENT = 2
+};
+
+// A program and the uniforms the queue sets on it; missing uniforms are -1
+struct QueueProgram {
+	GLuint programID = 0;
+	GLint viewMatrixID = -1;		// Camera or light space matrix, set once per flush
+	GLint textureSamplerID = -1;
+	GLint baseColorFactorID = -1;
+};
+
+// Static material features, each compiled into a program variant as "#define NAME 0/1"
+enum ProgramFeature {
+	FEATURE_UNLIT = 1 << 0,				// Solid colour, no lighting (lamp bulbs)
+	FEATURE_TRANSPARENT = 1 << 1,		// Writes the weighted blended OIT targets
+	FEATURE_INSTANCE_MATERIAL = 1 << 2	// Instances carry a texture array layer and UV tiling
+};
+
+// One vertex/fragment pair compiled per feature set, on top of definitions shared by every
+// variant. Materials pick their variant once at load. Variants build in the background; until
+// one is ready its QueueProgram draws with the fallback program, or not at all for transparent
+// variants (programID 0), and update() swaps the real program in place.
+struct ProgramVariants {
+	const char* vertexPath = nullptr;
+	const char* fragmentPath = nullptr;
+	const char* viewMatrixName = "camera";
+	ShaderDefines defines;
+	GLuint fallbackProgramID = 0;
+	std::unordered_map<unsigned int, QueueProgram> programs;
+	std::unordered_map<unsigned int, ProgramFuture> pending;
+
+	// Texture units for samplers other than textureSampler, set on each program once it is built
+	std::vector<std::pair<std::string, GLint>> samplerUnits;
+
+	// The fallback is compiled straight away and only needs the camera uniform and instance matrix
+	void initialize(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines,
+		const char* fallbackVertexPath = nullptr, const char* fallbackFragmentPath = nullptr);
+
+	// Requested on first use; the reference stays valid until cleanup
+	const QueueProgram& get(unsigned int features);
+
+	void setSamplerUnit(const std::string& name, GLint unit);
+
+	// Swap in variants that finished building; returns how many are still pending
+	size_t update();
+
+	void cleanup();
+};
+
+// Texture and per-draw uniforms shared by every packet that points at it
+struct DrawMaterial {
+	GLenum textureTarget = GL_TEXTURE_2D;
+	GLuint textureID = 0;
+	GLuint textureUnit = 0;
+	glm::vec4 baseColorFactor = glm::vec4(1.0f);
+};
+
+struct DrawPacket {
+	uint64_t key;
+	const QueueProgram* program;
+	const DrawMaterial* material;	// Null for depth-only passes
+	GeometryArena* geometry;
+	GLuint instanceBufferID;
+	GLsizei instanceStride;
+	bool instanceMaterial;
+	MeshRange mesh;
+	GLint firstInstance;
+	GLsizei instanceCount;
+	int layer;		// Shadow layer the packet belongs to, or -1 for every layer
+};
+
+// Shadow of the GL state touched while replaying a queue. Only valid between reset() and the end
+// of a flush: anything drawn outside the queue binds state behind its back.
+struct GLStateCache {
+	static const int MAX_UNITS = 8;
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint activeUnit;
+	GLenum textureTargets[MAX_UNITS];
+	GLuint textures[MAX_UNITS];
+	const DrawMaterial* material;
+	GLuint instanceBuffer;
+	GLint firstInstance;
+
+	unsigned int issued = 0;
+	unsigned int skipped = 0;
+
+	void reset();
+
+	// Each returns true when the call reached GL
+	bool useProgram(GLuint programID);
+	bool bindVertexArray(GLuint vertexArrayID);
+	bool bindTexture(GLuint unit, GLenum target, GLuint textureID);
+	bool setMaterial(const QueueProgram& program, const DrawMaterial* material);
+	bool bindInstances(GeometryArena& geometry, GLuint buffer, GLsizei stride, bool withMaterial, GLint firstInstance);
+};
+
+// Draw packets sorted by a 64-bit key, from most to least expensive state change:
+// pass (4 bits) | program (12) | material (16) | vertex array (8) | depth (24)
+struct RenderQueue {
+	std::vector<DrawPacket> packets;
+	std::unordered_map<const DrawMaterial*, uint64_t> materialIDs;
+	GLStateCache state;
+
+	// Statistics of the last completed frame
+	unsigned int lastDrawCount = 0;
+	unsigned int lastIssued = 0;
+	unsigned int lastSkipped = 0;
+
+	// Start a new frame
+	void clear();
+
+	// depth is a view distance normalised to [0, 1]; nearer draws go first within equal state
+	void submit(RenderPass pass, const QueueProgram& program, const DrawMaterial* material, GeometryArena& geometry,
+		GLuint instanceBufferID, GLsizei instanceStride, bool instanceMaterial, const MeshRange& mesh, GLsizei instanceCount, float depth = 0.0f);
+
+	// A depth-only draw into one shadow layer of instances [firstInstance, firstInstance + instanceCount)
+	void submitShadow(int layer, const QueueProgram& program, GeometryArena& geometry,
+		GLuint instanceBufferID, GLsizei instanceStride, bool instanceMaterial, const MeshRange& mesh, GLint firstInstance, GLsizei instanceCount);
+
+	void sort();
+
+	// Replay every packet of one pass; the target framebuffer and blend and depth state belong to
+	// the caller. A depth-only program replaces each packet's program and skips its material.
+	// With a layer, packets meant for other shadow layers are skipped.
+	void flush(RenderPass pass, const glm::mat4& viewMatrix, const QueueProgram* depthOnly = nullptr, int layer = -1);
+};
+
+#endif
@@ -31,6 +31,7 @@ GLuint CompileShader(GLenum shaderType, const std::string& shaderCode) {
         std::vector<char> infoLog(logLength + 1);
         glGetShaderInfoLog(shaderID, logLength, nullptr, infoLog.data());
         std::cerr << "Error compiling shader: " << infoLog.data() << std::endl;
+        glDeleteShader(shaderID);
         return 0;
     }
     return shaderID;
@@ -41,14 +42,57 @@ GLuint LoadShadersFromFile(const char* vertex_file_path, const char* fragment_fi
     std::string vertexCode = ReadFile(vertex_file_path);
     std::string fragmentCode = ReadFile(fragment_file_path);
     std::string geometryCode = geometry_file_path ? ReadFile(geometry_file_path) : "";
+    return LoadShadersFromString(vertexCode, fragmentCode, geometryCode);
+}
 
-    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, vertexCode);
-    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentCode);
+// Insert #defines after the #version line; #line keeps compiler messages on the file's numbering
+std::string InjectDefines(std::string code, const ShaderDefines& defines) {
+    if (defines.empty()) {
+        return code;
+    }
+
+    size_t version = code.find("#version");
+    size_t insertAt = version == std::string::npos ? std::string::npos : code.find('\n', version);
+    insertAt = insertAt == std::string::npos ? 0 : insertAt + 1;
+    int nextLine = 1 + static_cast<int>(std::count(code.begin(), code.begin() + insertAt, '\n'));
+
+    std::string block;
+    for (const auto& define : defines) {
+        block += "#define " + define.first + " " + define.second + "\n";
+    }
+    block += "#line " + std::to_string(nextLine) + "\n";
+    code.insert(insertAt, block);
+    return code;
+}
+
+std::string LoadShaderSource(const char* file_path, const ShaderDefines& defines) {
+    return InjectDefines(ReadFile(file_path), defines);
+}
+
+// Load shaders from file with preprocessor definitions
+GLuint LoadShadersFromFile(const char* vertex_file_path, const char* fragment_file_path, const ShaderDefines& defines) {
+    std::string vertexCode = LoadShaderSource(vertex_file_path, defines);
+    std::string fragmentCode = LoadShaderSource(fragment_file_path, defines);
+    return LoadShadersFromString(vertexCode, fragmentCode);
+}
+
+// Load shaders from string (vertex, fragment, and optional geometry shader)
+GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode, std::string GeometryShaderCode) {
+    // Reuse the binary from an earlier run of the same sources on the same driver
+    ProgramBinaryCache& binaries = ProgramBinaries();
+    std::string binaryKey = binaries.key({ VertexShaderCode, FragmentShaderCode, GeometryShaderCode });
+    GLuint cachedProgramID = binaries.load(binaryKey);
+    if (cachedProgramID != 0) {
+        return cachedProgramID;
+    }
+
+    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, VertexShaderCode);
+    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, FragmentShaderCode);
     GLuint geometryShader = 0;
 
-    // If geometry shader path is provided, compile the geometry shader
-    if (!geometryCode.empty()) {
-        geometryShader = CompileShader(GL_GEOMETRY_SHADER, geometryCode);
+    // If geometry shader code is provided, compile the geometry shader
+    if (!GeometryShaderCode.empty()) {
+        geometryShader = CompileShader(GL_GEOMETRY_SHADER, GeometryShaderCode);
     }
 
     // Create shader program
@@ -58,6 +102,7 @@ GLuint LoadShadersFromFile(const char* vertex_file_path, const char* fragment_fi
     if (geometryShader) {
         glAttachShader(programID, geometryShader);
     }
+    binaries.prepare(programID);
 
     // Link the program
     GLint success;
@@ -69,6 +114,12 @@ GLuint LoadShadersFromFile(const char* vertex_file_path, const char* fragment_fi
         std::vector<char> infoLog(logLength + 1);
         glGetProgramInfoLog(programID, logLength, nullptr, infoLog.data());
         std::cerr << "Error linking shader program: " << infoLog.data() << std::endl;
+        glDeleteProgram(programID);
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        if (geometryShader) {
+            glDeleteShader(geometryShader);
+        }
         return 0;
     }
 
@@ -79,27 +130,34 @@ GLuint LoadShadersFromFile(const char* vertex_file_path, const char* fragment_fi
         glDeleteShader(geometryShader);
     }
 
+    binaries.store(binaryKey, programID);
     return programID;
 }
 
-// Load shaders from string (vertex, fragment, and optional geometry shader)
-GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode, std::string GeometryShaderCode) {
-    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, VertexShaderCode);
-    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, FragmentShaderCode);
-    GLuint geometryShader = 0;
+// Load a vertex-only program whose outputs are captured with transform feedback (interleaved)
+GLuint LoadTransformFeedbackShaderFromFile(const char* vertex_file_path, const std::vector<const char*>& varyings) {
+    std::string vertexCode = ReadFile(vertex_file_path);
 
-    // If geometry shader code is provided, compile the geometry shader
-    if (!GeometryShaderCode.empty()) {
-        geometryShader = CompileShader(GL_GEOMETRY_SHADER, GeometryShaderCode);
+    // The captured varyings are part of the linked program, so they are part of its key
+    ProgramBinaryCache& binaries = ProgramBinaries();
+    std::vector<std::string> keyParts = { vertexCode, "transform feedback" };
+    keyParts.insert(keyParts.end(), varyings.begin(), varyings.end());
+    std::string binaryKey = binaries.key(keyParts);
+    GLuint cachedProgramID = binaries.load(binaryKey);
+    if (cachedProgramID != 0) {
+        return cachedProgramID;
     }
 
-    // Create shader program
+    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, vertexCode);
+    if (vertexShader == 0) {
+        return 0;
+    }
+
+    // Create shader program, varyings must be declared before linking
     GLuint programID = glCreateProgram();
     glAttachShader(programID, vertexShader);
-    glAttachShader(programID, fragmentShader);
-    if (geometryShader) {
-        glAttachShader(programID, geometryShader);
-    }
+    glTransformFeedbackVaryings(programID, varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+    binaries.prepare(programID);
 
     // Link the program
     GLint success;
@@ -110,16 +168,14 @@ GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentS
         glGetProgramiv(programID, GL_INFO_LOG_LENGTH, &logLength);
         std::vector<char> infoLog(logLength + 1);
         glGetProgramInfoLog(programID, logLength, nullptr, infoLog.data());
-        std::cerr << "Error linking shader program: " << infoLog.data() << std::endl;
+        std::cerr << "Error linking transform feedback program: " << infoLog.data() << std::endl;
+        glDeleteProgram(programID);
+        glDeleteShader(vertexShader);
         return 0;
     }
 
-    // Clean up shaders as they are now linked into the program
     glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    if (geometryShader) {
-        glDeleteShader(geometryShader);
-    }
 
+    binaries.store(binaryKey, programID);
     return programID;
 }
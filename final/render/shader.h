@@ -2,9 +2,21 @@
 #define _SHADER_H_
 
 #include "headers.h"
+#include "program_cache.h"
+
+// Preprocessor definitions (name, value) inserted after a shader's #version line
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
 
 GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path, const char* geometry_file_path = nullptr);
 
+// Both stages get the same definitions
+GLuint LoadShadersFromFile(const char* vertex_file_path, const char* fragment_file_path, const ShaderDefines& defines);
+
+// A file's source with the definitions inserted, as the overload above compiles it
+std::string LoadShaderSource(const char* file_path, const ShaderDefines& defines);
+
 GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode, std::string GeometryShaderCode = "");
 
+GLuint LoadTransformFeedbackShaderFromFile(const char* vertex_file_path, const std::vector<const char*>& varyings);
+
 #endif
@@ -0,0 +1,227 @@
+#include "shader_compiler.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static void printShaderLog(GLuint shaderID, const std::string& name) {
+	GLint success = GL_FALSE;
+	glGetShaderiv(shaderID, GL_COMPILE_STATUS, &success);
+	if (success) return;
+	GLint logLength = 0;
+	glGetShaderiv(shaderID, GL_INFO_LOG_LENGTH, &logLength);
+	std::vector<char> infoLog(logLength + 1);
+	glGetShaderInfoLog(shaderID, logLength, nullptr, infoLog.data());
+	std::cerr << "Error compiling shader for " << name << ": " << infoLog.data() << std::endl;
+}
+
+void ShaderCompiler::initialize(GLFWwindow* mainWindow) {
+	// Let the driver compile on its own threads if it can; nothing else is needed then
+	MaxShaderCompilerThreadsProc maxThreads = nullptr;
+	if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+		maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+	}
+	else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile")) {
+		maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+	}
+	if (maxThreads != nullptr) {
+		maxThreads(0xFFFFFFFF);
+		mode = PARALLEL_EXTENSION;
+		return;
+	}
+
+	// Otherwise a hidden 1x1 window whose context shares objects with the main one; it uses the
+	// version and profile hints still set from creating the main window
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	sharedWindow = glfwCreateWindow(1, 1, "Shader compiler", NULL, mainWindow);
+	glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+	if (sharedWindow == nullptr) {
+		std::cerr << "Failed to create a shared context, shaders are compiled synchronously." << std::endl;
+		mode = SYNCHRONOUS;
+		return;
+	}
+
+	mode = SHARED_CONTEXT;
+	stopping = false;
+	worker = std::thread(&ShaderCompiler::run, this);
+}
+
+ProgramFuture ShaderCompiler::compile(const std::string& name, const std::string& vertexCode, const std::string& fragmentCode) {
+	ProgramFuture future;
+	future.job = std::make_shared<ShaderJob>();
+	ShaderJob& job = *future.job;
+	job.name = name;
+	job.vertexCode = vertexCode;
+	job.fragmentCode = fragmentCode;
+
+	if (mode == SHARED_CONTEXT) {
+		pendingJobs++;
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(future.job);
+		wake.notify_one();
+		return future;
+	}
+
+	if (mode == PARALLEL_EXTENSION) {
+		// A cached binary is quick to load, so only a miss goes to the driver's threads
+		ProgramBinaryCache& binaries = ProgramBinaries();
+		job.binaryKey = binaries.key({ vertexCode, fragmentCode, "" });
+		job.programID = binaries.load(job.binaryKey);
+		if (job.programID != 0) {
+			job.state = ShaderJob::READY;
+			return future;
+		}
+
+		// Compile and link without asking for status, which would wait for the result
+		const char* vertexSource = job.vertexCode.c_str();
+		const char* fragmentSource = job.fragmentCode.c_str();
+		job.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(job.vertexShader, 1, &vertexSource, nullptr);
+		glCompileShader(job.vertexShader);
+		job.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(job.fragmentShader, 1, &fragmentSource, nullptr);
+		glCompileShader(job.fragmentShader);
+		job.programID = glCreateProgram();
+		glAttachShader(job.programID, job.vertexShader);
+		glAttachShader(job.programID, job.fragmentShader);
+		binaries.prepare(job.programID);
+		glLinkProgram(job.programID);
+
+		pendingJobs++;
+		compiling.push_back(future.job);
+		return future;
+	}
+
+	job.programID = LoadShadersFromString(vertexCode, fragmentCode);
+	job.state = job.programID != 0 ? ShaderJob::READY : ShaderJob::FAILED;
+	return future;
+}
+
+void ShaderCompiler::finishParallel(ShaderJob& job) {
+	GLint success = GL_FALSE;
+	glGetProgramiv(job.programID, GL_LINK_STATUS, &success);
+	if (!success) {
+		printShaderLog(job.vertexShader, job.name);
+		printShaderLog(job.fragmentShader, job.name);
+		GLint logLength = 0;
+		glGetProgramiv(job.programID, GL_INFO_LOG_LENGTH, &logLength);
+		std::vector<char> infoLog(logLength + 1);
+		glGetProgramInfoLog(job.programID, logLength, nullptr, infoLog.data());
+		std::cerr << "Error linking shader program " << job.name << ": " << infoLog.data() << std::endl;
+		glDeleteProgram(job.programID);
+		job.programID = 0;
+	}
+	glDeleteShader(job.vertexShader);
+	glDeleteShader(job.fragmentShader);
+	job.vertexShader = job.fragmentShader = 0;
+
+	if (job.programID != 0) {
+		ProgramBinaries().store(job.binaryKey, job.programID);
+	}
+	job.state = job.programID != 0 ? ShaderJob::READY : ShaderJob::FAILED;
+	pendingJobs--;
+}
+
+void ShaderCompiler::update() {
+	for (size_t i = 0; i < compiling.size();) {
+		GLint done = GL_FALSE;
+		glGetProgramiv(compiling[i]->programID, GL_COMPLETION_STATUS_KHR, &done);
+		if (!done) {
+			++i;
+			continue;
+		}
+		finishParallel(*compiling[i]);
+		compiling[i] = compiling.back();
+		compiling.pop_back();
+	}
+}
+
+void ShaderCompiler::run() {
+	glfwMakeContextCurrent(sharedWindow);
+	while (true) {
+		std::shared_ptr<ShaderJob> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (stopping) break;
+			job = queue.front();
+			queue.pop_front();
+		}
+
+		// The finish makes the linked program complete before the main context can see it
+		GLuint programID = LoadShadersFromString(job->vertexCode, job->fragmentCode);
+		glFinish();
+		job->programID = programID;
+		job->state = programID != 0 ? ShaderJob::READY : ShaderJob::FAILED;
+		pendingJobs--;
+	}
+	glfwMakeContextCurrent(nullptr);
+}
+
+void ShaderCompiler::cleanup() {
+	if (worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		worker.join();
+	}
+	for (auto& job : queue) {
+		job->state = ShaderJob::FAILED;
+	}
+	queue.clear();
+
+	for (auto& job : compiling) {
+		glDeleteShader(job->vertexShader);
+		glDeleteShader(job->fragmentShader);
+		glDeleteProgram(job->programID);
+		job->programID = 0;
+		job->state = ShaderJob::FAILED;
+	}
+	compiling.clear();
+	pendingJobs = 0;
+
+	if (sharedWindow != nullptr) {
+		glfwDestroyWindow(sharedWindow);
+		sharedWindow = nullptr;
+	}
+}
+
+ShaderCompiler& BackgroundShaders() {
+	static ShaderCompiler compiler;
+	return compiler;
+}
+
+ProgramFuture ShaderVariantCache::get(const char* vertex_file_path, const char* fragment_file_path, const ShaderDefines& defines) {
+	std::string key = std::string(vertex_file_path) + "|" + fragment_file_path;
+	for (const auto& define : defines) {
+		key += "|" + define.first + "=" + define.second;
+	}
+
+	auto found = programs.find(key);
+	if (found != programs.end()) {
+		return found->second;
+	}
+
+	std::string vertexCode = LoadShaderSource(vertex_file_path, defines);
+	std::string fragmentCode = LoadShaderSource(fragment_file_path, defines);
+	ProgramFuture future = BackgroundShaders().compile(key, vertexCode, fragmentCode);
+	programs.emplace(key, future);
+	return future;
+}
+
+void ShaderVariantCache::cleanup() {
+	// Call after BackgroundShaders().cleanup(), so no program is still being built
+	for (auto& program : programs) {
+		if (program.second.ready()) {
+			glDeleteProgram(program.second.get());
+		}
+	}
+	programs.clear();
+}
+
+ShaderVariantCache& ShaderVariants() {
+	static ShaderVariantCache cache;
+	return cache;
+}
@@ -0,0 +1,99 @@
+#ifndef _SHADER_COMPILER_H_
+#define _SHADER_COMPILER_H_
+
+#include "headers.h"
+#include "shader.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// One program being built; programID is written before state leaves PENDING
+struct ShaderJob {
+	enum State { PENDING, READY, FAILED };
+
+	std::string name;
+	std::string vertexCode, fragmentCode;
+	std::atomic<int> state{ PENDING };
+	GLuint programID = 0;
+
+	// Parallel compile only: objects the driver is still working on
+	GLuint vertexShader = 0, fragmentShader = 0;
+	std::string binaryKey;
+};
+
+// Handle to a program that may still be compiling
+struct ProgramFuture {
+	std::shared_ptr<ShaderJob> job;
+
+	bool valid() const { return job != nullptr; }
+	bool ready() const { return job != nullptr && job->state.load() == ShaderJob::READY; }
+	bool failed() const { return job == nullptr || job->state.load() == ShaderJob::FAILED; }
+
+	// The program once it is built, the fallback until then (or if it failed)
+	GLuint get(GLuint fallback = 0) const { return ready() ? job->programID : fallback; }
+};
+
+// Builds programs off the main thread's critical path, in the first way the driver supports:
+//   PARALLEL_EXTENSION  KHR/ARB_parallel_shader_compile; the driver compiles on its own threads
+//                       and update() polls for completion without blocking
+//   SHARED_CONTEXT      a worker thread compiles and links on a hidden window whose context
+//                       shares objects with the main one
+//   SYNCHRONOUS         compiled inside compile(), as before
+// The binary cache is tried first in every mode.
+struct ShaderCompiler {
+	enum Mode { SYNCHRONOUS, PARALLEL_EXTENSION, SHARED_CONTEXT };
+
+	typedef void (GLAD_API_PTR* MaxShaderCompilerThreadsProc)(GLuint);
+
+	Mode mode = SYNCHRONOUS;
+
+	// Parallel compile jobs submitted from the main thread and not yet complete
+	std::vector<std::shared_ptr<ShaderJob>> compiling;
+
+	// Shared-context worker
+	GLFWwindow* sharedWindow = nullptr;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::shared_ptr<ShaderJob>> queue;
+	bool stopping = false;
+
+	std::atomic<int> pendingJobs{ 0 };
+
+	// Call on the main thread with its context current, after GL is loaded
+	void initialize(GLFWwindow* mainWindow);
+
+	// Sources are complete (defines already injected)
+	ProgramFuture compile(const std::string& name, const std::string& vertexCode, const std::string& fragmentCode);
+
+	// Once per frame on the main thread; finishes parallel compile jobs that are done
+	void update();
+
+	int pending() const { return pendingJobs.load(); }
+
+	// Stops the worker; unfinished jobs fail and their programs are deleted
+	void cleanup();
+
+	void run();
+	void finishParallel(ShaderJob& job);
+};
+
+ShaderCompiler& BackgroundShaders();
+
+// Programs keyed by their files and definitions, so equal permutations are built once
+struct ShaderVariantCache {
+	std::unordered_map<std::string, ProgramFuture> programs;
+
+	// Built by BackgroundShaders()
+	ProgramFuture get(const char* vertex_file_path, const char* fragment_file_path, const ShaderDefines& defines);
+
+	void cleanup();
+};
+
+ShaderVariantCache& ShaderVariants();
+
+#endif
@@ -0,0 +1,40 @@
+#include "shadows.h"
+
+ShadowLight MakeShadowLight(const glm::mat4& lightSpaceMatrix, const glm::vec3& position, float radius) {
+	ShadowLight light;
+	light.frustum = ExtractFrustum(lightSpaceMatrix);
+	light.position = position;
+	light.radius = radius;
+	return light;
+}
+
+bool CastsShadow(const ShadowLight& light, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+	// The sphere is the tighter test for street lights, so it goes first
+	return BoxInSphere(boxMin, boxMax, light.position, light.radius) && BoxInFrustum(light.frustum, boxMin, boxMax);
+}
+
+void ShadowCasterList::upload() {
+	if (bufferID == 0) {
+		glGenBuffers(1, &bufferID);
+	}
+	if (staging.empty()) {
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+	if (staging.size() > capacity) {
+		// Reallocate buffer if needed
+		glBufferData(GL_ARRAY_BUFFER, staging.size(), staging.data(), GL_DYNAMIC_DRAW);
+		capacity = staging.size();
+	}
+	else {
+		glBufferSubData(GL_ARRAY_BUFFER, 0, staging.size(), staging.data());
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ShadowCasterList::cleanup() {
+	glDeleteBuffers(1, &bufferID);
+	bufferID = 0;
+	capacity = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _SHADOWS_H_
+#define _SHADOWS_H_
+
+#include "headers.h"
+#include "frustum.h"
+#include <cstring>
+
+// What one shadow layer needs drawn: casters inside the light's frustum and within the radius
+// around the light where model.frag looks up shadows. Anything outside either can't darken a lit
+// fragment, since the segment from a shadowed fragment to its light stays inside that sphere.
+struct ShadowLight {
+	Frustum frustum;
+	glm::vec3 position;
+	float radius;
+};
+
+ShadowLight MakeShadowLight(const glm::mat4& lightSpaceMatrix, const glm::vec3& position, float radius);
+
+bool CastsShadow(const ShadowLight& light, const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+// One object's shadow casters for every layer, compacted into a single instance buffer that is
+// uploaded once per frame: layer i draws ranges[i].count instances from ranges[i].first.
+struct ShadowCasterList {
+	struct Range {
+		GLint first = 0;
+		GLsizei count = 0;
+	};
+
+	GLuint bufferID = 0;
+	size_t capacity = 0;	// In bytes
+	std::vector<Range> ranges;
+	std::vector<unsigned char> staging;
+	std::vector<glm::vec3> boundsMin, boundsMax;
+
+	// bounds(instance, min, max) gives the world box of an instance
+	template <typename Instance, typename Bounds>
+	void update(const std::vector<Instance>& instances, const std::vector<ShadowLight>& lights, Bounds bounds) {
+		boundsMin.resize(instances.size());
+		boundsMax.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); ++i) {
+			bounds(instances[i], boundsMin[i], boundsMax[i]);
+		}
+
+		staging.clear();
+		ranges.assign(lights.size(), Range());
+		for (size_t layer = 0; layer < lights.size(); ++layer) {
+			ranges[layer].first = static_cast<GLint>(staging.size() / sizeof(Instance));
+			for (size_t i = 0; i < instances.size(); ++i) {
+				if (!CastsShadow(lights[layer], boundsMin[i], boundsMax[i])) continue;
+				size_t offset = staging.size();
+				staging.resize(offset + sizeof(Instance));
+				std::memcpy(&staging[offset], &instances[i], sizeof(Instance));
+				ranges[layer].count++;
+			}
+		}
+		upload();
+	}
+
+	void upload();
+
+	void cleanup();
+};
+
+#endif
@@ -8,11 +8,23 @@
 #endif
 #include <stb/stb_image.h>
 
-GLuint LoadTextureTileBox(const char* texture_file_path) {
-	int w, h, channels;
-	uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
-	GLuint texture;
-	glGenTextures(1, &texture);
+bool DecodeImage(const char* texture_file_path, int channels, ImageData& image) {
+	int w, h, fileChannels;
+	uint8_t* img = stbi_load(texture_file_path, &w, &h, &fileChannels, channels);
+	if (!img) {
+		std::cout << "Failed to load texture " << texture_file_path << std::endl;
+		return false;
+	}
+	image.width = w;
+	image.height = h;
+	image.layers = 1;
+	image.channels = channels;
+	image.pixels.assign(img, img + w * h * channels);
+	stbi_image_free(img);
+	return true;
+}
+
+void UploadTextureTileBox(GLuint texture, const ImageData& image) {
 	glBindTexture(GL_TEXTURE_2D, texture);
 
 	// To tile textures on a box, we set wrapping to repeat
@@ -21,14 +33,166 @@ GLuint LoadTextureTileBox(const char* texture_file_path) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	if (img) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+	if (!image.pixels.empty()) {
+		GLenum format = image.channels == 4 ? GL_RGBA : GL_RGB;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		glGenerateMipmap(GL_TEXTURE_2D);
 	}
-	else {
-		std::cout << "Failed to load texture " << texture_file_path << std::endl;
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLuint LoadTextureTileBox(const char* texture_file_path) {
+	ImageData image;
+	DecodeImage(texture_file_path, 3, image);
+	GLuint texture;
+	glGenTextures(1, &texture);
+	UploadTextureTileBox(texture, image);
+	return texture;
+}
+
+// Box-filter (or point-sample for non-integer ratios) an RGB image down to size x size
+static std::vector<uint8_t> ResampleLayer(const uint8_t* img, int w, int h, int size) {
+	std::vector<uint8_t> layer(size * size * 3);
+	int fx = std::max(1, w / size);
+	int fy = std::max(1, h / size);
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			int sx = x * w / size;
+			int sy = y * h / size;
+			for (int c = 0; c < 3; ++c) {
+				int sum = 0;
+				for (int j = 0; j < fy; ++j) {
+					for (int i = 0; i < fx; ++i) {
+						sum += img[((sy + j) * w + (sx + i)) * 3 + c];
+					}
+				}
+				layer[(y * size + x) * 3 + c] = static_cast<uint8_t>(sum / (fx * fy));
+			}
+		}
 	}
-	stbi_image_free(img);
+	return layer;
+}
+
+ImageData DecodeTextureArray(const std::vector<const char*>& texture_file_paths) {
+	// Every layer takes the size of the first texture; larger textures are filtered down to it
+	int size = 0;
+	std::vector<std::vector<uint8_t>> layers;
+	for (const char* path : texture_file_paths) {
+		int w, h, channels;
+		uint8_t* img = stbi_load(path, &w, &h, &channels, 3);
+		if (!img) {
+			std::cout << "Failed to load texture " << path << std::endl;
+			w = h = std::max(size, 1);
+			layers.push_back(std::vector<uint8_t>(w * h * 3, 255));
+		}
+		else {
+			if (size == 0) size = w;
+			if (w == size && h == size) layers.push_back(std::vector<uint8_t>(img, img + w * h * 3));
+			else layers.push_back(ResampleLayer(img, w, h, size));
+		}
+		stbi_image_free(img);
+	}
+	if (size == 0) size = 1;
 
+	ImageData array;
+	array.width = array.height = size;
+	array.layers = layers.size();
+	array.channels = 3;
+	for (auto& layer : layers) {
+		if (layer.size() != static_cast<size_t>(size * size * 3)) layer = ResampleLayer(layer.data(), 1, 1, size);
+		array.pixels.insert(array.pixels.end(), layer.begin(), layer.end());
+	}
+	return array;
+}
+
+// Each texel averages the 2x2 block above it; odd rows and columns fold into their neighbours
+static void DownsampleLevel(const uint8_t* src, int w, int h, int channels, uint8_t* dst) {
+	int dw = PackageMipExtent(w), dh = PackageMipExtent(h);
+	for (int y = 0; y < dh; ++y) {
+		int y0 = std::min(y * 2, h - 1), y1 = std::min(y * 2 + 1, h - 1);
+		for (int x = 0; x < dw; ++x) {
+			int x0 = std::min(x * 2, w - 1), x1 = std::min(x * 2 + 1, w - 1);
+			for (int c = 0; c < channels; ++c) {
+				int sum = src[(y0 * w + x0) * channels + c] + src[(y0 * w + x1) * channels + c] +
+					src[(y1 * w + x0) * channels + c] + src[(y1 * w + x1) * channels + c];
+				dst[(y * dw + x) * channels + c] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+std::vector<uint8_t> BuildMipChain(const ImageData& image, int& levels) {
+	std::vector<uint8_t> chain(image.pixels);
+	levels = image.pixels.empty() ? 0 : 1;
+	int w = image.width, h = image.height;
+	size_t levelStart = 0;
+	while (levels > 0 && (w > 1 || h > 1)) {
+		int dw = PackageMipExtent(w), dh = PackageMipExtent(h);
+		size_t layerBytes = static_cast<size_t>(w) * h * image.channels;
+		size_t nextLayerBytes = static_cast<size_t>(dw) * dh * image.channels;
+		size_t nextStart = chain.size();
+		chain.resize(nextStart + nextLayerBytes * image.layers);
+		for (int layer = 0; layer < image.layers; ++layer) {
+			DownsampleLevel(&chain[levelStart + layer * layerBytes], w, h, image.channels, &chain[nextStart + layer * nextLayerBytes]);
+		}
+		levelStart = nextStart;
+		w = dw;
+		h = dh;
+		levels++;
+	}
+	return chain;
+}
+
+void UploadTextureArray(GLuint texture, const ImageData& layers) {
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+	// To tile textures on a box, we set wrapping to repeat
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, layers.width, layers.height, layers.layers, 0, GL_RGB, GL_UNSIGNED_BYTE, layers.pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void UploadCookedTexture(GLuint texture, GLenum target, const PackageTexture& cooked, const uint8_t* pixels) {
+	glBindTexture(target, texture);
+
+	// To tile textures on a box, we set wrapping to repeat
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, cooked.levels > 0 ? cooked.levels - 1 : 0);
+
+	GLenum format = cooked.channels == 4 ? GL_RGBA : GL_RGB;
+	GLsizei w = cooked.width, h = cooked.height;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (GLint level = 0; level < static_cast<GLint>(cooked.levels); ++level) {
+		if (target == GL_TEXTURE_2D_ARRAY) {
+			glTexImage3D(target, level, format, w, h, cooked.layers, 0, format, GL_UNSIGNED_BYTE, pixels);
+		}
+		else {
+			glTexImage2D(target, level, format, w, h, 0, format, GL_UNSIGNED_BYTE, pixels);
+		}
+		pixels += static_cast<size_t>(w) * h * cooked.layers * cooked.channels;
+		w = PackageMipExtent(w);
+		h = PackageMipExtent(h);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(target, 0);
+}
+
+GLuint LoadTextureArray(const std::vector<const char*>& texture_file_paths) {
+	ImageData layers = DecodeTextureArray(texture_file_paths);
+	GLuint texture;
+	glGenTextures(1, &texture);
+	UploadTextureArray(texture, layers);
 	return texture;
-}
\ No newline at end of file
+}
@@ -2,7 +2,34 @@
 #define _TEXTURE_H_
 
 #include "headers.h"
+#include "package.h"
+
+// Decoded pixels, tightly packed; a texture array stores its layers one after another
+struct ImageData {
+	int width = 0;
+	int height = 0;
+	int layers = 0;
+	int channels = 0;
+	std::vector<uint8_t> pixels;
+};
+
+// The decode halves touch no GL state, so they can run on any thread
+bool DecodeImage(const char* texture_file_path, int channels, ImageData& image);
+
+ImageData DecodeTextureArray(const std::vector<const char*>& texture_file_paths);
+
+// Every mip level of the image down to 1x1, box filtered, laid out as PackageTexture describes
+std::vector<uint8_t> BuildMipChain(const ImageData& image, int& levels);
+
+void UploadTextureTileBox(GLuint texture, const ImageData& image);
+
+void UploadTextureArray(GLuint texture, const ImageData& layers);
+
+// Repeat-wrapped like the decoded textures, with the cooked mip chain in place of glGenerateMipmap
+void UploadCookedTexture(GLuint texture, GLenum target, const PackageTexture& cooked, const uint8_t* pixels);
 
 GLuint LoadTextureTileBox(const char* texture_file_path);
 
+GLuint LoadTextureArray(const std::vector<const char*>& texture_file_paths);
+
 #endif
\ No newline at end of file
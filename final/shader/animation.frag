@@ -1,13 +1,12 @@
 #version 330 core
 
 in vec3 worldPosition;
-in vec3 worldNormal; 
-in mat4 modelMatrix;
+in vec3 lightVector;
+in vec3 modelNormal;
 in vec2 uv;
 
 out vec4 finalColor;
 
-uniform vec3 lightPosition;
 uniform vec3 lightIntensity;
 uniform vec3 cameraPosition;
 uniform sampler2D textureSampler;
@@ -19,10 +18,9 @@ const vec4 FOG_COLOUR = vec4(0.004f, 0.02f, 0.05f, 0.0);
 void main()
 {
 	// Lighting
-	vec3 lightDir = lightPosition - worldPosition;
-	float lightDist = dot(lightDir, lightDir);
-	lightDir = normalize(lightDir);
-	vec3 v = lightIntensity * clamp(dot(lightDir, worldNormal), 0.0, 1.0) / lightDist;
+	float lightDist = dot(lightVector, lightVector);
+	vec3 lightDir = lightVector * inversesqrt(lightDist);
+	vec3 v = lightIntensity * clamp(dot(lightDir, modelNormal), 0.0, 1.0) / lightDist;
 
 	// Tone mapping
 	v = v / (1.0 + v);
@@ -31,8 +29,7 @@ void main()
 	vec4 fragColor = texture(textureSampler, uv) * vec4(pow(v, vec3(1.0 / 2.2)), 1.0);
 
 	// Fogging
-	vec3 fragPosition = vec3(modelMatrix * vec4(worldPosition, 1.0));
-    float distanceToCamera = length(fragPosition - cameraPosition);
+    float distanceToCamera = length(worldPosition - cameraPosition);
     float fogFactor = smoothstep(FOG_MIN_DIST, FOG_MAX_DIST, distanceToCamera);
 
 	finalColor = mix(fragColor, FOG_COLOUR, fogFactor);
@@ -14,12 +14,13 @@ layout(location = 5) in mat4 instanceMatrix;
 
 // Output data, to be interpolated for each fragment
 out vec3 worldPosition;
-out vec3 worldNormal;
-out mat4 modelMatrix;
+out vec3 lightVector;	// From the vertex to the light, in the model's own frame
+out vec3 modelNormal;
 out vec2 uv;
 
 uniform mat4 MVP;
 uniform mat4 jointMatrices[25];
+uniform vec3 lightPosition;	// Relative to each instance, so every model carries its own light
 
 void main() {
     // Skinning Matrix
@@ -30,12 +31,13 @@ void main() {
         weight.w * jointMatrices[int(joint.w)];
 
     // Transform vertex using skinning matrix
-    gl_Position =  MVP * instanceMatrix * skinMatrix * vec4(vertexPosition, 1.0);
+    vec4 skinnedPosition = skinMatrix * vec4(vertexPosition, 1.0);
+    gl_Position =  MVP * instanceMatrix * skinnedPosition;
 
-    // World-space geometry (apply correct lighting using skinning matrix)
-    worldPosition = (skinMatrix * vec4(vertexPosition, 1.0)).xyz;
+    // Lighting happens in the skinned model's frame; only fog needs the world position
+    worldPosition = (instanceMatrix * skinnedPosition).xyz;
+    lightVector = lightPosition - skinnedPosition.xyz;
     mat3 skinRotation = mat3(skinMatrix);
-    worldNormal = normalize(skinRotation * vertexNormal);
-    modelMatrix = instanceMatrix;
+    modelNormal = normalize(skinRotation * vertexNormal);
     uv = vertexUV;
 }
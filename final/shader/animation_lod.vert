@@ -0,0 +1,45 @@
+#version 330 core
+
+// Distant variant of animation.vert: rigid skinning to the most influential joint only
+
+// Input
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec2 vertexUV;
+
+// Joints and Weights 
+layout(location = 3) in vec4 joint;
+layout(location = 4) in vec4 weight;
+
+// Instance Matrix
+layout(location = 5) in mat4 instanceMatrix;
+
+// Output data, to be interpolated for each fragment
+out vec3 worldPosition;
+out vec3 lightVector;	// From the vertex to the light, in the model's own frame
+out vec3 modelNormal;
+out vec2 uv;
+
+uniform mat4 MVP;
+uniform mat4 jointMatrices[25];
+uniform vec3 lightPosition;	// Relative to each instance, so every model carries its own light
+
+void main() {
+    // Pick the dominant joint
+    float j = weight.x >= weight.y ? joint.x : joint.y;
+    float w = max(weight.x, weight.y);
+    j = weight.z > w ? joint.z : j;
+    w = max(w, weight.z);
+    j = weight.w > w ? joint.w : j;
+    mat4 skinMatrix = jointMatrices[int(j)];
+
+    // Transform vertex using skinning matrix
+    vec4 skinnedPosition = skinMatrix * vec4(vertexPosition, 1.0);
+    gl_Position = MVP * instanceMatrix * skinnedPosition;
+
+    // Lighting happens in the skinned model's frame (normals are left unnormalised at this distance)
+    worldPosition = (instanceMatrix * skinnedPosition).xyz;
+    lightVector = lightPosition - skinnedPosition.xyz;
+    modelNormal = mat3(skinMatrix) * vertexNormal;
+    uv = vertexUV;
+}
@@ -2,6 +2,5 @@
 
 void main()
 {
-    // No colour needed, only depth
-    gl_FragDepth = gl_FragCoord.z;
+    // No colour needed, only depth; leaving gl_FragDepth alone keeps early depth testing
 }
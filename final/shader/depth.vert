@@ -5,6 +5,9 @@ layout(location = 3) in mat4 instanceMatrix;
 
 uniform mat4 lightSpace;
 
+// The depth prepass must produce exactly the depth the lit pass compares against
+invariant gl_Position;
+
 void main()
 {
     // Transform the vertex position to light space
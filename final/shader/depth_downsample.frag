@@ -0,0 +1,21 @@
+#version 330 core
+
+in vec2 uv;
+
+uniform sampler2D depthTexture;
+uniform int factor;
+
+void main()
+{
+	// Farthest depth of the full-resolution block under this texel, so particles behind thin
+	// foreground detail survive and are rejected per pixel when upsampled
+	ivec2 base = ivec2(gl_FragCoord.xy) * factor;
+	ivec2 maxTexel = textureSize(depthTexture, 0) - 1;
+	float depth = 0.0;
+	for (int y = 0; y < factor; ++y) {
+		for (int x = 0; x < factor; ++x) {
+			depth = max(depth, texelFetch(depthTexture, min(base + ivec2(x, y), maxTexel), 0).r);
+		}
+	}
+	gl_FragDepth = depth;
+}
@@ -0,0 +1,19 @@
+#version 330 core
+
+// Flat, dim surfaces fading into the fog, so geometry is in place before its real shader is ready
+
+in float distanceToCamera;
+
+uniform vec4 baseColorFactor;
+
+out vec4 finalColor;
+
+const float FOG_MIN_DIST = 1024;
+const float FOG_MAX_DIST = 2048;
+const vec4 FOG_COLOUR = vec4(0.004f, 0.02f, 0.05f, 0.0);
+
+void main()
+{
+    float fogFactor = smoothstep(FOG_MIN_DIST, FOG_MAX_DIST, distanceToCamera);
+    finalColor = mix(vec4(baseColorFactor.rgb * 0.1, 1.0), FOG_COLOUR, fogFactor);
+}
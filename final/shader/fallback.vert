@@ -0,0 +1,20 @@
+#version 330 core
+
+// Stands in for a model.vert variant that is still being compiled
+
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 3) in mat4 instanceMatrix;
+
+out float distanceToCamera;
+
+uniform mat4 camera;
+
+// Must match the depth prepass (depth.vert)
+invariant gl_Position;
+
+void main() {
+    gl_Position = camera * instanceMatrix * vec4(vertexPosition, 1);
+
+    // Clip-space w is the view depth
+    distanceToCamera = gl_Position.w;
+}
@@ -1,95 +1,146 @@
 #version 330 core
 
+// Compiled per material feature set (see ProgramVariants); the host injects after #version:
+//   MAX_LIGHTS, FOG_MIN_DIST, FOG_MAX_DIST  scene constants
+//   SHADOWS            sample the shadow map array
+//   VERTEX_SHADOW_LIGHTS  lights whose light-space position comes from model.vert
+//   UNLIT              emissive surfaces such as lamp bulbs (KHR_materials_unlit)
+//   TRANSPARENT        weighted blended OIT output for the transparent pass
+//   INSTANCE_MATERIAL  texture array layer and tiling come from each instance
+
 in vec3 worldPosition;
 in vec3 worldNormal;
 in vec2 uv;
-in mat4 modelMatrix;
+#if INSTANCE_MATERIAL
+flat in int textureLayer;
 
+uniform sampler2DArray textureArray;
+#else
 uniform sampler2D textureSampler;
+#endif
 uniform vec4 baseColorFactor;
-uniform int isLight;
 
-out vec4 finalColor;
+layout(location = 0) out vec4 finalColor;
+#if TRANSPARENT
+layout(location = 1) out vec4 weight;
+#endif
 
-const int MAX_LIGHTS = 9;
-const float FOG_MIN_DIST = 1024;
-const float FOG_MAX_DIST = 2048;
 const vec4 FOG_COLOUR = vec4(0.004f, 0.02f, 0.05f, 0.0);
 
 uniform int lightCount;
 uniform vec3 lightPositions[MAX_LIGHTS];
 uniform vec3 lightIntensities[MAX_LIGHTS];
 uniform float lightExposures[MAX_LIGHTS];
-uniform sampler2DArray shadowMapArray;
-uniform mat4 lightSpaceMatrices[MAX_LIGHTS];
 uniform vec3 cameraPosition;
 
-void main()
-{
-    if (isLight == 0) {
-        vec3 normal = normalize(worldNormal);
-        vec3 fragPosition = vec3(modelMatrix * vec4(worldPosition, 1.0));
-        vec3 finalLighting = vec3(0.0);
-
-        // Accumulate lighting for each light in the scene
-        for (int i = 0; i < lightCount; ++i) {
-            
-            // Attenuation to give a nice radius of light around lamps
-            vec3 lightDirection = normalize(lightPositions[i] - fragPosition);
-            float distance = length(lightPositions[i] - fragPosition);
-            float attenuation = 1.0f;
-            float threshold = 300.0f;
-            if (distance > threshold) {
-                float k1 = 0.001f;
-                float k2 = 0.0002f;
-                attenuation = 1.0f / (1.0f + k1 * (distance - threshold) + k2 * pow(distance - threshold, 2));
-            }
+#if SHADOWS
+#if VERTEX_SHADOW_LIGHTS > 0
+in vec4 lightSpacePositions[VERTEX_SHADOW_LIGHTS];
+#endif
+
+uniform sampler2DArrayShadow shadowMapArray;
+uniform mat4 lightSpaceMatrices[MAX_LIGHTS];
 
-            float diff = max(dot(normal, lightDirection), 0.0);
-            vec3 diffuse = diff * lightIntensities[i] * attenuation;
-
-            // If the fragment is too far from the light source, skip the shadow logic
-            if (distance <= FOG_MIN_DIST/2) {
-                vec4 fragPosLightSpace = lightSpaceMatrices[i] * vec4(worldPosition, 1.0);
-                vec3 lightCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-                lightCoords = lightCoords * 0.5 + 0.5;
-
-                float shadow;
-                if (lightCoords.x < 0.0 || lightCoords.x > 1.0 ||
-                    lightCoords.z < 0.0 || lightCoords.z > 1.0 ||
-                    lightCoords.y > 1.0) {
-                    shadow = 1.0;
-                }
-                else {
-                    vec3 coord = vec3(1-lightCoords.x * 1.003, lightCoords.z * 1.022, i);
-                    float closestDepth = pow(texture(shadowMapArray, coord).r, 50);
-                    float bias = max(0.05 * (1.0 - dot(normal, lightDirection)), 0.005);
-                    shadow = lightCoords.z - bias >= closestDepth ? 0.2 : 1.0;
-                }
-                diffuse *= shadow;
+// 0 = one hardware-filtered tap (2x2 texels), 1 = fixed 3x3 grid of them
+uniform int shadowKernel;
+
+// Fraction of light i reaching a world position; out of the light's view counts as lit
+float shadowFactor(int i, vec3 position) {
+    // Lights past those interpolated from the vertex stage are projected here
+    vec4 fragPosLightSpace;
+#if VERTEX_SHADOW_LIGHTS > 0
+    if (i < VERTEX_SHADOW_LIGHTS) fragPosLightSpace = lightSpacePositions[i];
+    else
+#endif
+    fragPosLightSpace = lightSpaceMatrices[i] * vec4(position, 1.0);
+    vec3 lightCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+    if (fragPosLightSpace.w <= 0.0 || any(lessThan(lightCoords, vec3(0.0))) || any(greaterThan(lightCoords, vec3(1.0)))) {
+        return 1.0;
+    }
+
+    // The comparison and bilinear filtering of its results happen in the sampler; the depth bias
+    // is applied as a polygon offset when the map is drawn
+    float lit;
+    if (shadowKernel == 0) {
+        lit = texture(shadowMapArray, vec4(lightCoords.xy, i, lightCoords.z));
+    }
+    else {
+        vec2 texel = 1.0 / vec2(textureSize(shadowMapArray, 0).xy);
+        lit = 0.0;
+        for (int x = -1; x <= 1; ++x) {
+            for (int y = -1; y <= 1; ++y) {
+                lit += texture(shadowMapArray, vec4(lightCoords.xy + vec2(x, y) * texel, i, lightCoords.z));
             }
-            finalLighting += diffuse * lightExposures[i];
         }
-        
-        // Apply accumulated lighting and texture
-        vec3 exposedColor = finalLighting;
-        vec3 toneMappedColor = exposedColor / (exposedColor + vec3(1.0));
-        vec4 baseColor = texture(textureSampler, uv).rgba * baseColorFactor;
-        vec4 fragColor = vec4(pow(toneMappedColor, vec3(1.0 / 2.2)), 1.0) * baseColor;
-
-        // Apply fog
-        float distanceToCamera = length(fragPosition - cameraPosition);
-        float fogFactor = smoothstep(FOG_MIN_DIST, FOG_MAX_DIST, distanceToCamera);
-        finalColor = mix(fragColor, FOG_COLOUR, fogFactor);
-
-        // If fragment is glass add a yellow tint
-        if (baseColorFactor.a < 1.0) finalColor = vec4(mix(finalColor.rgb, vec3(1.0, 1.0, 0.0), 0.5), finalColor.a);
+        lit /= 9.0;
     }
-    else {
-        // If the fragment is a light, it should be solid yellow
-        vec3 fragPosition = vec3(modelMatrix * vec4(worldPosition, 1.0));
-        float distanceToCamera = length(fragPosition - cameraPosition);
-        float fogFactor = smoothstep(FOG_MIN_DIST, FOG_MAX_DIST, distanceToCamera);
-        finalColor = mix(vec4(1.0, 1.0, 0.0, baseColorFactor.a), FOG_COLOUR, fogFactor);
+    return mix(0.2, 1.0, lit);
+}
+#endif
+
+void main()
+{
+    vec3 fragPosition = worldPosition;
+    float distanceToCamera = length(fragPosition - cameraPosition);
+    float fogFactor = smoothstep(FOG_MIN_DIST, FOG_MAX_DIST, distanceToCamera);
+
+#if UNLIT
+    // Lights are solid yellow
+    finalColor = mix(vec4(1.0, 1.0, 0.0, baseColorFactor.a), FOG_COLOUR, fogFactor);
+#else
+    vec3 normal = normalize(worldNormal);
+    vec3 finalLighting = vec3(0.0);
+
+    // Accumulate lighting for each light in the scene
+    for (int i = 0; i < lightCount; ++i) {
+        
+        // Attenuation to give a nice radius of light around lamps
+        vec3 lightDirection = normalize(lightPositions[i] - fragPosition);
+        float distance = length(lightPositions[i] - fragPosition);
+        float attenuation = 1.0f;
+        float threshold = 300.0f;
+        if (distance > threshold) {
+            float k1 = 0.001f;
+            float k2 = 0.0002f;
+            attenuation = 1.0f / (1.0f + k1 * (distance - threshold) + k2 * pow(distance - threshold, 2));
+        }
+
+        float diff = max(dot(normal, lightDirection), 0.0);
+        vec3 diffuse = diff * lightIntensities[i] * attenuation;
+
+#if SHADOWS
+        // If the fragment is too far from the light source, skip the shadow logic
+        if (distance <= FOG_MIN_DIST/2) {
+            diffuse *= shadowFactor(i, fragPosition);
+        }
+#endif
+        finalLighting += diffuse * lightExposures[i];
     }
+    
+    // Apply accumulated lighting and texture
+    vec3 exposedColor = finalLighting;
+    vec3 toneMappedColor = exposedColor / (exposedColor + vec3(1.0));
+#if INSTANCE_MATERIAL
+    vec4 texColor = texture(textureArray, vec3(uv, textureLayer));
+#else
+    vec4 texColor = texture(textureSampler, uv);
+#endif
+    vec4 baseColor = texColor * baseColorFactor;
+    vec4 fragColor = vec4(pow(toneMappedColor, vec3(1.0 / 2.2)), 1.0) * baseColor;
+
+    // Apply fog
+    finalColor = mix(fragColor, FOG_COLOUR, fogFactor);
+
+#if TRANSPARENT
+    // Glass gets a yellow tint
+    finalColor = vec4(mix(finalColor.rgb, vec3(1.0, 1.0, 0.0), 0.5), finalColor.a);
+#endif
+#endif
+
+#if TRANSPARENT
+    // Nearer surfaces dominate the weighted average
+    float w = finalColor.a * clamp(0.03 / (1e-5 + pow(distanceToCamera / 2000.0, 4.0)), 1e-2, 3e3);
+    finalColor = vec4(finalColor.rgb * w, finalColor.a);
+    weight = vec4(w);
+#endif
 }
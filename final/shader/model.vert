@@ -5,25 +5,55 @@ layout(location = 0) in vec3 vertexPosition;
 layout(location = 1) in vec3 vertexNormal;
 layout(location = 2) in vec2 vertexUV;
 layout(location = 3) in mat4 instanceMatrix;
+#if INSTANCE_MATERIAL
+layout(location = 7) in vec4 instanceMaterial;	// x = texture array layer + 1, y = UV scale, z = UV height
+#endif
 
 // Output data, to be interpolated for each fragment
 out vec3 worldPosition;
 out vec3 worldNormal;
 out vec2 uv;
-out mat4 modelMatrix;
+#if INSTANCE_MATERIAL
+flat out int textureLayer;
+#endif
+#if SHADOWS && VERTEX_SHADOW_LIGHTS > 0
+// Clip-space position seen from each of the first lights; affine in world position, so it
+// interpolates exactly and the fragment shader only divides
+out vec4 lightSpacePositions[VERTEX_SHADOW_LIGHTS];
+
+uniform mat4 lightSpaceMatrices[MAX_LIGHTS];
+#endif
 
 // Matrices for vertex transformation
 uniform mat4 camera;
 
+// Must match the depth prepass (depth.vert)
+invariant gl_Position;
+
 void main() {
     // Transform vertex
     gl_Position = camera * instanceMatrix * vec4(vertexPosition, 1);
 
-    // World-space geometry 
-    worldPosition = vertexPosition;
-    worldNormal = vertexNormal;
-    modelMatrix = instanceMatrix;
+    // World-space geometry. Normals go through the cofactor matrix, which keeps them perpendicular
+    // under non-uniform scale like the inverse transpose (up to a length the fragment shader
+    // normalises away) but stays defined when an axis is scaled to zero, as the ground tiles are
+    vec4 position = instanceMatrix * vec4(vertexPosition, 1);
+    worldPosition = position.xyz;
+    mat3 m = mat3(instanceMatrix);
+    mat3 cofactor = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+    worldNormal = cofactor * vertexNormal;
+
+#if SHADOWS && VERTEX_SHADOW_LIGHTS > 0
+    for (int i = 0; i < VERTEX_SHADOW_LIGHTS; ++i) {
+        lightSpacePositions[i] = lightSpaceMatrices[i] * position;
+    }
+#endif
 
-    // Pass UV to the fragment shader
+    // Pass UV to the fragment shader, tiled per instance when drawing from the texture array
+#if INSTANCE_MATERIAL
+    textureLayer = int(instanceMaterial.x) - 1;
+    uv = vertexUV * vec2(instanceMaterial.y, instanceMaterial.y * instanceMaterial.z);
+#else
     uv = vertexUV;
-}
\ No newline at end of file
+#endif
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+layout(location = 0) in vec3 vertexPosition;
+
+// Camera matrix times the tile's bounding box transform
+uniform mat4 boxMatrix;
+
+void main()
+{
+    gl_Position = boxMatrix * vec4(vertexPosition, 1.0);
+}
@@ -1,14 +1,14 @@
 #version 330 core
 
-in vec3 worldPosition;
-in mat4 modelMatrix;
-in vec3 cameraPosition;
 in vec2 uv;
 in float alpha;
+in float distanceToCamera;
 
 uniform sampler2D textureSampler;
 
-out vec4 finalColor;
+// Weighted blended OIT targets (see transparency.cpp)
+layout(location = 0) out vec4 accum;
+layout(location = 1) out vec4 weight;
 
 const float FOG_MIN_DIST = 1024;
 const float FOG_MAX_DIST = 2048;
@@ -17,8 +17,6 @@ const vec4 FOG_COLOUR = vec4(0.004f, 0.02f, 0.05f, 0.0);
 void main()
 {
     // Fogging
-    vec3 fragPosition = vec3(modelMatrix * vec4(worldPosition, 1.0));
-    float distanceToCamera = length(fragPosition - cameraPosition);
     float fogFactor = smoothstep(FOG_MIN_DIST, FOG_MAX_DIST, distanceToCamera);
 
     // Texture (use instance alpha)
@@ -30,5 +28,10 @@ void main()
         discard;
     }
 
-    finalColor = mix(fragColor, FOG_COLOUR, fogFactor);
+    vec4 colour = mix(fragColor, FOG_COLOUR, fogFactor);
+
+    // Nearer surfaces dominate the weighted average
+    float w = colour.a * clamp(0.03 / (1e-5 + pow(distanceToCamera / 2000.0, 4.0)), 1e-2, 3e3);
+    accum = vec4(colour.rgb * w, colour.a);
+    weight = vec4(w);
 }
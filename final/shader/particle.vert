@@ -1,22 +1,31 @@
 #version 330 core
 
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in float instanceAlpha;
 layout(location = 2) in vec2 vertexUV;
-layout(location = 3) in mat4 instanceMatrix;
+layout(location = 3) in vec4 instancePositionAlpha;	// xyz = position, w = alpha
 
-out vec3 worldPosition;
-out mat4 modelMatrix;
-out vec3 cameraPosition;
 out vec2 uv;
 out float alpha;
+out float distanceToCamera;	// Close enough to linear across a particle to interpolate
 
 uniform mat4 cameraMVP;
 uniform vec3 cameraPos;
+uniform float emitterScales[16];	// Particle size, grown as live counts are reduced
+uniform int particlesPerEmitter;
+uniform int firstParticle;			// Pool index of instance 0
 
 void main() {
+	// Particles of freed blocks have zero alpha and collapse to a degenerate triangle
+	if (instancePositionAlpha.w <= 0.0) {
+		gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+		uv = vertexUV;
+		alpha = 0.0;
+		distanceToCamera = 0.0;
+		return;
+	}
+
 	// Compute rotation matrix to ensure vertex faces the camera
-    vec3 position = vec3(instanceMatrix[3]);
+    vec3 position = instancePositionAlpha.xyz;
 	vec3 toCamera = normalize(cameraPos - position);
 	vec3 up = vec3(0.0, 1.0, 0.0);
 	vec3 right = normalize(cross(up, toCamera));
@@ -25,12 +34,13 @@ void main() {
 	rotationMatrix[0] = vec4(right, 0.0f);
 	rotationMatrix[1] = vec4(up, 0.0f);
 	rotationMatrix[2] = vec4(toCamera, 0.0f);
+	rotationMatrix[3] = vec4(position, 1.0f);
 
-    gl_Position = cameraMVP * instanceMatrix * rotationMatrix * vec4(vertexPosition, 1);
+	vec3 scaledPosition = vertexPosition * emitterScales[(firstParticle + gl_InstanceID) / particlesPerEmitter];
+	vec4 worldPosition = rotationMatrix * vec4(scaledPosition, 1);
+    gl_Position = cameraMVP * worldPosition;
 
-	worldPosition = vertexPosition;
-	modelMatrix = instanceMatrix * rotationMatrix;
-	cameraPosition = cameraPos;
     uv = vertexUV;
-	alpha = instanceAlpha;
+	alpha = instancePositionAlpha.w;
+	distanceToCamera = length(worldPosition.xyz - cameraPos);
 }
\ No newline at end of file
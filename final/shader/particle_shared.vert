@@ -0,0 +1,69 @@
+#version 330 core
+
+// Shared-simulation particles: the instances are one canonical field from the GPU simulation
+// (see particle_update.vert) and the mesh holds one quad per lamp drawing that field
+
+layout(location = 3) in vec4 positionSpeed;
+layout(location = 4) in vec3 lifeAgeSeed;
+
+out vec2 uv;
+out float alpha;
+out float distanceToCamera;	// Close enough to linear across a particle to interpolate
+
+uniform mat4 cameraMVP;
+uniform vec3 cameraPos;
+uniform vec4 placements[16];	// x, y = lamp position on the ground, z = rotation, w = phase
+uniform vec2 placementLODs[16];	// x = live particles, y = particle size
+
+const vec2 corners[4] = vec2[4](vec2(-0.5, -0.5), vec2(0.5, -0.5), vec2(0.5, 0.5), vec2(-0.5, 0.5));
+
+void main() {
+	vec3 vertexPosition = vec3(corners[gl_VertexID % 4], 0.0);
+	vec2 vertexUV = corners[gl_VertexID % 4] + 0.5;
+	vec4 placement = placements[gl_VertexID / 4];
+	vec2 lod = placementLODs[gl_VertexID / 4];
+	vertexPosition *= lod.y;
+
+	// Particles that have not spawned yet or are past this lamp's live count collapse to a degenerate triangle
+	float lifetime = lifeAgeSeed.x;
+	if (lifetime <= 0.0 || float(gl_InstanceID) >= lod.x) {
+		gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+		uv = vertexUV;
+		alpha = 0.0;
+		distanceToCamera = 0.0;
+		return;
+	}
+
+	// Shift the particle along its own life so lamps sharing a field are out of step
+	float age = mod(lifeAgeSeed.y + placement.w * lifetime, lifetime);
+	vec3 local = positionSpeed.xyz;
+	local.y += (age - lifeAgeSeed.y) * positionSpeed.w;
+
+	// Rotate the field about the lamp and move it into place
+	float c = cos(placement.z);
+	float s = sin(placement.z);
+	vec3 position = vec3(placement.x + c * local.x - s * local.z, local.y, placement.y + s * local.x + c * local.z);
+
+	// Compute rotation matrix to ensure vertex faces the camera
+	vec3 toCamera = normalize(cameraPos - position);
+	vec3 up = vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(up, toCamera));
+	up = cross(toCamera, right);
+	mat4 instanceMatrix = mat4(1.0f);
+	instanceMatrix[0] = vec4(right, 0.0f);
+	instanceMatrix[1] = vec4(up, 0.0f);
+	instanceMatrix[2] = vec4(toCamera, 0.0f);
+	instanceMatrix[3] = vec4(position, 1.0f);
+
+	vec4 worldPosition = instanceMatrix * vec4(vertexPosition, 1);
+	gl_Position = cameraMVP * worldPosition;
+
+	uv = vertexUV;
+	distanceToCamera = length(worldPosition.xyz - cameraPos);
+
+	// Fade towards death. A shifted copy jumps whenever its own age wraps or the canonical
+	// particle respawns on a new path, so it is also faded out on either side of both.
+	alpha = clamp(0.6 - (age / lifetime) * 0.6, 0.0, 1.0);
+	float fade = 0.1 * lifetime;
+	alpha *= smoothstep(0.0, fade, age) * smoothstep(0.0, fade, lifeAgeSeed.y) * smoothstep(0.0, fade, lifetime - lifeAgeSeed.y);
+}
@@ -0,0 +1,54 @@
+#version 330 core
+
+// Renders particles straight from the GPU simulation state (see particle_update.vert)
+
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 2) in vec2 vertexUV;
+layout(location = 3) in vec4 positionSpeed;
+layout(location = 4) in vec3 lifeAgeSeed;
+
+out vec2 uv;
+out float alpha;
+out float distanceToCamera;	// Close enough to linear across a particle to interpolate
+
+uniform mat4 cameraMVP;
+uniform vec3 cameraPos;
+uniform vec4 emitters[16];		// w = live particles to draw (0 if the emitter is hidden)
+uniform float emitterScales[16];	// Particle size, grown as live counts are reduced
+uniform int particlesPerEmitter;
+uniform int firstParticle;		// Pool index of instance 0
+
+void main() {
+	// Dead particles, particles past the live count and hidden emitters collapse to a degenerate triangle
+	int particle = firstParticle + gl_InstanceID;
+	int emitter = particle / particlesPerEmitter;
+	if (float(particle % particlesPerEmitter) >= emitters[emitter].w || lifeAgeSeed.x <= 0.0) {
+		gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+		uv = vertexUV;
+		alpha = 0.0;
+		distanceToCamera = 0.0;
+		return;
+	}
+
+	// Compute rotation matrix to ensure vertex faces the camera
+    vec3 position = positionSpeed.xyz;
+	vec3 toCamera = normalize(cameraPos - position);
+	vec3 up = vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(up, toCamera));
+	up = cross(toCamera, right);
+	mat4 instanceMatrix = mat4(1.0f);
+	instanceMatrix[0] = vec4(right, 0.0f);
+	instanceMatrix[1] = vec4(up, 0.0f);
+	instanceMatrix[2] = vec4(toCamera, 0.0f);
+	instanceMatrix[3] = vec4(position, 1.0f);
+
+	vec3 scaledPosition = vertexPosition * emitterScales[emitter];
+	vec4 worldPosition = instanceMatrix * vec4(scaledPosition, 1);
+    gl_Position = cameraMVP * worldPosition;
+
+    uv = vertexUV;
+	distanceToCamera = length(worldPosition.xyz - cameraPos);
+
+	// Fade towards death
+	alpha = clamp(0.6 - (lifeAgeSeed.y / lifeAgeSeed.x) * 0.6, 0.0, 1.0);
+}
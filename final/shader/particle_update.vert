@@ -0,0 +1,67 @@
+#version 330 core
+
+// GPU particle simulation, captured with transform feedback (no rasterisation)
+
+layout(location = 0) in vec4 positionSpeed;	// xyz = position, w = rise speed
+layout(location = 1) in vec3 lifeAgeSeed;	// x = lifetime, y = age, z = RNG state
+
+out vec4 outPositionSpeed;
+out vec3 outLifeAgeSeed;
+
+uniform float deltaTime;
+uniform vec4 emitters[16];		// xyz = centre, w = live particles in the emitter's block (0 when freed)
+uniform int particlesPerEmitter;
+uniform float emitterRadius;
+
+const float PI = 3.14159265;
+
+// Integer hash (PCG output permutation)
+uint hash(uint x) {
+    uint state = x * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(inout uint state) {
+    state = hash(state);
+    return float(state & 0xFFFFFFu) / 16777216.0;
+}
+
+void main()
+{
+    vec3 position = positionSpeed.xyz;
+    float speed = positionSpeed.w;
+    float lifetime = lifeAgeSeed.x;
+    float age = lifeAgeSeed.y + deltaTime;
+    uint state = uint(lifeAgeSeed.z) ^ (uint(gl_VertexID) * 9781u);
+
+    // Particles of a freed block or past the live count stay dead and respawn once back in use
+    vec4 emitter = emitters[gl_VertexID / particlesPerEmitter];
+    if (float(gl_VertexID % particlesPerEmitter) >= emitter.w) {
+        outPositionSpeed = vec4(0.0);
+        outLifeAgeSeed = vec3(0.0, 0.0, float(state & 0xFFFFFFu));
+        return;
+    }
+    vec3 emitterCenter = emitter.xyz;
+
+    if (age >= lifetime) {
+        // Respawn somewhere in the disc around the lamp, with the same distribution as the CPU path
+        float angle = random(state) * 2.0 * PI;
+        float radius = random(state) * emitterRadius;
+        float startHeight = floor(random(state) * 50.0);
+        speed = 5.0 + floor(random(state) * 15.0);
+        float extraLifetime = floor(random(state) * 10.0);
+
+        position = vec3(emitterCenter.x + radius * cos(angle), startHeight, emitterCenter.z + radius * sin(angle));
+        lifetime = mix(2.0, 10.0, 1.0 - radius / emitterRadius) + extraLifetime;
+        age = 0.0;
+    }
+    else {
+        // Move particle upward with a slight horizontal drift
+        position.y += speed * deltaTime;
+        position.x += (random(state) < 0.5 ? 1.0 : -1.0) * 0.5 * deltaTime;
+    }
+
+    outPositionSpeed = vec4(position, speed);
+    outLifeAgeSeed = vec3(lifetime, age, float(state & 0xFFFFFFu));
+}
@@ -15,8 +15,8 @@ out vec2 uv;
 uniform mat4 MVP;
 
 void main() {
-    // Transform vertex
-    gl_Position =  MVP * vec4(vertexPosition, 1);
+    // Transform vertex, pinned to the far plane so it only fills pixels nothing else covered
+    gl_Position = (MVP * vec4(vertexPosition, 1)).xyww;
     
     // Pass vertex color to the fragment shader
     color = vertexColor;
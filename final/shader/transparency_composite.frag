@@ -0,0 +1,71 @@
+#version 330 core
+
+in vec2 uv;
+
+// Weighted blended OIT targets: accum.rgb = sum(colour * alpha * weight), accum.a = product(1 - alpha),
+// weight.r = sum(alpha * weight)
+uniform sampler2D accumTexture;
+uniform sampler2D weightTexture;
+
+// The same targets at reduced resolution for particles, with the depth they were tested against
+uniform int lowResolution;
+uniform sampler2D particleAccumTexture;
+uniform sampler2D particleWeightTexture;
+uniform sampler2D particleDepth;
+uniform sampler2D sceneDepth;
+uniform vec2 clipPlanes;			// Camera near and far
+
+out vec4 finalColor;
+
+float linearDepth(float depth) {
+	float z = depth * 2.0 - 1.0;
+	return 2.0 * clipPlanes.x * clipPlanes.y / (clipPlanes.y + clipPlanes.x - z * (clipPlanes.y - clipPlanes.x));
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 accum = texelFetch(accumTexture, pixel, 0);
+	float weight = texelFetch(weightTexture, pixel, 0).r;
+
+	if (lowResolution == 1) {
+		// Bilateral upsample: bilinear weights of the four nearest low-resolution texels, scaled down
+		// where their depth differs from this pixel's so particles do not bleed across edges
+		ivec2 lowSize = textureSize(particleAccumTexture, 0);
+		vec2 position = uv * vec2(lowSize) - 0.5;
+		ivec2 base = ivec2(floor(position));
+		vec2 f = fract(position);
+		float depth = linearDepth(texelFetch(sceneDepth, pixel, 0).r);
+
+		vec4 lowAccum = vec4(0.0);
+		float lowWeight = 0.0;
+		float totalWeight = 0.0;
+		for (int i = 0; i < 4; ++i) {
+			ivec2 offset = ivec2(i & 1, i >> 1);
+			ivec2 texel = clamp(base + offset, ivec2(0), lowSize - 1);
+			vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+			float lowDepth = linearDepth(texelFetch(particleDepth, texel, 0).r);
+			float tapWeight = bilinear.x * bilinear.y / (0.001 + abs(lowDepth - depth) / depth);
+			lowAccum += texelFetch(particleAccumTexture, texel, 0) * tapWeight;
+			lowWeight += texelFetch(particleWeightTexture, texel, 0).r * tapWeight;
+			totalWeight += tapWeight;
+		}
+
+		// Both buffers hold sums and products, so they merge exactly
+		if (totalWeight > 0.0) {
+			lowAccum /= totalWeight;
+			lowWeight /= totalWeight;
+			accum.rgb += lowAccum.rgb;
+			accum.a *= lowAccum.a;
+			weight += lowWeight;
+		}
+	}
+
+	// Nothing transparent covers this pixel
+	float revealage = accum.a;
+	if (revealage >= 1.0) {
+		discard;
+	}
+
+	finalColor = vec4(accum.rgb / max(weight, 1e-5), 1.0 - revealage);
+}
@@ -1,5 +1,7 @@
 #include <render/shader.h>
 #include <render/texture.h>
+#include <render/assets.h>
+#include <render/geometry.h>
 
 struct Skybox {
 	glm::vec3 position;
@@ -140,12 +142,10 @@ struct Skybox {
 		0.499f, 0.666f
 	};
 
+	// Range of the box in the shared static geometry
+	MeshRange mesh;
+
 	// OpenGL buffers
-	GLuint vertexArrayID;
-	GLuint vertexBufferID;
-	GLuint indexBufferID;
-	GLuint colorBufferID;
-	GLuint uvBufferID;
 	GLuint textureID;
 
 	// Shader variable IDs
@@ -158,31 +158,15 @@ struct Skybox {
 		this->position = position;
 		this->scale = scale;
 
-		// Create a vertex array object
-		glGenVertexArrays(1, &vertexArrayID);
-		glBindVertexArray(vertexArrayID);
-
-		// Create a vertex buffer object to store the vertex data		
-		glGenBuffers(1, &vertexBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the color data
+		// Interleave into the shared static geometry; the colour goes in the normal slot (location 1)
 		for (int i = 0; i < 72; ++i) color_buffer_data[i] = 1.0f;
-		glGenBuffers(1, &colorBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
-
-		// Create a vertex buffer object to store the UV data
-		for (int i = 0; i < 24; ++i) uv_buffer_data[2 * i + 1] *= 1;
-		glGenBuffers(1, &uvBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
-
-		// Create an index buffer object to store the index data that defines triangle faces
-		glGenBuffers(1, &indexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+		StaticVertex vertices[24];
+		for (int i = 0; i < 24; ++i) {
+			vertices[i].position = glm::vec3(vertex_buffer_data[3 * i], vertex_buffer_data[3 * i + 1], vertex_buffer_data[3 * i + 2]);
+			vertices[i].normal = glm::vec3(color_buffer_data[3 * i], color_buffer_data[3 * i + 1], color_buffer_data[3 * i + 2]);
+			vertices[i].uv = glm::vec2(uv_buffer_data[2 * i], uv_buffer_data[2 * i + 1]);
+		}
+		mesh = StaticGeometry().addMesh(vertices, 24, index_buffer_data, 36);
 
 		// Create and compile our GLSL program from the shaders
 		programID = LoadShadersFromFile("../final/shader/sky.vert", "../final/shader/sky.frag");
@@ -192,7 +176,7 @@ struct Skybox {
 		}
 
 		// Load the texture into GPU memory
-		textureID = LoadTextureTileBox("../final/assets/stars.png");
+		textureID = Assets().loadTexture("../final/assets/stars.png", PRIORITY_LOW);
 
 		// Get a handle for GLSL variables
 		mvpMatrixID = glGetUniformLocation(programID, "MVP");
@@ -206,21 +190,7 @@ struct Skybox {
 	void render(glm::mat4 cameraMatrix) {
 		glUseProgram(programID);
 
-		glBindVertexArray(vertexArrayID);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		StaticGeometry().bind();
 
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, textureID);
@@ -237,19 +207,15 @@ struct Skybox {
 		glm::mat4 mvp = cameraMatrix * modelMatrix;
 		glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
 
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		// Drawn after the opaque scene at the far plane (see sky.vert)
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_FALSE);
+		glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, (void*)(mesh.firstIndex * sizeof(GLuint)), mesh.baseVertex);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
 	}
 
 	void cleanup() {
-		glDeleteBuffers(1, &vertexBufferID);
-		glDeleteBuffers(1, &colorBufferID);
-		glDeleteBuffers(1, &indexBufferID);
-		glDeleteVertexArrays(1, &vertexArrayID);
-		glDeleteBuffers(1, &uvBufferID);
 		glDeleteTextures(1, &textureID);
 		glDeleteProgram(programID);
 	}
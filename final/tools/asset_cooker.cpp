@@ -0,0 +1,479 @@
+// Offline converter from the authoring formats to cooked packages (see render/package.h)
+//   asset_cooker texture <out.pkg> <image>                 RGB texture and its mip chain
+//   asset_cooker array <out.pkg> <image> [<image>...]      RGB texture array, layers sized to the first
+//   asset_cooker model <out.pkg> <model.gltf>              static model: geometry, materials, textures, bounds
+//   asset_cooker animation <out.pkg> <model.gltf>          compressed animation clips
+// The game looks for packages in final/cooked, at the source's path under final/, and loads the
+// source asset when there is none or one of the files recorded in it has changed since.
+#ifndef TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_IMPLEMENTATION
+#endif
+#include <render/texture.h>
+#include <render/package.h>
+#include <clip.cpp>
+#include <cfloat>
+#include <unordered_map>
+
+// Post-transform cache the triangle order is tuned for; the score falls off over its entries
+static const size_t VERTEX_CACHE_SIZE = 32;
+
+static PackageTexture addTexture(const ImageData& image, std::vector<uint8_t>& pixels) {
+	int levels = 0;
+	std::vector<uint8_t> chain = BuildMipChain(image, levels);
+
+	PackageTexture texture = {};
+	texture.width = image.width;
+	texture.height = image.height;
+	texture.layers = image.layers;
+	texture.channels = image.channels;
+	texture.levels = levels;
+	texture.firstPixel = pixels.size();
+	pixels.insert(pixels.end(), chain.begin(), chain.end());
+	return texture;
+}
+
+static std::string directoryOf(const std::string& path) {
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// Path of a file as seen from a directory (both relative to the same place, or both absolute)
+static std::string relativePath(const std::string& directory, const std::string& path) {
+	size_t common = 0;
+	for (size_t i = 0; i < directory.size() && i < path.size() && directory[i] == path[i]; ++i) {
+		if (directory[i] == '/' || directory[i] == '\\') common = i + 1;
+	}
+	std::string relative;
+	for (size_t i = common; i < directory.size(); ++i) {
+		if (directory[i] == '/' || directory[i] == '\\') relative += "../";
+	}
+	return relative + path.substr(common);
+}
+
+// The cooked asset first, then anything else it reads, named as the game will find them
+static bool addSources(PackageWriter& writer, const std::string& assetPath, const std::vector<std::string>& otherPaths) {
+	std::string directory = directoryOf(assetPath);
+	bool recorded = writer.addSource(assetPath, assetPath.substr(directory.size()));
+	for (const auto& path : otherPaths) {
+		recorded = writer.addSource(path, relativePath(directory, path)) && recorded;
+	}
+	return recorded;
+}
+
+static bool writeTexture(PackageWriter& writer, const char* outPath, const ImageData& image) {
+	std::vector<PackageTexture> textures;
+	std::vector<uint8_t> pixels;
+	textures.push_back(addTexture(image, pixels));
+
+	writer.add(SECTION_TEXTURES, textures);
+	writer.add(SECTION_PIXELS, pixels);
+	if (!writer.write(outPath)) {
+		return false;
+	}
+	std::cout << "Cooked " << outPath << ": " << image.width << "x" << image.height << "x" << image.layers
+		<< ", " << textures[0].levels << " levels" << std::endl;
+	return true;
+}
+
+static bool cookTexture(const char* outPath, const char* imagePath) {
+	ImageData image;
+	PackageWriter writer;
+	return addSources(writer, imagePath, {}) && DecodeImage(imagePath, 3, image) && writeTexture(writer, outPath, image);
+}
+
+static bool cookTextureArray(const char* outPath, const std::vector<const char*>& imagePaths) {
+	PackageWriter writer;
+	std::vector<std::string> layers(imagePaths.begin() + 1, imagePaths.end());
+	return addSources(writer, imagePaths[0], layers) && writeTexture(writer, outPath, DecodeTextureArray(imagePaths));
+}
+
+// Every element of an accessor as floats; normalised integers are scaled to [0, 1] as at load time
+static std::vector<float> readFloats(const tinygltf::Model& model, const tinygltf::Accessor& accessor) {
+	int components = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : accessor.type;
+	std::vector<float> values(accessor.count * components, 0.0f);
+	if (accessor.bufferView < 0) {
+		return values;
+	}
+
+	const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+	const unsigned char* data = &model.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+	int stride = accessor.ByteStride(bufferView);
+	for (size_t i = 0; i < accessor.count; ++i) {
+		const unsigned char* element = data + i * stride;
+		for (int c = 0; c < components; ++c) {
+			float value;
+			switch (accessor.componentType) {
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+				value = element[c] / (accessor.normalized ? 255.0f : 1.0f);
+				break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+				value = reinterpret_cast<const uint16_t*>(element)[c] / (accessor.normalized ? 65535.0f : 1.0f);
+				break;
+			default:
+				value = reinterpret_cast<const float*>(element)[c];
+				break;
+			}
+			values[i * components + c] = value;
+		}
+	}
+	return values;
+}
+
+static std::vector<uint32_t> readIndices(const tinygltf::Model& model, const tinygltf::Accessor& accessor) {
+	std::vector<uint32_t> indices(accessor.count);
+	const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+	const unsigned char* data = &model.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+	for (size_t i = 0; i < accessor.count; ++i) {
+		switch (accessor.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			indices[i] = data[i];
+			break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+			indices[i] = reinterpret_cast<const uint16_t*>(data)[i];
+			break;
+		default:
+			indices[i] = reinterpret_cast<const uint32_t*>(data)[i];
+			break;
+		}
+	}
+	return indices;
+}
+
+// Merge vertices whose every attribute is identical, rewriting the indices to match
+static std::vector<PackageVertex> weldVertices(const std::vector<PackageVertex>& vertices, std::vector<uint32_t>& indices) {
+	std::vector<PackageVertex> welded;
+	std::vector<uint32_t> remap(vertices.size());
+	std::unordered_map<std::string, uint32_t> unique;
+	for (size_t v = 0; v < vertices.size(); ++v) {
+		std::string key(reinterpret_cast<const char*>(&vertices[v]), sizeof(PackageVertex));
+		auto found = unique.find(key);
+		if (found == unique.end()) {
+			found = unique.emplace(key, static_cast<uint32_t>(welded.size())).first;
+			welded.push_back(vertices[v]);
+		}
+		remap[v] = found->second;
+	}
+	for (auto& index : indices) index = remap[index];
+	return welded;
+}
+
+// Transformed vertices per triangle through a FIFO cache of VERTEX_CACHE_SIZE; 0.5 is the ideal
+static float averageCacheMissRatio(const std::vector<uint32_t>& indices) {
+	std::vector<uint32_t> cache;
+	size_t misses = 0;
+	for (uint32_t index : indices) {
+		if (std::find(cache.begin(), cache.end(), index) != cache.end()) continue;
+		misses++;
+		cache.insert(cache.begin(), index);
+		if (cache.size() > VERTEX_CACHE_SIZE) cache.pop_back();
+	}
+	return indices.empty() ? 0.0f : static_cast<float>(misses) / (indices.size() / 3);
+}
+
+// Forsyth's score: vertices already in the cache, and those with few triangles left, go first
+static float vertexScore(int cachePosition, int remainingTriangles) {
+	if (remainingTriangles == 0) {
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		// The last triangle's vertices score lower, so strips don't double back on themselves
+		score = cachePosition < 3 ? 0.75f : powf(1.0f - (cachePosition - 3) / (VERTEX_CACHE_SIZE - 3.0f), 1.5f);
+	}
+	return score + 2.0f * powf(static_cast<float>(remainingTriangles), -0.5f);
+}
+
+// Reorder triangles for the post-transform vertex cache (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+static void optimiseTriangleOrder(std::vector<uint32_t>& indices, size_t vertexCount) {
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// Triangles using each vertex; the first remaining[v] entries of its range are still unemitted
+	std::vector<int> remaining(vertexCount, 0);
+	for (uint32_t index : indices) remaining[index]++;
+	std::vector<size_t> firstTriangle(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v) firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<size_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (size_t i = 0; i < indices.size(); ++i) adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> scores(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v) scores[v] = vertexScore(-1, remaining[v]);
+	std::vector<float> triangleScores(triangleCount, 0.0f);
+	for (size_t i = 0; i < indices.size(); ++i) triangleScores[i / 3] += scores[indices[i]];
+	std::vector<bool> emitted(triangleCount, false);
+
+	std::vector<uint32_t> ordered;
+	ordered.reserve(indices.size());
+	std::vector<uint32_t> cache, nextCache;
+	long best = std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin();
+	size_t scan = 0;
+	while (ordered.size() < triangleCount * 3) {
+		// Nothing in the cache has triangles left, so start again from the best of the rest
+		if (best < 0) {
+			float bestScore = -FLT_MAX;
+			for (; scan < triangleCount && emitted[scan]; ++scan) {}
+			for (size_t t = scan; t < triangleCount; ++t) {
+				if (!emitted[t] && triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					best = static_cast<long>(t);
+				}
+			}
+		}
+
+		const uint32_t* triangle = &indices[best * 3];
+		ordered.insert(ordered.end(), triangle, triangle + 3);
+		emitted[best] = true;
+
+		// Drop the triangle from each vertex's remaining list, and move its vertices to the front of the cache
+		nextCache.assign(triangle, triangle + 3);
+		for (int c = 0; c < 3; ++c) {
+			uint32_t v = triangle[c];
+			uint32_t* list = &adjacency[firstTriangle[v]];
+			int count = remaining[v];
+			for (int i = 0; i < count; ++i) {
+				if (list[i] == static_cast<uint32_t>(best)) {
+					std::swap(list[i], list[count - 1]);
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+		for (uint32_t v : cache) {
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2]) nextCache.push_back(v);
+		}
+
+		// Rescore everything that moved, including the vertices pushed out the end, then take the
+		// best triangle among theirs
+		for (size_t i = 0; i < nextCache.size(); ++i) {
+			uint32_t v = nextCache[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? static_cast<int>(i) : -1;
+			float score = vertexScore(cachePosition[v], remaining[v]);
+			const uint32_t* list = &adjacency[firstTriangle[v]];
+			for (int t = 0; t < remaining[v]; ++t) triangleScores[list[t]] += score - scores[v];
+			scores[v] = score;
+		}
+		best = -1;
+		float bestScore = -FLT_MAX;
+		for (uint32_t v : nextCache) {
+			const uint32_t* list = &adjacency[firstTriangle[v]];
+			for (int t = 0; t < remaining[v]; ++t) {
+				if (triangleScores[list[t]] > bestScore) {
+					bestScore = triangleScores[list[t]];
+					best = list[t];
+				}
+			}
+		}
+		if (nextCache.size() > VERTEX_CACHE_SIZE) nextCache.resize(VERTEX_CACHE_SIZE);
+		cache.swap(nextCache);
+	}
+	indices.swap(ordered);
+}
+
+// Renumber vertices in the order the indices first use them, so fetches walk the buffer forwards
+static std::vector<PackageVertex> orderVerticesByFirstUse(const std::vector<PackageVertex>& vertices, std::vector<uint32_t>& indices) {
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<PackageVertex> ordered;
+	ordered.reserve(vertices.size());
+	for (auto& index : indices) {
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = static_cast<uint32_t>(ordered.size());
+			ordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	return ordered;
+}
+
+// Parse the glTF and record it, with the buffers and images it refers to, as the package's sources
+static bool loadSource(const char* modelPath, tinygltf::Model& model, PackageWriter& writer) {
+	tinygltf::TinyGLTF loader;
+	std::string err, warn;
+	bool loaded = loader.LoadASCIIFromFile(&model, &err, &warn, modelPath);
+	if (!warn.empty()) std::cout << "WARN: " << warn << std::endl;
+	if (!err.empty()) std::cout << "ERR: " << err << std::endl;
+	if (!loaded) {
+		std::cout << "Failed to load glTF: " << modelPath << std::endl;
+		return false;
+	}
+
+	std::string directory = directoryOf(modelPath);
+	std::vector<std::string> files;
+	for (const auto& buffer : model.buffers) {
+		if (!buffer.uri.empty() && buffer.uri.compare(0, 5, "data:") != 0) files.push_back(directory + buffer.uri);
+	}
+	for (const auto& image : model.images) {
+		if (!image.uri.empty() && image.uri.compare(0, 5, "data:") != 0) files.push_back(directory + image.uri);
+	}
+	return addSources(writer, modelPath, files);
+}
+
+// Everything StaticModel::bindModel reads from the glTF, in the shape it ends up in
+static bool cookModel(const char* outPath, const char* modelPath) {
+	tinygltf::Model model;
+	PackageWriter writer;
+	if (!loadSource(modelPath, model, writer)) {
+		return false;
+	}
+
+	std::vector<PackageTexture> textures;
+	std::vector<uint8_t> pixels;
+	for (const auto& texture : model.textures) {
+		ImageData image;
+		if (texture.source >= 0 && model.images[texture.source].bits == 8) {
+			const tinygltf::Image& source = model.images[texture.source];
+			image.width = source.width;
+			image.height = source.height;
+			image.layers = 1;
+			image.channels = source.component;
+			image.pixels = source.image;
+		}
+		textures.push_back(addTexture(image, pixels));
+	}
+
+	std::vector<PackageVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<PackagePrimitive> primitives;
+	PackageBounds bounds = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+	float missesBefore = 0.0f, missesAfter = 0.0f;
+	size_t sourceVertices = 0;
+
+	for (const auto& mesh : model.meshes) {
+		for (const auto& primitive : mesh.primitives) {
+			auto position = primitive.attributes.find("POSITION");
+			if (position == primitive.attributes.end()) {
+				continue;
+			}
+			std::vector<PackageVertex> meshVertices(model.accessors[position->second].count, PackageVertex());
+			for (const auto& attrib : primitive.attributes) {
+				int components = attrib.first == "POSITION" || attrib.first == "NORMAL" ? 3 : attrib.first == "TEXCOORD_0" ? 2 : 0;
+				if (components == 0) {
+					continue;
+				}
+				std::vector<float> values = readFloats(model, model.accessors[attrib.second]);
+				for (size_t v = 0; v < meshVertices.size(); ++v) {
+					float* target = attrib.first == "POSITION" ? meshVertices[v].position :
+						attrib.first == "NORMAL" ? meshVertices[v].normal : meshVertices[v].uv;
+					std::copy(&values[v * components], &values[v * components] + components, target);
+				}
+			}
+
+			std::vector<uint32_t> meshIndices;
+			if (primitive.indices >= 0) {
+				meshIndices = readIndices(model, model.accessors[primitive.indices]);
+			}
+			else {
+				meshIndices.resize(meshVertices.size());
+				for (size_t v = 0; v < meshIndices.size(); ++v) meshIndices[v] = v;
+			}
+
+			sourceVertices += meshVertices.size();
+			missesBefore += averageCacheMissRatio(meshIndices) * meshIndices.size();
+			meshVertices = weldVertices(meshVertices, meshIndices);
+			optimiseTriangleOrder(meshIndices, meshVertices.size());
+			meshVertices = orderVerticesByFirstUse(meshVertices, meshIndices);
+			missesAfter += averageCacheMissRatio(meshIndices) * meshIndices.size();
+
+			for (const auto& vertex : meshVertices) {
+				for (int c = 0; c < 3; ++c) {
+					bounds.min[c] = std::min(bounds.min[c], vertex.position[c]);
+					bounds.max[c] = std::max(bounds.max[c], vertex.position[c]);
+				}
+			}
+
+			PackagePrimitive packagePrimitive = {};
+			packagePrimitive.firstVertex = static_cast<uint32_t>(vertices.size());
+			packagePrimitive.vertexCount = static_cast<uint32_t>(meshVertices.size());
+			packagePrimitive.firstIndex = static_cast<uint32_t>(indices.size());
+			packagePrimitive.indexCount = static_cast<uint32_t>(meshIndices.size());
+			packagePrimitive.texture = -1;
+			std::fill(packagePrimitive.baseColorFactor, packagePrimitive.baseColorFactor + 4, 1.0f);
+			if (primitive.material >= 0) {
+				const tinygltf::Material& material = model.materials[primitive.material];
+				packagePrimitive.texture = material.pbrMetallicRoughness.baseColorTexture.index;
+				if (material.pbrMetallicRoughness.baseColorFactor.size() == 4) {
+					for (int c = 0; c < 4; ++c) {
+						packagePrimitive.baseColorFactor[c] = static_cast<float>(material.pbrMetallicRoughness.baseColorFactor[c]);
+					}
+				}
+				if (material.extensions.count("KHR_materials_unlit")) packagePrimitive.flags |= PACKAGE_MATERIAL_UNLIT;
+				if (material.alphaMode == "BLEND" || packagePrimitive.baseColorFactor[3] < 1.0f) {
+					packagePrimitive.flags |= PACKAGE_MATERIAL_BLEND;
+				}
+			}
+			primitives.push_back(packagePrimitive);
+			vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+			indices.insert(indices.end(), meshIndices.begin(), meshIndices.end());
+		}
+	}
+
+	writer.add(SECTION_VERTICES, vertices);
+	writer.add(SECTION_INDICES, indices);
+	writer.add(SECTION_PRIMITIVES, primitives);
+	writer.add(SECTION_BOUNDS, std::vector<PackageBounds>(1, bounds));
+	writer.add(SECTION_TEXTURES, textures);
+	writer.add(SECTION_PIXELS, pixels);
+	if (!writer.write(outPath)) {
+		return false;
+	}
+
+	float indexCount = std::max<float>(indices.size(), 1.0f);
+	std::cout << "Cooked " << outPath << ": " << primitives.size() << " primitive(s), " << sourceVertices << " -> "
+		<< vertices.size() << " vertices, ACMR " << std::setprecision(3) << missesBefore / indexCount << " -> "
+		<< missesAfter / indexCount << ", " << textures.size() << " texture(s)" << std::endl;
+	return true;
+}
+
+// Clips compressed with the default settings AnimatedModel uses
+static bool cookAnimation(const char* outPath, const char* modelPath) {
+	tinygltf::Model model;
+	PackageWriter writer;
+	if (!loadSource(modelPath, model, writer)) {
+		return false;
+	}
+
+	ClipCompressionSettings settings;
+	std::vector<CompressedClip> clips;
+	for (const auto& anim : model.animations) {
+		CompressedClip clip;
+		clip.build(model, anim, settings);
+		clips.push_back(clip);
+	}
+
+	AddCookedClips(writer, clips);
+	if (!writer.write(outPath)) {
+		return false;
+	}
+	std::cout << "Cooked " << outPath << ": " << clips.size() << " animation clip(s)" << std::endl;
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 4) {
+		std::cerr << "Usage: asset_cooker texture|array|model|animation <out.pkg> <source>..." << std::endl;
+		return 1;
+	}
+
+	std::string mode = argv[1];
+	const char* outPath = argv[2];
+	bool cooked = false;
+	if (mode == "texture") {
+		cooked = cookTexture(outPath, argv[3]);
+	}
+	else if (mode == "array") {
+		cooked = cookTextureArray(outPath, std::vector<const char*>(argv + 3, argv + argc));
+	}
+	else if (mode == "model") {
+		cooked = cookModel(outPath, argv[3]);
+	}
+	else if (mode == "animation") {
+		cooked = cookAnimation(outPath, argv[3]);
+	}
+	else {
+		std::cerr << "Unknown mode: " << mode << std::endl;
+	}
+	return cooked ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#include <render/shader.h>
+#include <render/graph.h>
+
+// Weighted blended order-independent transparency (McGuire & Bavoil). Transparent surfaces add
+// premultiplied, depth-weighted colour into an accumulation target and multiply their coverage
+// into a revealage channel, so they need no sorting and cost the same however many there are.
+//
+// GL 3.3 has one blend function for every attachment, so the targets are laid out to need just
+// one: RGB is additive and alpha is multiplicative (accum.a is the revealage), and the weight sum
+// goes into the RGB of a second target.
+//
+// Particles can be drawn into a second, reduced-resolution pair of targets tested against a
+// downsampled copy of the scene depth; the pairs merge exactly when resolved.
+//
+// The targets are render graph textures: addPasses declares the transparent, particle and resolve
+// passes after the opaque scene has been declared.
+struct Transparency {
+
+	// Particles at 1 / resolutionDivisor of the screen (2 = half, 4 = quarter)
+	bool lowResolutionParticles = true;
+	int resolutionDivisor = 2;
+	float zNear, zFar;
+
+	GLuint vertexArrayID;
+	GLuint downsampleProgramID;
+	GLuint downsampleDepthID;
+	GLuint downsampleFactorID;
+	GLuint compositeProgramID;
+	GLuint compositeAccumID;
+	GLuint compositeWeightID;
+	GLuint compositeLowResolutionID;
+	GLuint compositeParticleAccumID;
+	GLuint compositeParticleWeightID;
+	GLuint compositeParticleDepthID;
+	GLuint compositeSceneDepthID;
+	GLuint compositeClipPlanesID;
+
+	void initialize(float zNear, float zFar) {
+		this->zNear = zNear;
+		this->zFar = zFar;
+
+		// Fullscreen passes generate their triangle from gl_VertexID but still need a VAO bound
+		glGenVertexArrays(1, &vertexArrayID);
+
+		downsampleProgramID = LoadShadersFromFile("../final/shader/fullscreen.vert", "../final/shader/depth_downsample.frag");
+		compositeProgramID = LoadShadersFromFile("../final/shader/fullscreen.vert", "../final/shader/transparency_composite.frag");
+		if (downsampleProgramID == 0 || compositeProgramID == 0)
+		{
+			std::cerr << "Failed to load transparency shaders." << std::endl;
+		}
+
+		// Get a handle for GLSL variables
+		downsampleDepthID = glGetUniformLocation(downsampleProgramID, "depthTexture");
+		downsampleFactorID = glGetUniformLocation(downsampleProgramID, "factor");
+		compositeAccumID = glGetUniformLocation(compositeProgramID, "accumTexture");
+		compositeWeightID = glGetUniformLocation(compositeProgramID, "weightTexture");
+		compositeLowResolutionID = glGetUniformLocation(compositeProgramID, "lowResolution");
+		compositeParticleAccumID = glGetUniformLocation(compositeProgramID, "particleAccumTexture");
+		compositeParticleWeightID = glGetUniformLocation(compositeProgramID, "particleWeightTexture");
+		compositeParticleDepthID = glGetUniformLocation(compositeProgramID, "particleDepth");
+		compositeSceneDepthID = glGetUniformLocation(compositeProgramID, "sceneDepth");
+		compositeClipPlanesID = glGetUniformLocation(compositeProgramID, "clipPlanes");
+	}
+
+	// drawTransparent and drawParticles issue the draws; blend and depth state are set here
+	void addPasses(RenderGraph& graph, int sceneColor, int sceneDepth, std::function<void()> drawTransparent, std::function<void()> drawParticles) {
+		// No colour, nothing covering (revealage 1), no weight
+		const glm::vec4 noCoverage(0.0f, 0.0f, 0.0f, 1.0f);
+
+		int accum = graph.createTexture("oitAccum", { GL_RGBA16F });
+		int weight = graph.createTexture("oitWeight", { GL_R16F });
+		bool lowResolution = lowResolutionParticles;
+		graph.addPass("transparent", [this, drawTransparent, drawParticles, lowResolution]() {
+			beginBlend();
+			drawTransparent();
+			if (!lowResolution) drawParticles();
+			endBlend();
+		}).color(accum, LoadOp::Clear, noCoverage).color(weight, LoadOp::Clear).depthTest(sceneDepth);
+
+		int particleAccum = -1, particleWeight = -1, particleDepth = -1;
+		if (lowResolution) {
+			particleAccum = graph.createTexture("particleAccum", { GL_RGBA16F, resolutionDivisor });
+			particleWeight = graph.createTexture("particleWeight", { GL_R16F, resolutionDivisor });
+			particleDepth = graph.createTexture("particleDepth", { GL_DEPTH_COMPONENT24, resolutionDivisor });
+
+			// The downsample covers every pixel, so the depth needs no clear
+			graph.addPass("particleDepth", [this, &graph, sceneDepth]() {
+				downsampleDepth(graph.texture(sceneDepth));
+			}).read(sceneDepth).depthStencil(particleDepth, LoadOp::DontCare);
+
+			graph.addPass("particles", [this, drawParticles]() {
+				beginBlend();
+				drawParticles();
+				endBlend();
+			}).color(particleAccum, LoadOp::Clear, noCoverage).color(particleWeight, LoadOp::Clear).depthTest(particleDepth);
+		}
+
+		GraphPass& resolve = graph.addPass("resolve", [this, &graph, accum, weight, particleAccum, particleWeight, particleDepth, sceneDepth]() {
+			composite(graph.texture(accum), graph.texture(weight),
+				particleAccum >= 0 ? graph.texture(particleAccum) : 0,
+				particleWeight >= 0 ? graph.texture(particleWeight) : 0,
+				particleDepth >= 0 ? graph.texture(particleDepth) : 0,
+				graph.texture(sceneDepth));
+		});
+		resolve.read(accum).read(weight).read(sceneDepth).color(sceneColor, LoadOp::Load);
+		if (lowResolution) {
+			resolve.read(particleAccum).read(particleWeight).read(particleDepth);
+		}
+	}
+
+	void beginBlend() {
+		// Tested against the opaque depth, never written
+		glDepthMask(GL_FALSE);
+		glEnable(GL_BLEND);
+		glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	}
+
+	void endBlend() {
+		glDisable(GL_BLEND);
+		glDepthMask(GL_TRUE);
+	}
+
+	// Write the maximum scene depth of each block into the bound (reduced resolution) depth buffer
+	void downsampleDepth(GLuint sceneDepth) {
+		glUseProgram(downsampleProgramID);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, sceneDepth);
+		glUniform1i(downsampleDepthID, 0);
+		glUniform1i(downsampleFactorID, resolutionDivisor);
+
+		glDepthMask(GL_TRUE);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthFunc(GL_ALWAYS);
+		glBindVertexArray(vertexArrayID);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glDepthFunc(GL_LESS);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+	// Average transparent colour over the bound scene colour by total coverage
+	void composite(GLuint accum, GLuint weight, GLuint particleAccum, GLuint particleWeight, GLuint particleDepth, GLuint sceneDepth) {
+		glUseProgram(compositeProgramID);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, accum);
+		glUniform1i(compositeAccumID, 0);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, weight);
+		glUniform1i(compositeWeightID, 1);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, particleAccum);
+		glUniform1i(compositeParticleAccumID, 2);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, particleWeight);
+		glUniform1i(compositeParticleWeightID, 3);
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, particleDepth);
+		glUniform1i(compositeParticleDepthID, 4);
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_2D, sceneDepth);
+		glUniform1i(compositeSceneDepthID, 5);
+		glUniform1i(compositeLowResolutionID, particleAccum != 0 ? 1 : 0);
+		glUniform2f(compositeClipPlanesID, zNear, zFar);
+
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBindVertexArray(vertexArrayID);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void cleanup() {
+		glDeleteVertexArrays(1, &vertexArrayID);
+		glDeleteProgram(downsampleProgramID);
+		glDeleteProgram(compositeProgramID);
+	}
+};